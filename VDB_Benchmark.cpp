@@ -0,0 +1,254 @@
+// OpenVDB_Softimage
+// VDB_Benchmark.cpp
+// openvdb_benchmark command, times the plugin's grid operations on a typical
+// level set and fog volume (or the grids of a given file) and logs the results
+
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_status.h>
+#include <xsi_argument.h>
+#include <xsi_command.h>
+
+#include <tbb/tick_count.h>
+#include <tbb/task_scheduler_init.h>
+
+#include <openvdb/openvdb.h>
+#include <openvdb/tools/LevelSetSphere.h>
+#include <openvdb/tools/LevelSetUtil.h>
+
+#include "VDB_Utils.h"
+#include "VDB_Node_Filter.h"
+
+using namespace XSI;
+
+namespace
+{
+   struct BenchmarkGrid
+   {
+      std::string label;
+      openvdb::GridBase::Ptr grid;
+   };
+
+   typedef std::vector<BenchmarkGrid> BenchmarkGridVec;
+
+   bool makeBenchmarkGrids(const std::string& path, double voxelSize, BenchmarkGridVec& grids)
+   {
+      if (!path.empty())
+      {
+         try
+         {
+            openvdb::io::File file(path);
+            file.open();
+            openvdb::GridPtrVecPtr fileGrids = file.getGrids();
+            file.close();
+            for (size_t i=0; fileGrids && i<fileGrids->size(); ++i)
+            {
+               BenchmarkGrid entry = { (*fileGrids)[i]->getName(), (*fileGrids)[i] };
+               grids.push_back(entry);
+            }
+         }
+         catch (openvdb::Exception& e)
+         {
+            Application().LogMessage(CString(e.what()) + L" : " + CString(path.c_str()), siErrorMsg);
+            return false;
+         }
+         return !grids.empty();
+      }
+
+      // a sphere of radius 10 is a few million voxels at the default voxel size
+      openvdb::FloatGrid::Ptr levelSet = openvdb::tools::createLevelSetSphere<openvdb::FloatGrid>(
+         10.0f, openvdb::Vec3f(0.0f), float(voxelSize));
+      levelSet->setName("levelset");
+
+      openvdb::FloatGrid::Ptr fog = levelSet->deepCopy();
+      openvdb::tools::sdfToFogVolume(*fog);
+      fog->setName("fog");
+
+      BenchmarkGrid levelSetEntry = { "level set", levelSet };
+      BenchmarkGrid fogEntry = { "fog volume", fog };
+      grids.push_back(levelSetEntry);
+      grids.push_back(fogEntry);
+      return true;
+   }
+
+   const char* codecName(int codec)
+   {
+      switch (codec)
+      {
+         case kCodecNone: return "none";
+         case kCodecZip: return "zip";
+         case kCodecBlosc: return "blosc";
+      }
+      return "";
+   }
+
+   // writes every grid with each codec and precision, the uncompressed full
+   // precision file is the reference for the ratio and the throughput
+   void benchmarkWrite(const BenchmarkGridVec& grids)
+   {
+      std::vector<int> codecs;
+      codecs.push_back(kCodecNone);
+      codecs.push_back(kCodecZip);
+      // blosc silently falls back to zip, don't report it twice
+      if (compressionFlags(kCodecBlosc) != compressionFlags(kCodecZip)) codecs.push_back(kCodecBlosc);
+
+      const std::string path = tempFilePath("openvdb_softimage_benchmark.vdb");
+
+      Application().LogMessage(L"[openvdb_benchmark] write: grid\tcodec\thalf\tsize\tratio\tMB/s");
+      for (size_t g=0; g<grids.size(); ++g)
+      {
+         openvdb::GridCPtrVec gridVec;
+         gridVec.push_back(grids[g].grid);
+
+         openvdb::Index64 referenceSize = 0;
+         for (size_t c=0; c<codecs.size(); ++c)
+         {
+            for (int half=0; half<2; ++half)
+            {
+               openvdb::GridCPtrVec flagged = gridsWithHalfFlags(gridVec, half != 0, half != 0);
+
+               tbb::tick_count start = tbb::tick_count::now();
+               try
+               {
+                  openvdb::io::File file(path);
+                  file.setCompression(compressionFlags(codecs[c]));
+                  file.write(flagged);
+                  file.close();
+               }
+               catch (openvdb::Exception& e)
+               {
+                  Application().LogMessage(CString(e.what()) + L" : " + CString(path.c_str()), siErrorMsg);
+                  continue;
+               }
+               double seconds = (tbb::tick_count::now() - start).seconds();
+
+               openvdb::Index64 size = 0;
+               fileSize(path, size);
+               if (!referenceSize) referenceSize = size;
+
+               std::ostringstream ostr;
+               ostr << std::setprecision(3) << "[openvdb_benchmark] write: " << grids[g].label << "\t"
+                  << codecName(codecs[c]) << "\t" << (half ? "yes" : "no") << "\t"
+                  << bytesAsString(size) << "\t"
+                  << (size ? double(referenceSize) / double(size) : 0.0) << "\t"
+                  << (seconds > 0.0 ? double(referenceSize) / double(1 << 20) / seconds : 0.0);
+               Application().LogMessage(CString(ostr.str().c_str()));
+            }
+         }
+      }
+      std::remove(path.c_str());
+   }
+
+   const char* filterName(int filter)
+   {
+      switch (filter)
+      {
+         case kFilterMean: return "mean";
+         case kFilterMedian: return "median";
+         case kFilterGaussian: return "gaussian";
+         case kFilterMeanCurvature: return "mean curvature";
+         case kFilterLaplacian: return "laplacian";
+         case kFilterOffset: return "offset";
+      }
+      return "";
+   }
+
+   // one iteration of every filter on a copy of each float grid, the
+   // throughput is reported in active voxels per second
+   void benchmarkFilter(const BenchmarkGridVec& grids, double voxelSize)
+   {
+      std::ostringstream header;
+      header << "[openvdb_benchmark] filter: grid\tfilter\tms\tMvoxels/s (" << tbb::task_scheduler_init::default_num_threads() << " threads)";
+      Application().LogMessage(CString(header.str().c_str()));
+
+      for (size_t g=0; g<grids.size(); ++g)
+      {
+         openvdb::FloatGrid::ConstPtr grid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(grids[g].grid);
+         if (!grid) continue;
+         const double voxelCount = double(grid->activeVoxelCount());
+
+         for (int filter=kFilterMean; filter<=kFilterOffset; ++filter)
+         {
+            openvdb::FloatGrid::Ptr copy = grid->deepCopy();
+            std::string error;
+
+            tbb::tick_count start = tbb::tick_count::now();
+            bool applied = VDB_Node_Filter::Apply(*copy, filter, 1, 1, float(voxelSize), NULL, error);
+            double seconds = (tbb::tick_count::now() - start).seconds();
+            // curvature flows don't apply to fog volumes
+            if (!applied) continue;
+
+            std::ostringstream ostr;
+            ostr << std::setprecision(3) << "[openvdb_benchmark] filter: " << grids[g].label << "\t"
+               << filterName(filter) << "\t" << seconds * 1000.0 << "\t"
+               << (seconds > 0.0 ? voxelCount / seconds / 1.0e6 : 0.0);
+            Application().LogMessage(CString(ostr.str().c_str()));
+         }
+      }
+   }
+}
+
+SICALLBACK openvdb_benchmark_Init (CRef& ref)
+{
+   Context ctxt(ref);
+   Command oCmd;
+   oCmd = ctxt.GetSource();
+   oCmd.PutDescription(L"time grid operations on a level set and a fog volume, or on the grids of a file");
+   oCmd.EnableReturnValue(true);
+
+   ArgumentArray oArgs;
+   oArgs = oCmd.GetArguments();
+   // write or filter
+   oArgs.Add(L"test", CString(L"write"));
+   oArgs.Add(L"file", CString());
+   oArgs.Add(L"voxelSize", 0.05);
+   return CStatus::OK;
+}
+
+SICALLBACK openvdb_benchmark_Execute (CRef& ref)
+{
+   Context ctxt(ref);
+   CValueArray args = ctxt.GetAttribute(L"Arguments");
+   CString test = args[0];
+   CString filename = args[1];
+   double voxelSize = args[2];
+
+   openvdb::initialize();
+
+   BenchmarkGridVec grids;
+   if (!makeBenchmarkGrids(filename.GetAsciiString(), voxelSize, grids))
+   {
+      Application().LogMessage(L"No grids to benchmark!", siErrorMsg);
+      ctxt.PutAttribute(L"ReturnValue", false);
+      return CStatus::Fail;
+   }
+
+   for (size_t g=0; g<grids.size(); ++g)
+   {
+      Application().LogMessage(L"[openvdb_benchmark] " + CString(grids[g].label.c_str()) + L"\t"
+         + CString(sizeAsString(grids[g].grid->activeVoxelCount(), " Voxels").c_str()) + L"\t"
+         + CString(bytesAsString(grids[g].grid->memUsage()).c_str()));
+   }
+
+   if (test == L"write")
+   {
+      benchmarkWrite(grids);
+   }
+   else if (test == L"filter")
+   {
+      benchmarkFilter(grids, voxelSize);
+   }
+   else
+   {
+      Application().LogMessage(L"Unknown benchmark " + test, siErrorMsg);
+      ctxt.PutAttribute(L"ReturnValue", false);
+      return CStatus::Fail;
+   }
+
+   ctxt.PutAttribute(L"ReturnValue", true);
+   return CStatus::OK;
+}
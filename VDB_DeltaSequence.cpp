@@ -0,0 +1,409 @@
+// OpenVDB_Softimage
+// VDB_DeltaSequence.cpp
+// sequence format storing only the leaf nodes that changed between frames
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <xsi_application.h>
+
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <openvdb/tree/LeafManager.h>
+
+#include "VDB_DeltaSequence.h"
+#include "VDB_Utils.h"
+
+static const char* kDeltaBaseMeta = "vdb_delta_base";
+static const char* kDeltaIdMeta = "vdb_delta_id";
+static const char* kDeltaBaseIdMeta = "vdb_delta_base_id";
+static const char* kKeepSuffix = ".delta_keep";
+
+namespace
+{
+   std::string fileName(const std::string& path)
+   {
+      size_t pos = path.find_last_of("/\\");
+      return pos == std::string::npos ? path : path.substr(pos + 1);
+   }
+
+   std::string siblingPath(const std::string& path, const std::string& name)
+   {
+      size_t pos = path.find_last_of("/\\");
+      return pos == std::string::npos ? name : path.substr(0, pos + 1) + name;
+   }
+
+   std::string stringMeta(const openvdb::MetaMap& meta, const char* name)
+   {
+      openvdb::StringMetadata::ConstPtr value = meta.getMetadata<openvdb::StringMetadata>(name);
+      return value ? value->value() : std::string();
+   }
+
+   bool hasKeepSuffix(const std::string& name)
+   {
+      const size_t len = std::string(kKeepSuffix).size();
+      return name.size() > len && name.compare(name.size() - len, len, kKeepSuffix) == 0;
+   }
+
+   // flags the leaf nodes that differ from the previous frame
+   template<typename TreeT>
+   struct CompareLeafsOp
+   {
+      typedef typename TreeT::LeafNodeType LeafT;
+
+      const openvdb::tree::LeafManager<const TreeT>* leafs;
+      const TreeT* prevTree;
+      std::vector<unsigned char>* changed;
+
+      void operator()(const tbb::blocked_range<size_t>& range) const
+      {
+         for (size_t n = range.begin(); n != range.end(); ++n)
+         {
+            const LeafT& leaf = leafs->leaf(n);
+            const LeafT* prevLeaf = prevTree->probeConstLeaf(leaf.origin());
+            (*changed)[n] = !(prevLeaf && *prevLeaf == leaf);
+         }
+      }
+   };
+
+   // the destination leaf nodes are allocated beforehand, copying their
+   // values and masks does not touch the tree structure
+   template<typename LeafT>
+   struct CopyLeafsOp
+   {
+      const std::vector<const LeafT*>* src;
+      const std::vector<LeafT*>* dst;
+
+      void operator()(const tbb::blocked_range<size_t>& range) const
+      {
+         for (size_t n = range.begin(); n != range.end(); ++n)
+         {
+            *(*dst)[n] = *(*src)[n];
+         }
+      }
+   };
+
+   template<typename LeafT>
+   void copyLeafs(const std::vector<const LeafT*>& src, const std::vector<LeafT*>& dst)
+   {
+      CopyLeafsOp<LeafT> op;
+      op.src = &src;
+      op.dst = &dst;
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, src.size()), op);
+   }
+
+   template<typename GridT>
+   bool encodeDelta(const openvdb::GridBase& prevBase, const openvdb::GridBase& curBase, openvdb::GridCPtrVec& result)
+   {
+      if (!curBase.isType<GridT>() || !prevBase.isType<GridT>()) return false;
+
+      typedef typename GridT::TreeType TreeT;
+      typedef typename TreeT::LeafNodeType LeafT;
+      typedef typename TreeT::ValueType ValueT;
+
+      const GridT& cur = static_cast<const GridT&>(curBase);
+      const GridT& prev = static_cast<const GridT&>(prevBase);
+      if (!(cur.background() == prev.background())) return false;
+      if (cur.transform() != prev.transform()) return false;
+
+      openvdb::tree::LeafManager<const TreeT> leafs(cur.tree());
+      std::vector<unsigned char> changed(leafs.leafCount(), 1);
+      CompareLeafsOp<TreeT> compareOp;
+      compareOp.leafs = &leafs;
+      compareOp.prevTree = &prev.tree();
+      compareOp.changed = &changed;
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, leafs.leafCount()), compareOp);
+
+      typename GridT::Ptr delta = cur.copy(openvdb::CP_NEW);
+      openvdb::BoolGrid::Ptr keep = openvdb::BoolGrid::create(false);
+      keep->setName(cur.getName() + kKeepSuffix);
+      keep->setTransform(cur.transform().copy());
+
+      // the tiles are few and cheap, they are always written
+      const ValueT& background = cur.background();
+      typename TreeT::ValueAllCIter tileIter = cur.tree().cbeginValueAll();
+      tileIter.setMaxDepth(TreeT::ValueAllCIter::LEAF_DEPTH - 1);
+      for (; tileIter; ++tileIter)
+      {
+         if (!tileIter.isValueOn() && *tileIter == background) continue;
+         delta->tree().addTile(tileIter.getLevel(), tileIter.getCoord(), *tileIter, tileIter.isValueOn());
+      }
+
+      std::vector<const LeafT*> src;
+      std::vector<LeafT*> dst;
+      openvdb::BoolGrid::Accessor keepAcc = keep->getAccessor();
+      for (size_t n = 0; n < leafs.leafCount(); ++n)
+      {
+         const LeafT& leaf = leafs.leaf(n);
+         if (!changed[n])
+         {
+            keepAcc.setValueOn(leaf.origin(), true);
+            continue;
+         }
+         src.push_back(&leaf);
+         dst.push_back(delta->tree().touchLeaf(leaf.origin()));
+      }
+      copyLeafs(src, dst);
+
+      result.push_back(delta);
+      result.push_back(keep);
+      return true;
+   }
+
+   bool encodeDelta(const openvdb::GridBase& prev, const openvdb::GridBase& cur, openvdb::GridCPtrVec& result)
+   {
+      return encodeDelta<openvdb::FloatGrid>(prev, cur, result)
+         || encodeDelta<openvdb::DoubleGrid>(prev, cur, result)
+         || encodeDelta<openvdb::Int32Grid>(prev, cur, result)
+         || encodeDelta<openvdb::Int64Grid>(prev, cur, result)
+         || encodeDelta<openvdb::Vec3SGrid>(prev, cur, result)
+         || encodeDelta<openvdb::Vec3DGrid>(prev, cur, result)
+         || encodeDelta<openvdb::Vec3IGrid>(prev, cur, result)
+         || encodeDelta<openvdb::BoolGrid>(prev, cur, result);
+   }
+
+   // copies the kept leaf nodes of the base frame into the delta grid,
+   // returns false when the grid types do not match
+   template<typename GridT>
+   bool applyDelta(openvdb::GridBase& deltaBase, const openvdb::BoolGrid& keep,
+      const openvdb::GridBase& baseBase, size_t& missing)
+   {
+      if (!deltaBase.isType<GridT>() || !baseBase.isType<GridT>()) return false;
+
+      typedef typename GridT::TreeType TreeT;
+      typedef typename TreeT::LeafNodeType LeafT;
+
+      GridT& delta = static_cast<GridT&>(deltaBase);
+      const TreeT& baseTree = static_cast<const GridT&>(baseBase).tree();
+
+      // allocating the leaf nodes changes the tree structure, only this
+      // part runs serially
+      std::vector<const LeafT*> src;
+      std::vector<LeafT*> dst;
+      for (openvdb::BoolTree::ValueOnCIter iter = keep.tree().cbeginValueOn(); iter; ++iter)
+      {
+         const LeafT* baseLeaf = baseTree.probeConstLeaf(iter.getCoord());
+         if (!baseLeaf)
+         {
+            ++missing;
+            continue;
+         }
+         src.push_back(baseLeaf);
+         dst.push_back(delta.tree().touchLeaf(iter.getCoord()));
+      }
+      copyLeafs(src, dst);
+      return true;
+   }
+
+   bool applyDelta(openvdb::GridBase& delta, const openvdb::BoolGrid& keep,
+      const openvdb::GridBase& base, size_t& missing)
+   {
+      return applyDelta<openvdb::FloatGrid>(delta, keep, base, missing)
+         || applyDelta<openvdb::DoubleGrid>(delta, keep, base, missing)
+         || applyDelta<openvdb::Int32Grid>(delta, keep, base, missing)
+         || applyDelta<openvdb::Int64Grid>(delta, keep, base, missing)
+         || applyDelta<openvdb::Vec3SGrid>(delta, keep, base, missing)
+         || applyDelta<openvdb::Vec3DGrid>(delta, keep, base, missing)
+         || applyDelta<openvdb::Vec3IGrid>(delta, keep, base, missing)
+         || applyDelta<openvdb::BoolGrid>(delta, keep, base, missing);
+   }
+}
+
+VDB_DeltaWriter::VDB_DeltaWriter()
+   : m_prevFrame(0)
+   , m_deltaCount(0)
+{
+}
+
+void VDB_DeltaWriter::Reset()
+{
+   m_prevGrids.clear();
+   m_prevPath.clear();
+   m_prevId.clear();
+   m_prevFrame = 0;
+   m_deltaCount = 0;
+}
+
+openvdb::GridCPtrVec VDB_DeltaWriter::Encode(const openvdb::GridCPtrVec& grids, openvdb::MetaMap& meta,
+   const std::string& path, int frame, int keyframeInterval)
+{
+   meta.removeMeta(kDeltaBaseMeta);
+   meta.removeMeta(kDeltaBaseIdMeta);
+
+   // identifies this version of the frame, a delta written against it only
+   // applies to this exact file
+   boost::uuids::random_generator generator;
+   const std::string id = boost::uuids::to_string(generator());
+   meta.insertMeta(kDeltaIdMeta, openvdb::StringMetadata(id));
+
+   // a longer chain could not be read back
+   keyframeInterval = std::min(keyframeInterval, kMaxDeltaChainLength);
+   const bool keyframe = m_prevGrids.empty() || frame != m_prevFrame + 1
+      || keyframeInterval <= 1 || m_deltaCount + 1 >= keyframeInterval;
+
+   openvdb::GridCPtrVec result;
+   if (keyframe)
+   {
+      result = grids;
+      m_deltaCount = 0;
+   }
+   else
+   {
+      for (size_t i=0; i<grids.size(); ++i)
+      {
+         const openvdb::GridBase& grid = *grids[i];
+
+         openvdb::GridBase::ConstPtr prevGrid;
+         for (size_t j=0; j<m_prevGrids.size() && !prevGrid; ++j)
+         {
+            if (m_prevGrids[j]->getName() == grid.getName()) prevGrid = m_prevGrids[j];
+         }
+         // new grids and grids that changed type or transform are written whole
+         if (!prevGrid || !encodeDelta(*prevGrid, grid, result)) result.push_back(grids[i]);
+      }
+      meta.insertMeta(kDeltaBaseMeta, openvdb::StringMetadata(fileName(m_prevPath)));
+      meta.insertMeta(kDeltaBaseIdMeta, openvdb::StringMetadata(m_prevId));
+      ++m_deltaCount;
+   }
+
+   // the grids are immutable once registered, holding them is enough
+   m_prevGrids = grids;
+   m_prevPath = path;
+   m_prevId = id;
+   m_prevFrame = frame;
+   return result;
+}
+
+VDB_DeltaReader& VDB_DeltaReader::Get()
+{
+   static VDB_DeltaReader reader;
+   return reader;
+}
+
+VDB_DeltaReader::VDB_DeltaReader()
+   : m_lastModTime(0)
+{
+}
+
+bool VDB_DeltaReader::IsDelta(const openvdb::MetaMap& meta)
+{
+   return meta.getMetadata<openvdb::StringMetadata>(kDeltaBaseMeta) != NULL;
+}
+
+void VDB_DeltaReader::Clear()
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   m_last.reset();
+   m_lastPath.clear();
+   m_lastModTime = 0;
+}
+
+VDB_Primitive::Ptr VDB_DeltaReader::Read(const std::string& path)
+{
+   return Read(path, 0);
+}
+
+VDB_Primitive::Ptr VDB_DeltaReader::Read(const std::string& path, int depth)
+{
+   std::time_t modTime = 0;
+   if (!fileModTime(path, modTime))
+   {
+      XSI::Application().LogMessage(L"[VDB_DeltaReader] file not found " + XSI::CString(path.c_str()), XSI::siErrorMsg);
+      return VDB_Primitive::Ptr();
+   }
+
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      if (m_last && path == m_lastPath && modTime == m_lastModTime) return m_last;
+   }
+
+   openvdb::GridPtrVecPtr grids;
+   openvdb::MetaMap::Ptr meta;
+   try
+   {
+      openvdb::io::File file(path);
+      file.open(false);
+      grids = file.getGrids();
+      meta = file.getMetadata();
+      file.close();
+   }
+   catch (openvdb::Exception& e)
+   {
+      XSI::Application().LogMessage(L"[VDB_DeltaReader] " + XSI::CString(e.what()) + L" : " + XSI::CString(path.c_str()), XSI::siErrorMsg);
+      return VDB_Primitive::Ptr();
+   }
+   if (!grids || !meta) return VDB_Primitive::Ptr();
+
+   VDB_Primitive::Ptr base;
+   openvdb::StringMetadata::ConstPtr baseName = meta->getMetadata<openvdb::StringMetadata>(kDeltaBaseMeta);
+   if (baseName)
+   {
+      if (depth >= kMaxDeltaChainLength)
+      {
+         XSI::Application().LogMessage(L"[VDB_DeltaReader] no keyframe found before " + XSI::CString(path.c_str()), XSI::siErrorMsg);
+         return VDB_Primitive::Ptr();
+      }
+      const std::string basePath = siblingPath(path, baseName->value());
+      base = Read(basePath, depth + 1);
+      if (!base) return VDB_Primitive::Ptr();
+
+      // the base was cached again or its write failed, the kept leaf nodes
+      // would come from a different frame
+      const std::string baseId = stringMeta(*meta, kDeltaBaseIdMeta);
+      if (!baseId.empty() && baseId != stringMeta(base->GetMetadata(), kDeltaIdMeta))
+      {
+         XSI::Application().LogMessage(L"[VDB_DeltaReader] " + XSI::CString(basePath.c_str()) + L" is not the base frame " + XSI::CString(path.c_str()) + L" was written against", XSI::siErrorMsg);
+         return VDB_Primitive::Ptr();
+      }
+      meta->removeMeta(kDeltaBaseMeta);
+      meta->removeMeta(kDeltaBaseIdMeta);
+   }
+
+   std::map<std::string, openvdb::BoolGrid::Ptr> keepGrids;
+   for (size_t i=0; i<grids->size(); ++i)
+   {
+      const std::string& name = (*grids)[i]->getName();
+      if (!hasKeepSuffix(name)) continue;
+      openvdb::BoolGrid::Ptr keep = openvdb::gridPtrCast<openvdb::BoolGrid>((*grids)[i]);
+      if (keep) keepGrids[name.substr(0, name.size() - std::string(kKeepSuffix).size())] = keep;
+   }
+
+   VDB_Primitive::Ptr prim(new VDB_Primitive());
+   for (size_t i=0; i<grids->size(); ++i)
+   {
+      openvdb::GridBase& grid = *(*grids)[i];
+      const std::string& name = grid.getName();
+      if (hasKeepSuffix(name)) continue;
+
+      std::map<std::string, openvdb::BoolGrid::Ptr>::const_iterator keepIt = keepGrids.find(name);
+      if (keepIt != keepGrids.end())
+      {
+         const int baseIndex = base ? base->FindGridIndex(name) : -1;
+         size_t missing = 0;
+         if (baseIndex < 0 || !applyDelta(grid, *keepIt->second, *base->GetConstGridPtr(baseIndex), missing))
+         {
+            XSI::Application().LogMessage(L"[VDB_DeltaReader] base frame has no matching grid " + XSI::CString(name.c_str()) + L" : " + XSI::CString(path.c_str()), XSI::siErrorMsg);
+            return VDB_Primitive::Ptr();
+         }
+         if (missing)
+         {
+            XSI::Application().LogMessage(L"[VDB_DeltaReader] " + XSI::CValue((ULONG)missing).GetAsText() + L" leaf nodes missing from the base frame of " + XSI::CString(path.c_str()), XSI::siWarningMsg);
+         }
+      }
+      prim->AddGrid(grid);
+   }
+   prim->GetMetadata() = *meta;
+   prim->SetSourceTime(base && base->GetSourceTime() > modTime ? base->GetSourceTime() : modTime);
+
+   tbb::mutex::scoped_lock lock(m_mutex);
+   m_last = prim;
+   m_lastPath = path;
+   m_lastModTime = modTime;
+   return prim;
+}
@@ -0,0 +1,77 @@
+// OpenVDB_Softimage
+// VDB_DeltaSequence.h
+// sequence format storing a full keyframe every few frames and in between
+// only the leaf nodes that changed since the previous frame.
+// a delta frame is a regular .vdb file, each grid holds the tiles of the
+// frame and its changed leaf nodes. the leaf nodes that did not change are
+// marked by one active voxel at their origin in a bool grid named
+// "<grid>.delta_keep", they are copied from the file named by the
+// "vdb_delta_base" metadata when the frame is read back. every frame carries
+// a unique id in "vdb_delta_id" and a delta frame the id of its base in
+// "vdb_delta_base_id", a base written again since is detected on read.
+
+#ifndef VDB_DELTASEQUENCE_H
+#define VDB_DELTASEQUENCE_H
+
+#include <string>
+#include <ctime>
+
+#include <tbb/mutex.h>
+
+#include <openvdb/openvdb.h>
+
+#include "VDB_Primitive.h"
+
+// deltas the reader follows back to a keyframe before giving up, it guards
+// against base files looping back on themselves. the writer never puts
+// keyframes further apart.
+static const int kMaxDeltaChainLength = 1000;
+
+class VDB_DeltaWriter
+{
+public:
+   VDB_DeltaWriter();
+
+   // returns the grids to write for the given frame. a keyframe is written
+   // when the frame does not follow the previous one or the interval is
+   // reached, otherwise the base file is recorded in the metadata. the
+   // interval is clamped to kMaxDeltaChainLength.
+   openvdb::GridCPtrVec Encode(const openvdb::GridCPtrVec& grids, openvdb::MetaMap& meta,
+      const std::string& path, int frame, int keyframeInterval);
+
+   // the next frame is written as a keyframe
+   void Reset();
+
+private:
+   openvdb::GridCPtrVec m_prevGrids;
+   std::string m_prevPath;
+   std::string m_prevId;
+   int m_prevFrame;
+   int m_deltaCount;
+};
+
+class VDB_DeltaReader
+{
+public:
+   static VDB_DeltaReader& Get();
+
+   static bool IsDelta(const openvdb::MetaMap& meta);
+
+   // reads a frame, following the base files back to the keyframe. the last
+   // frame is kept so playing forward only applies one delta per frame.
+   VDB_Primitive::Ptr Read(const std::string& path);
+
+   void Clear();
+
+private:
+   VDB_DeltaReader();
+
+   VDB_Primitive::Ptr Read(const std::string& path, int depth);
+
+   tbb::mutex m_mutex;
+   std::string m_lastPath;
+   std::time_t m_lastModTime;
+   VDB_Primitive::Ptr m_last;
+};
+
+#endif
@@ -0,0 +1,318 @@
+// OpenVDB_Softimage
+// VDB_GridRegistry.cpp
+// central registry that owns every VDB_Primitive living in the ICE graph
+
+#include <cstdio>
+
+#include <xsi_application.h>
+
+#include "VDB_GridRegistry.h"
+#include "VDB_Utils.h"
+
+VDB_GridRegistry& VDB_GridRegistry::Get()
+{
+   static VDB_GridRegistry registry;
+   return registry;
+}
+
+VDB_GridRegistry::VDB_GridRegistry()
+   : m_nextId(1)
+   , m_memUsage(0)
+   , m_memBudget(0)
+   , m_clock(0)
+   , m_spilledCount(0)
+{
+}
+
+VDB_GridRegistry::~VDB_GridRegistry()
+{
+   Clear();
+}
+
+ULONG VDB_GridRegistry::Add(const VDB_Primitive::Ptr& prim)
+{
+   if (!prim) return 0;
+
+   // grids are immutable once registered, so the memory can be measured once
+   Entry entry;
+   entry.prim = prim;
+   entry.refCount = 1;
+   entry.memUsage = prim->GetUncachedMemUsage();
+   entry.spilling = false;
+
+   ULONG id;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      // zero is reserved for the invalid handle
+      if (m_nextId == 0) m_nextId = 1;
+      id = m_nextId++;
+      entry.lastAccess = ++m_clock;
+      prim->m_registryId = id;
+      m_entries[id] = entry;
+      m_memUsage += entry.memUsage;
+   }
+
+   EnforceBudget(id);
+   return id;
+}
+
+void VDB_GridRegistry::AddRef(ULONG id)
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   EntryMap::iterator it = m_entries.find(id);
+   if (it != m_entries.end()) ++it->second.refCount;
+}
+
+void VDB_GridRegistry::Release(ULONG id)
+{
+   // destroy the primitive outside of the lock, freeing a large tree takes a while
+   VDB_Primitive::Ptr released;
+   std::string spillPath;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      EntryMap::iterator it = m_entries.find(id);
+      if (it == m_entries.end()) return;
+      if (--it->second.refCount > 0) return;
+
+      released = it->second.prim;
+      if (released) m_memUsage -= it->second.memUsage;
+      else --m_spilledCount;
+      spillPath = it->second.spillPath;
+      m_entries.erase(it);
+   }
+   if (!spillPath.empty()) std::remove(spillPath.c_str());
+}
+
+VDB_Primitive::Ptr VDB_GridRegistry::Find(ULONG id)
+{
+   std::string spillPath;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      EntryMap::iterator it = m_entries.find(id);
+      if (it == m_entries.end()) return VDB_Primitive::Ptr();
+      it->second.lastAccess = ++m_clock;
+      if (it->second.prim) return it->second.prim;
+      spillPath = it->second.spillPath;
+   }
+
+   // read the spilled primitive back without blocking the other nodes
+   VDB_Primitive::Ptr prim = VDB_Primitive::ReadFromFile(spillPath);
+   if (!prim)
+   {
+      XSI::Application().LogMessage(L"[VDB_GridRegistry] failed to reload " + XSI::CString(spillPath.c_str()), XSI::siErrorMsg);
+      return prim;
+   }
+   const openvdb::Index64 memUsage = prim->GetUncachedMemUsage();
+
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      EntryMap::iterator it = m_entries.find(id);
+      if (it == m_entries.end()) return prim;
+      // another thread may have reloaded it in the meantime
+      if (it->second.prim) return it->second.prim;
+      it->second.prim = prim;
+      prim->m_registryId = id;
+      it->second.memUsage = memUsage;
+      m_memUsage += it->second.memUsage;
+      --m_spilledCount;
+   }
+
+   EnforceBudget(id);
+   return prim;
+}
+
+ULONG VDB_GridRegistry::GetRefCount(ULONG id) const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   EntryMap::const_iterator it = m_entries.find(id);
+   return it == m_entries.end() ? 0 : it->second.refCount;
+}
+
+size_t VDB_GridRegistry::GetCount() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_entries.size();
+}
+
+size_t VDB_GridRegistry::GetSpilledCount() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_spilledCount;
+}
+
+openvdb::Index64 VDB_GridRegistry::GetMemUsage() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_memUsage;
+}
+
+void VDB_GridRegistry::AddMemUsage(const VDB_Primitive& prim, openvdb::Index64 bytes)
+{
+   const ULONG id = prim.m_registryId;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      EntryMap::iterator it = m_entries.find(id);
+      // released meanwhile, or the entry holds a copy reloaded from disk
+      if (it == m_entries.end() || it->second.prim.get() != &prim) return;
+      it->second.memUsage += bytes;
+      m_memUsage += bytes;
+   }
+   EnforceBudget(id);
+}
+
+void VDB_GridRegistry::SetMemoryBudget(openvdb::Index64 bytes)
+{
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      m_memBudget = bytes;
+   }
+   EnforceBudget(0);
+}
+
+openvdb::Index64 VDB_GridRegistry::GetMemoryBudget() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_memBudget;
+}
+
+void VDB_GridRegistry::EnforceBudget(ULONG keepId)
+{
+   for (;;)
+   {
+      {
+         tbb::mutex::scoped_lock lock(m_mutex);
+         if (m_memBudget == 0 || m_memUsage <= m_memBudget) return;
+      }
+      // nothing left that can be spilled, run over budget rather than fail
+      if (!SpillOne(keepId)) return;
+   }
+}
+
+bool VDB_GridRegistry::SpillOne(ULONG keepId)
+{
+   ULONG victimId = 0;
+   VDB_Primitive::Ptr victim;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      openvdb::Index64 oldest = 0;
+      for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+      {
+         const Entry& entry = it->second;
+         if (it->first == keepId || !entry.prim || entry.spilling) continue;
+         // a node is still using the primitive, or its trees are shared with
+         // another primitive or the read cache, spilling would not free anything
+         if (!entry.prim.unique() || entry.prim->HasSharedTrees()) continue;
+         // writing it out would resolve the operations into a full copy first
+         if (entry.prim->HasUnresolvedOps()) continue;
+         if (!victimId || entry.lastAccess < oldest)
+         {
+            victimId = it->first;
+            oldest = entry.lastAccess;
+         }
+      }
+      if (!victimId) return false;
+      Entry& entry = m_entries[victimId];
+      entry.spilling = true;
+      victim = entry.prim;
+   }
+
+   std::ostringstream ostr;
+   // the registry address keeps concurrent sessions from sharing files
+   ostr << "openvdb_softimage_spill_" << this << "_" << victimId << ".vdb";
+   const std::string spillPath = tempFilePath(ostr.str());
+   const bool written = victim->WriteToFile(spillPath);
+
+   tbb::mutex::scoped_lock lock(m_mutex);
+   EntryMap::iterator it = m_entries.find(victimId);
+   if (it == m_entries.end())
+   {
+      // released while we were writing it out
+      std::remove(spillPath.c_str());
+      return true;
+   }
+   Entry& entry = it->second;
+   entry.spilling = false;
+   // picked up by a node while writing, try again on the next candidate
+   if (!written || entry.prim.use_count() > 2)
+   {
+      std::remove(spillPath.c_str());
+      entry.lastAccess = ++m_clock;
+      return written;
+   }
+   entry.prim.reset();
+   entry.spillPath = spillPath;
+   m_memUsage -= entry.memUsage;
+   ++m_spilledCount;
+   return true;
+}
+
+void VDB_GridRegistry::Clear()
+{
+   EntryMap released;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      released.swap(m_entries);
+      m_memUsage = 0;
+      m_spilledCount = 0;
+   }
+   for (EntryMap::iterator it = released.begin(); it != released.end(); ++it)
+   {
+      if (!it->second.spillPath.empty()) std::remove(it->second.spillPath.c_str());
+   }
+}
+
+VDB_OutputHandles::VDB_OutputHandles()
+{
+}
+
+VDB_OutputHandles::~VDB_OutputHandles()
+{
+   ReleaseAll();
+}
+
+ULONG VDB_OutputHandles::Add(const VDB_Primitive::Ptr& prim)
+{
+   ULONG id = VDB_GridRegistry::Get().Add(prim);
+   if (id) m_ids.push_back(id);
+   return id;
+}
+
+ULONG VDB_OutputHandles::Hold(ULONG id)
+{
+   if (!id) return 0;
+   VDB_GridRegistry::Get().AddRef(id);
+   m_ids.push_back(id);
+   return id;
+}
+
+void VDB_OutputHandles::ReleaseAll()
+{
+   VDB_GridRegistry& registry = VDB_GridRegistry::Get();
+   for (size_t i=0; i<m_ids.size(); ++i)
+   {
+      registry.Release(m_ids[i]);
+   }
+   m_ids.clear();
+}
+
+ULONG GetHandleId(XSI::CDataArrayCustomType& port, ULONG index)
+{
+   ULONG dataSize = 0;
+   const VDB_Handle* handle = NULL;
+   port.GetData(index, (const XSI::CDataArrayCustomType::TData**)&handle, dataSize);
+   if (!handle || dataSize != sizeof(VDB_Handle)) return 0;
+   return handle->id;
+}
+
+VDB_Primitive::Ptr GetPrimitive(XSI::CDataArrayCustomType& port, ULONG index)
+{
+   ULONG id = GetHandleId(port, index);
+   if (!id) return VDB_Primitive::Ptr();
+   return VDB_GridRegistry::Get().Find(id);
+}
+
+void SetHandleId(XSI::CDataArrayCustomType& output, ULONG index, ULONG id)
+{
+   VDB_Handle* handle = (VDB_Handle*)output.Resize(index, sizeof(VDB_Handle));
+   if (handle) handle->id = id;
+}
@@ -0,0 +1,113 @@
+// OpenVDB_Softimage
+// VDB_GridRegistry.h
+// central registry that owns every VDB_Primitive living in the ICE graph.
+// the vdb_prim custom type only carries a small handle into this registry,
+// ICE is free to memcpy the handle around without touching reference counts.
+// the registry also enforces a memory budget, when the grids it holds exceed
+// the budget the least recently used ones are spilled to a temporary .vdb file
+// and read back the next time a node asks for them.
+
+#ifndef VDB_GRIDREGISTRY_H
+#define VDB_GRIDREGISTRY_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <xsi_dataarray.h>
+
+#include <tbb/mutex.h>
+
+#include <openvdb/openvdb.h>
+
+#include "VDB_Primitive.h"
+
+// contents of the vdb_prim custom data buffer
+struct VDB_Handle
+{
+   ULONG id;
+};
+
+class VDB_GridRegistry
+{
+public:
+   static VDB_GridRegistry& Get();
+
+   // adds the primitive with a reference count of one and returns its id
+   ULONG Add(const VDB_Primitive::Ptr& prim);
+   void AddRef(ULONG id);
+   // the primitive is destroyed when its last reference is released
+   void Release(ULONG id);
+
+   // returns an empty pointer when the id is unknown or already released,
+   // a spilled primitive is read back from disk first
+   VDB_Primitive::Ptr Find(ULONG id);
+   ULONG GetRefCount(ULONG id) const;
+
+   size_t GetCount() const;
+   size_t GetSpilledCount() const;
+   // memory held by the primitives currently resident in memory, trees
+   // shared with VDB_ReadCache are counted by the cache only
+   openvdb::Index64 GetMemUsage() const;
+   // charges memory a registered primitive allocated after it was added,
+   // e.g. when its pending operations were resolved
+   void AddMemUsage(const VDB_Primitive& prim, openvdb::Index64 bytes);
+
+   // zero means unlimited
+   void SetMemoryBudget(openvdb::Index64 bytes);
+   openvdb::Index64 GetMemoryBudget() const;
+
+   void Clear();
+
+private:
+   VDB_GridRegistry();
+   ~VDB_GridRegistry();
+
+   // spills least recently used primitives until the budget is met,
+   // the primitive with the given id is never picked
+   void EnforceBudget(ULONG keepId);
+   bool SpillOne(ULONG keepId);
+
+   struct Entry
+   {
+      VDB_Primitive::Ptr prim;
+      ULONG refCount;
+      openvdb::Index64 memUsage;
+      openvdb::Index64 lastAccess;
+      std::string spillPath;
+      bool spilling;
+   };
+   typedef std::map<ULONG, Entry> EntryMap;
+
+   mutable tbb::mutex m_mutex;
+   EntryMap m_entries;
+   ULONG m_nextId;
+   openvdb::Index64 m_memUsage;
+   openvdb::Index64 m_memBudget;
+   openvdb::Index64 m_clock;
+   size_t m_spilledCount;
+};
+
+// references held by a node on the handles it wrote to its output ports,
+// released when the node evaluates again or is deleted
+class VDB_OutputHandles
+{
+public:
+   VDB_OutputHandles();
+   ~VDB_OutputHandles();
+
+   ULONG Add(const VDB_Primitive::Ptr& prim);
+   // keeps an extra reference on a handle coming from an input port
+   ULONG Hold(ULONG id);
+   void ReleaseAll();
+
+private:
+   std::vector<ULONG> m_ids;
+};
+
+// helpers to move handles in and out of vdb_prim ports
+VDB_Primitive::Ptr GetPrimitive(XSI::CDataArrayCustomType& port, ULONG index);
+ULONG GetHandleId(XSI::CDataArrayCustomType& port, ULONG index);
+void SetHandleId(XSI::CDataArrayCustomType& output, ULONG index, ULONG id);
+
+#endif
@@ -0,0 +1,382 @@
+// OpenVDB_Softimage
+// VDB_MeshSequence.cpp
+// openvdb_volumeToMesh command, meshes a grid of a file or of a $F sequence
+// of files into polygon mesh objects. loading and meshing run in a pipeline
+// on background threads while the main thread uploads the previous frame.
+
+#include <sstream>
+#include <vector>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_status.h>
+#include <xsi_argument.h>
+#include <xsi_command.h>
+#include <xsi_model.h>
+#include <xsi_x3dobject.h>
+#include <xsi_primitive.h>
+#include <xsi_polygonmesh.h>
+#include <xsi_doublearray.h>
+#include <xsi_longarray.h>
+#include <xsi_vector3.h>
+
+#include <tbb/pipeline.h>
+#include <tbb/concurrent_queue.h>
+#include <tbb/tbb_thread.h>
+#include <tbb/tick_count.h>
+
+#include <openvdb/openvdb.h>
+#include <openvdb/tools/VolumeToMesh.h>
+
+#include "VDB_Utils.h"
+#include "VDB_Node_Read.h"
+#include "VDB_ReadCache.h"
+#include "VDB_DeltaSequence.h"
+
+using namespace XSI;
+using namespace XSI::MATH;
+
+namespace
+{
+   // frames loaded or meshed ahead of the upload, each holds a grid and a mesh
+   const size_t kMaxFramesInFlight = 3;
+
+   struct MeshFrame
+   {
+      int frame;
+      std::string path;
+      std::string meshName;
+
+      openvdb::GridBase::ConstPtr grid;
+      CDoubleArray points;
+      CLongArray polygons;
+      std::string error;
+
+      double loadSeconds;
+      double meshSeconds;
+   };
+
+   struct MeshSettings
+   {
+      std::string pathTemplate;
+      std::string meshNameTemplate;
+      std::string gridName;
+      double isoValue;
+      double adaptivity;
+      int startFrame;
+      int endFrame;
+   };
+
+   // first filter of the pipeline, hands out the frames in order
+   struct FrameSource
+   {
+      const MeshSettings* settings;
+      int* nextFrame;
+
+      MeshFrame* operator()(tbb::flow_control& fc) const
+      {
+         if (*nextFrame > settings->endFrame)
+         {
+            fc.stop();
+            return NULL;
+         }
+         MeshFrame* frame = new MeshFrame;
+         frame->frame = (*nextFrame)++;
+         frame->path = expandFrameTokens(settings->pathTemplate, frame->frame);
+         frame->meshName = expandFrameTokens(settings->meshNameTemplate, frame->frame);
+         frame->loadSeconds = 0.0;
+         frame->meshSeconds = 0.0;
+         return frame;
+      }
+   };
+
+   struct LoadFilter
+   {
+      const MeshSettings* settings;
+
+      MeshFrame* operator()(MeshFrame* frame) const
+      {
+         tbb::tick_count start = tbb::tick_count::now();
+         try
+         {
+            // same path as VDB Read, frames come from the read cache and
+            // delta frames are rebuilt from their base frames
+            std::string name = settings->gridName;
+            std::vector<std::string> gridNames;
+            openvdb::MetaMap::ConstPtr meta;
+            if (name.empty() && VDB_ReadCache::Get().GetFileInfo(frame->path, gridNames, meta)
+               && !VDB_DeltaReader::IsDelta(*meta) && !gridNames.empty())
+            {
+               name = gridNames[0];
+            }
+            VDB_Primitive::Ptr prim = VDB_Node_Read::Load(frame->path, name, false, NULL);
+            const int gridIndex = prim ? prim->FindGridIndex(name) : -1;
+            if (gridIndex >= 0) frame->grid = prim->GetConstGridPtr(gridIndex);
+            else frame->error = "no grid named " + name;
+         }
+         catch (openvdb::Exception& e)
+         {
+            frame->error = e.what();
+         }
+         catch (std::exception& e)
+         {
+            frame->error = e.what();
+         }
+         frame->loadSeconds = (tbb::tick_count::now() - start).seconds();
+         return frame;
+      }
+   };
+
+   template<typename GridT>
+   bool meshGrid(const openvdb::GridBase& grid, openvdb::tools::VolumeToMesh& mesher)
+   {
+      if (!grid.isType<GridT>()) return false;
+      mesher(static_cast<const GridT&>(grid));
+      return true;
+   }
+
+   struct MeshFilter
+   {
+      const MeshSettings* settings;
+
+      MeshFrame* operator()(MeshFrame* frame) const
+      {
+         if (!frame->grid) return frame;
+
+         tbb::tick_count start = tbb::tick_count::now();
+         openvdb::tools::VolumeToMesh mesher(settings->isoValue, settings->adaptivity);
+         try
+         {
+            if (!meshGrid<openvdb::FloatGrid>(*frame->grid, mesher)
+               && !meshGrid<openvdb::DoubleGrid>(*frame->grid, mesher))
+            {
+               frame->error = "only scalar grids can be meshed, " + frame->grid->getName() + " is " + frame->grid->valueType();
+            }
+         }
+         catch (std::exception& e)
+         {
+            // the main thread waits on every frame, an exception must not
+            // escape the pipeline
+            frame->error = e.what();
+         }
+         frame->grid.reset();
+         if (!frame->error.empty()) return frame;
+         if (mesher.pointListSize() == 0)
+         {
+            frame->error = "nothing to mesh at this iso value";
+            return frame;
+         }
+
+         // the arrays are filled here, the main thread only hands them over
+         const openvdb::tools::PointList& pointList = mesher.pointList();
+         frame->points.Resize(LONG(mesher.pointListSize() * 3));
+         for (size_t i=0; i<mesher.pointListSize(); ++i)
+         {
+            frame->points[LONG(i*3)] = pointList[i].x();
+            frame->points[LONG(i*3+1)] = pointList[i].y();
+            frame->points[LONG(i*3+2)] = pointList[i].z();
+         }
+
+         const openvdb::tools::PolygonPoolList& polyList = mesher.polygonPoolList();
+         size_t polygonDataSize = 0;
+         for (size_t i=0; i<mesher.polygonPoolListSize(); ++i)
+         {
+            polygonDataSize += polyList[i].numQuads() * 5 + polyList[i].numTriangles() * 4;
+         }
+
+         // vertex count followed by the indices, reversed like the ICE node
+         // to face outward
+         frame->polygons.Resize(LONG(polygonDataSize));
+         LONG index = 0;
+         for (size_t i=0; i<mesher.polygonPoolListSize(); ++i)
+         {
+            const openvdb::tools::PolygonPool& polygons = polyList[i];
+            for (size_t q=0; q<polygons.numQuads(); ++q)
+            {
+               const openvdb::Vec4I& quad = polygons.quad(q);
+               frame->polygons[index++] = 4;
+               frame->polygons[index++] = quad.w();
+               frame->polygons[index++] = quad.z();
+               frame->polygons[index++] = quad.y();
+               frame->polygons[index++] = quad.x();
+            }
+            for (size_t t=0; t<polygons.numTriangles(); ++t)
+            {
+               const openvdb::Vec3I& triangle = polygons.triangle(t);
+               frame->polygons[index++] = 3;
+               frame->polygons[index++] = triangle.z();
+               frame->polygons[index++] = triangle.y();
+               frame->polygons[index++] = triangle.x();
+            }
+         }
+         frame->meshSeconds = (tbb::tick_count::now() - start).seconds();
+         return frame;
+      }
+   };
+
+   // last filter, frames come out in order
+   struct FrameSink
+   {
+      tbb::concurrent_bounded_queue<MeshFrame*>* queue;
+
+      void operator()(MeshFrame* frame) const { queue->push(frame); }
+   };
+
+   // runs on its own thread so the pipeline keeps going while the main
+   // thread is busy uploading
+   struct PipelineRunner
+   {
+      const MeshSettings* settings;
+      tbb::concurrent_bounded_queue<MeshFrame*>* queue;
+
+      void operator()() const
+      {
+         int nextFrame = settings->startFrame;
+         FrameSource source = { settings, &nextFrame };
+         LoadFilter load = { settings };
+         MeshFilter mesh = { settings };
+         FrameSink sink = { queue };
+
+         tbb::parallel_pipeline(kMaxFramesInFlight,
+            tbb::make_filter<void, MeshFrame*>(tbb::filter::serial_in_order, source)
+            & tbb::make_filter<MeshFrame*, MeshFrame*>(tbb::filter::parallel, load)
+            & tbb::make_filter<MeshFrame*, MeshFrame*>(tbb::filter::parallel, mesh)
+            & tbb::make_filter<MeshFrame*, void>(tbb::filter::serial_in_order, sink));
+      }
+   };
+
+   // updates the mesh object with the given name or creates it
+   CStatus uploadMesh(const MeshFrame& frame)
+   {
+      Model root = Application().GetActiveSceneRoot();
+      const CString name(frame.meshName.c_str());
+
+      X3DObject object = root.FindChild(name, siPolyMeshType, CStringArray(), false);
+      if (object.IsValid())
+      {
+         PolygonMesh mesh = object.GetActivePrimitive().GetGeometry();
+         return mesh.Set(frame.points, frame.polygons);
+      }
+
+      CVector3Array vertices(frame.points.GetCount() / 3);
+      for (LONG i=0; i<vertices.GetCount(); ++i)
+      {
+         vertices[i].Set(frame.points[i*3], frame.points[i*3+1], frame.points[i*3+2]);
+      }
+      X3DObject newObject;
+      return root.AddPolygonMesh(vertices, frame.polygons, name, newObject);
+   }
+}
+
+SICALLBACK openvdb_volumeToMesh_Init (CRef& ref)
+{
+   Context ctxt(ref);
+   Command oCmd;
+   oCmd = ctxt.GetSource();
+   oCmd.PutDescription(L"mesh a scalar grid from an input openvdb file(.vdb)");
+   oCmd.EnableReturnValue(true);
+
+   ArgumentArray oArgs;
+   oArgs = oCmd.GetArguments();
+   oArgs.Add(L"file", CString());
+   oArgs.Add(L"gridName", CString());
+   oArgs.Add(L"isoValue", 0.0);
+   oArgs.Add(L"adaptivity", 0.0);
+   // $F tokens in the mesh name create one object per frame
+   oArgs.Add(L"meshName", CString(L"vdb_mesh"));
+   // used when the file name holds $F tokens
+   oArgs.Add(L"startFrame", 1);
+   oArgs.Add(L"endFrame", 1);
+   return CStatus::OK;
+}
+
+SICALLBACK openvdb_volumeToMesh_Execute (CRef& ref)
+{
+   Context ctxt(ref);
+   CValueArray args = ctxt.GetAttribute(L"Arguments");
+   CString filename = args[0];
+   CString gridName = args[1];
+   double isoValue = args[2];
+   double adaptivity = args[3];
+   CString meshName = args[4];
+   LONG startFrame = args[5];
+   LONG endFrame = args[6];
+
+   if (filename.IsEmpty())
+   {
+      Application().LogMessage(L"No file name provided!", siErrorMsg);
+      ctxt.PutAttribute(L"ReturnValue", false);
+      return CStatus::Fail;
+   }
+
+   openvdb::initialize();
+
+   MeshSettings settings;
+   settings.pathTemplate = filename.GetAsciiString();
+   settings.meshNameTemplate = meshName.IsEmpty() ? "vdb_mesh" : meshName.GetAsciiString();
+   settings.gridName = gridName.GetAsciiString();
+   settings.isoValue = isoValue;
+   settings.adaptivity = adaptivity;
+   settings.startFrame = int(startFrame);
+   settings.endFrame = int(endFrame);
+   // a single file is meshed once
+   if (settings.pathTemplate.find("$F") == std::string::npos) settings.endFrame = settings.startFrame;
+   if (settings.endFrame < settings.startFrame)
+   {
+      Application().LogMessage(L"End frame is before start frame!", siErrorMsg);
+      ctxt.PutAttribute(L"ReturnValue", false);
+      return CStatus::Fail;
+   }
+
+   tbb::tick_count start = tbb::tick_count::now();
+
+   // one slot per frame in flight, the pipeline waits while the main thread
+   // has not taken the previous frame yet
+   tbb::concurrent_bounded_queue<MeshFrame*> queue;
+   queue.set_capacity(1);
+   PipelineRunner runner = { &settings, &queue };
+   tbb::tbb_thread pipelineThread(runner);
+
+   double loadSeconds = 0.0, meshSeconds = 0.0, uploadSeconds = 0.0;
+   int failed = 0;
+   for (int i=settings.startFrame; i<=settings.endFrame; ++i)
+   {
+      MeshFrame* frame = NULL;
+      queue.pop(frame);
+
+      tbb::tick_count uploadStart = tbb::tick_count::now();
+      if (frame->error.empty())
+      {
+         CStatus st = uploadMesh(*frame);
+         if (st != CStatus::OK) frame->error = "failed to update mesh " + frame->meshName;
+      }
+      double frameUploadSeconds = (tbb::tick_count::now() - uploadStart).seconds();
+
+      loadSeconds += frame->loadSeconds;
+      meshSeconds += frame->meshSeconds;
+      uploadSeconds += frameUploadSeconds;
+
+      std::ostringstream ostr;
+      ostr << "frame " << frame->frame << "\tload " << frame->loadSeconds * 1000.0 << " ms"
+         << "\tmesh " << frame->meshSeconds * 1000.0 << " ms"
+         << "\tupload " << frameUploadSeconds * 1000.0 << " ms"
+         << "\t" << frame->points.GetCount() / 3 << " points";
+      Application().LogMessage(CString(ostr.str().c_str()));
+      if (!frame->error.empty())
+      {
+         ++failed;
+         Application().LogMessage(CString(frame->error.c_str()) + L" : " + CString(frame->path.c_str()), siErrorMsg);
+      }
+      delete frame;
+   }
+   pipelineThread.join();
+
+   // the stages overlap, the total is less than the sum of the stages
+   std::ostringstream ostr;
+   ostr << "total load " << loadSeconds << " s\tmesh " << meshSeconds << " s\tupload " << uploadSeconds
+      << " s\telapsed " << (tbb::tick_count::now() - start).seconds() << " s";
+   Application().LogMessage(CString(ostr.str().c_str()));
+
+   ctxt.PutAttribute(L"ReturnValue", failed == 0);
+   return CStatus::OK;
+}
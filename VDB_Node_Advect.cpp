@@ -0,0 +1,458 @@
+// OpenVDB_Softimage
+// VDB_Node_Advect.cpp
+// ICE node that moves a level set through a velocity field over a time step
+// The velocity comes from a vector grid or is splatted from ICE particles
+
+#include <algorithm>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+#include <xsi_dataarray2D.h>
+#include <xsi_vector3f.h>
+
+#include <tbb/parallel_reduce.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <openvdb/tools/LevelSetAdvect.h>
+#include <openvdb/tools/Composite.h>
+#include <openvdb/tree/LeafManager.h>
+
+#include "VDB_Node_Advect.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kInVDBGrid = 200;
+static const ULONG kGridName = 201;
+static const ULONG kVelocityVDBGrid = 202;
+static const ULONG kVelocityGridName = 203;
+static const ULONG kPointPositions = 204;
+static const ULONG kPointVelocities = 205;
+static const ULONG kPointRadius = 206;
+static const ULONG kTimeStep = 207;
+static const ULONG kSpatialScheme = 208;
+static const ULONG kTemporalScheme = 209;
+static const ULONG kOutVDBGrid = 300;
+
+using namespace XSI;
+
+namespace
+{
+   // splats a range of particles into grids owned by this body, the bodies
+   // are summed when tbb joins them
+   struct RasterizeOp
+   {
+      RasterizeOp(const std::vector<openvdb::Vec3s>& positions,
+         const std::vector<openvdb::Vec3s>& velocities, double voxelRadius,
+         const openvdb::math::Transform& xform)
+         : m_positions(positions)
+         , m_velocities(velocities)
+         , m_voxelRadius(voxelRadius)
+         , m_xform(xform)
+         , m_velocity(openvdb::Vec3SGrid::create())
+         , m_weight(openvdb::FloatGrid::create())
+      {
+      }
+
+      RasterizeOp(RasterizeOp& other, tbb::split)
+         : m_positions(other.m_positions)
+         , m_velocities(other.m_velocities)
+         , m_voxelRadius(other.m_voxelRadius)
+         , m_xform(other.m_xform)
+         , m_velocity(openvdb::Vec3SGrid::create())
+         , m_weight(openvdb::FloatGrid::create())
+      {
+      }
+
+      void operator()(const tbb::blocked_range<size_t>& range)
+      {
+         openvdb::Vec3SGrid::Accessor velocityAcc = m_velocity->getAccessor();
+         openvdb::FloatGrid::Accessor weightAcc = m_weight->getAccessor();
+
+         for (size_t i=range.begin(); i!=range.end(); ++i)
+         {
+            const openvdb::Vec3d center = m_xform.worldToIndex(openvdb::Vec3d(m_positions[i]));
+            const openvdb::Coord lo = openvdb::Coord::floor(center - openvdb::Vec3d(m_voxelRadius));
+            const openvdb::Coord hi = openvdb::Coord::ceil(center + openvdb::Vec3d(m_voxelRadius));
+
+            openvdb::Coord ijk;
+            for (ijk[0]=lo[0]; ijk[0]<=hi[0]; ++ijk[0])
+            {
+               for (ijk[1]=lo[1]; ijk[1]<=hi[1]; ++ijk[1])
+               {
+                  for (ijk[2]=lo[2]; ijk[2]<=hi[2]; ++ijk[2])
+                  {
+                     // tent kernel, the weights are divided out afterwards
+                     const double dist = (ijk.asVec3d() - center).length();
+                     if (dist >= m_voxelRadius) continue;
+                     const float weight = float(1.0 - dist / m_voxelRadius);
+                     velocityAcc.setValue(ijk, velocityAcc.getValue(ijk) + m_velocities[i] * weight);
+                     weightAcc.setValue(ijk, weightAcc.getValue(ijk) + weight);
+                  }
+               }
+            }
+         }
+      }
+
+      void join(RasterizeOp& other)
+      {
+         openvdb::tools::compSum(*m_velocity, *other.m_velocity);
+         openvdb::tools::compSum(*m_weight, *other.m_weight);
+      }
+
+      const std::vector<openvdb::Vec3s>& m_positions;
+      const std::vector<openvdb::Vec3s>& m_velocities;
+      const double m_voxelRadius;
+      const openvdb::math::Transform& m_xform;
+      openvdb::Vec3SGrid::Ptr m_velocity;
+      openvdb::FloatGrid::Ptr m_weight;
+   };
+
+   // turns the weighted velocity sums into averages
+   struct NormalizeOp
+   {
+      typedef openvdb::tree::LeafManager<openvdb::Vec3STree> LeafManagerT;
+
+      NormalizeOp(const openvdb::FloatTree& weight) : m_weight(weight) {}
+
+      void operator()(const LeafManagerT::LeafRange& range) const
+      {
+         openvdb::tree::ValueAccessor<const openvdb::FloatTree> weightAcc(m_weight);
+         for (LeafManagerT::LeafRange::Iterator leaf = range.begin(); leaf; ++leaf)
+         {
+            for (openvdb::Vec3STree::LeafNodeType::ValueOnIter iter = leaf->beginValueOn(); iter; ++iter)
+            {
+               const float weight = weightAcc.getValue(iter.getCoord());
+               if (weight > 0.0f) iter.setValue(*iter / weight);
+            }
+         }
+      }
+
+      const openvdb::FloatTree& m_weight;
+   };
+}
+
+VDB_Node_Advect::VDB_Node_Advect()
+{
+}
+
+VDB_Node_Advect::~VDB_Node_Advect()
+{
+}
+
+openvdb::Vec3SGrid::Ptr VDB_Node_Advect::RasterizeVelocity(const std::vector<openvdb::Vec3s>& positions,
+   const std::vector<openvdb::Vec3s>& velocities, float radius,
+   const openvdb::math::Transform& xform)
+{
+   // a particle always reaches the voxels next to it
+   const double voxelRadius = std::max(double(radius) / xform.voxelSize()[0], 1.0);
+
+   RasterizeOp op(positions, velocities, voxelRadius, xform);
+   tbb::parallel_reduce(tbb::blocked_range<size_t>(0, positions.size(), 1024), op);
+
+   NormalizeOp::LeafManagerT leafs(op.m_velocity->tree());
+   tbb::parallel_for(leafs.leafRange(), NormalizeOp(op.m_weight->tree()));
+
+   op.m_velocity->setTransform(xform.copy());
+   op.m_velocity->setName("velocity");
+   return op.m_velocity;
+}
+
+bool VDB_Node_Advect::Apply(openvdb::FloatGrid& grid, const openvdb::Vec3SGrid& velocity,
+   float timeStep, int spatialScheme, int temporalScheme, std::string& error)
+{
+   if (grid.getGridClass() != openvdb::GRID_LEVEL_SET)
+   {
+      error = "advection needs a level set";
+      return false;
+   }
+
+   openvdb::math::BiasedGradientScheme spatial;
+   switch (spatialScheme)
+   {
+      case 0: spatial = openvdb::math::FIRST_BIAS; break;
+      case 1: spatial = openvdb::math::SECOND_BIAS; break;
+      case 2: spatial = openvdb::math::THIRD_BIAS; break;
+      case 3: spatial = openvdb::math::WENO5_BIAS; break;
+      case 4: spatial = openvdb::math::HJWENO5_BIAS; break;
+      default:
+         error = "unknown spatial scheme";
+         return false;
+   }
+
+   openvdb::math::TemporalIntegrationScheme temporal;
+   switch (temporalScheme)
+   {
+      case 0: temporal = openvdb::math::TVD_RK1; break;
+      case 1: temporal = openvdb::math::TVD_RK2; break;
+      case 2: temporal = openvdb::math::TVD_RK3; break;
+      default:
+         error = "unknown temporal scheme";
+         return false;
+   }
+
+   // the velocity is sampled in world space, so it does not need to share
+   // the transform of the level set. the advection splits the time step into
+   // CFL sub steps, each one runs over the narrow band on all cores and the
+   // tracker rebuilds the band and renormalizes it afterwards.
+   typedef openvdb::tools::DiscreteField<openvdb::Vec3SGrid> FieldT;
+   FieldT field(velocity);
+   openvdb::tools::LevelSetAdvection<openvdb::FloatGrid, FieldT> advection(grid, field);
+   advection.setSpatialScheme(spatial);
+   advection.setTemporalScheme(temporal);
+   // first order renormalization is enough to keep the band a distance field
+   advection.setTrackerSpatialScheme(openvdb::math::FIRST_BIAS);
+   advection.setTrackerTemporalScheme(openvdb::math::TVD_RK1);
+
+   try
+   {
+      advection.advect(0.0, timeStep);
+   }
+   catch (openvdb::Exception& e)
+   {
+      error = e.what();
+      return false;
+   }
+   return true;
+}
+
+CStatus VDB_Node_Advect::Evaluate(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_Advect] Evaluate");
+
+   CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid);
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+
+   switch (evaluatedPort)
+   {
+      case kOutVDBGrid:
+      {
+         CDataArrayCustomType output(ctxt);
+         CIndexSet indexSet(ctxt);
+
+         // the previous result is freed once nothing downstream holds it
+         m_outHandles.ReleaseAll();
+
+         CDataArrayString gridName(ctxt, kGridName);
+         CDataArrayCustomType velocityVDBGridPort(ctxt, kVelocityVDBGrid);
+         CDataArrayString velocityGridName(ctxt, kVelocityGridName);
+         CDataArray2DVector3f pointPositions(ctxt, kPointPositions);
+         CDataArray2DVector3f pointVelocities(ctxt, kPointVelocities);
+         CDataArrayFloat pointRadius(ctxt, kPointRadius);
+         CDataArrayFloat timeStep(ctxt, kTimeStep);
+         CDataArrayLong spatialScheme(ctxt, kSpatialScheme);
+         CDataArrayLong temporalScheme(ctxt, kTemporalScheme);
+
+         for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+         {
+            VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, it);
+            if (!inVDBPrim)
+            {
+               Application().LogMessage(L"[VDB_Node_Advect] input handle is invalid!", siErrorMsg);
+               return CStatus::OK;
+            }
+
+            int gridIndex = inVDBPrim->FindGridIndex(gridName[0].GetAsciiString());
+
+            openvdb::FloatGrid::ConstPtr inputGrid;
+            if (gridIndex >= 0)
+            {
+               inputGrid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(inVDBPrim->GetConstGridPtr(gridIndex));
+            }
+            if (!inputGrid)
+            {
+               Application().LogMessage(L"[VDB_Node_Advect] selected grid must be a float grid!", siErrorMsg);
+               return CStatus::OK;
+            }
+
+            // a connected velocity grid wins over the particles
+            openvdb::Vec3SGrid::ConstPtr velocityGrid;
+            VDB_Primitive::Ptr velocityVDBPrim = GetPrimitive(velocityVDBGridPort, it);
+            if (velocityVDBPrim)
+            {
+               int velocityIndex = velocityVDBPrim->FindGridIndex(velocityGridName[0].GetAsciiString());
+               if (velocityIndex >= 0)
+               {
+                  velocityGrid = openvdb::gridConstPtrCast<openvdb::Vec3SGrid>(velocityVDBPrim->GetConstGridPtr(velocityIndex));
+               }
+               if (!velocityGrid)
+               {
+                  Application().LogMessage(L"[VDB_Node_Advect] velocity grid must be a vec3s grid!", siErrorMsg);
+                  return CStatus::OK;
+               }
+            }
+            else
+            {
+               CDataArray2DVector3f::Accessor positionsAcc = pointPositions[0];
+               CDataArray2DVector3f::Accessor velocitiesAcc = pointVelocities[0];
+               const ULONG count = std::min(positionsAcc.GetCount(), velocitiesAcc.GetCount());
+               if (count == 0)
+               {
+                  Application().LogMessage(L"[VDB_Node_Advect] connect a velocity grid or particle arrays!", siErrorMsg);
+                  return CStatus::OK;
+               }
+
+               std::vector<openvdb::Vec3s> positions(count);
+               std::vector<openvdb::Vec3s> velocities(count);
+               for (ULONG i=0; i<count; ++i)
+               {
+                  const MATH::CVector3f& p = positionsAcc[i];
+                  const MATH::CVector3f& v = velocitiesAcc[i];
+                  positions[i] = openvdb::Vec3s(p.GetX(), p.GetY(), p.GetZ());
+                  velocities[i] = openvdb::Vec3s(v.GetX(), v.GetY(), v.GetZ());
+               }
+               velocityGrid = RasterizeVelocity(positions, velocities, pointRadius[0], inputGrid->transform());
+            }
+
+            // the input grid is shared with the upstream node, advect a copy
+            openvdb::FloatGrid::Ptr outputGrid = inputGrid->deepCopy();
+            std::string error;
+            if (!Apply(*outputGrid, *velocityGrid, timeStep[0], spatialScheme[0], temporalScheme[0], error))
+            {
+               Application().LogMessage(L"[VDB_Node_Advect] " + CString(error.c_str()), siErrorMsg);
+               return CStatus::OK;
+            }
+
+            // the other grids of the primitive are passed through untouched
+            VDB_Primitive::Ptr outVDBPrim = inVDBPrim->ShallowCopy();
+            outVDBPrim->SetGridAt(gridIndex, *outputGrid);
+            SetHandleId(output, it, m_outHandles.Add(outVDBPrim));
+         }
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_Advect::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_Advect", L"VDB Advect");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   st = nodeDef.PutThreadingModel(siICENodeSingleThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"In", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kVelocityVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Velocity", L"velocityVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kVelocityGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Velocity Grid Name", L"velocityGridName", L"");
+   st.AssertSucceeded();
+
+   // used when no velocity grid is connected, e.g. from Build Array from Set
+   st = nodeDef.AddInputPort(kPointPositions, kGroup1, siICENodeDataVector3,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Point Positions", L"pointPositions");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kPointVelocities, kGroup1, siICENodeDataVector3,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Point Velocities", L"pointVelocities");
+   st.AssertSucceeded();
+
+   // world units
+   st = nodeDef.AddInputPort(kPointRadius, kGroup1, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Point Radius", L"pointRadius", 0.5f);
+   st.AssertSucceeded();
+
+   // seconds, one frame at 24 fps by default
+   st = nodeDef.AddInputPort(kTimeStep, kGroup1, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Time Step", L"timeStep", 1.0f / 24.0f);
+   st.AssertSucceeded();
+
+   // 0 first order, 1 second order, 2 third order, 3 WENO5, 4 HJWENO5
+   st = nodeDef.AddInputPort(kSpatialScheme, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Spatial Scheme", L"spatialScheme", CValue(4));
+   st.AssertSucceeded();
+
+   // 0 TVD-RK1, 1 TVD-RK2, 2 TVD-RK3
+   st = nodeDef.AddInputPort(kTemporalScheme, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Temporal Scheme", L"temporalScheme", CValue(1));
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutVDBGrid, customTypes,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Out", L"outVDBGrid");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Advect_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_Advect* vdbNode = new VDB_Node_Advect();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Advect_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Advect* vdbNode;
+   vdbNode = (VDB_Node_Advect*)(CValue::siPtrType)userData;
+   vdbNode->Evaluate(ctxt);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Advect_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_Advect* vdbNode;
+      vdbNode = (VDB_Node_Advect*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
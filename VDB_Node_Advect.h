@@ -0,0 +1,45 @@
+// OpenVDB_Softimage
+// VDB_Node_Advect.h
+// ICE node that moves a level set through a velocity field over a time step
+// The velocity comes from a vector grid or is splatted from ICE particles
+
+#ifndef VDB_NODE_ADVECT_H
+#define VDB_NODE_ADVECT_H
+
+#include <string>
+#include <vector>
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+#include "VDB_GridRegistry.h"
+
+class VDB_Node_Advect
+{
+public:
+   VDB_Node_Advect();
+   ~VDB_Node_Advect();
+
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+   // advects the level set in place, the surface is renormalized after each
+   // CFL sub step. returns false and sets the error when the schemes are invalid.
+   static bool Apply(openvdb::FloatGrid& grid, const openvdb::Vec3SGrid& velocity,
+      float timeStep, int spatialScheme, int temporalScheme, std::string& error);
+
+   // splats the particle velocities into a grid with the given transform,
+   // each particle covers a sphere of the given radius in world units
+   static openvdb::Vec3SGrid::Ptr RasterizeVelocity(const std::vector<openvdb::Vec3s>& positions,
+      const std::vector<openvdb::Vec3s>& velocities, float radius,
+      const openvdb::math::Transform& xform);
+
+private:
+   VDB_OutputHandles m_outHandles;
+};
+
+#endif
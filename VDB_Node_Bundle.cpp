@@ -0,0 +1,164 @@
+// OpenVDB_Softimage
+// VDB_Node_Bundle.cpp
+// ICE node that gathers the grids of several inputs into one primitive,
+// so density, temperature, velocity... travel through the graph together
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+
+#include "VDB_Node_Bundle.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kInVDBGrid = 200;
+static const ULONG kOutVDBGrid = 300;
+
+using namespace XSI;
+
+VDB_Node_Bundle::VDB_Node_Bundle()
+{
+}
+
+VDB_Node_Bundle::~VDB_Node_Bundle()
+{
+}
+
+CStatus VDB_Node_Bundle::Evaluate(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_Bundle] Evaluate");
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+
+   switch (evaluatedPort)
+   {
+      case kOutVDBGrid:
+      {
+         CDataArrayCustomType output(ctxt);
+         CIndexSet indexSet(ctxt);
+
+         m_outHandles.ReleaseAll();
+
+         ULONG portCount;
+         ctxt.GetGroupInstanceCount(kGroup1, portCount);
+
+         for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+         {
+            // grids are shared with the inputs, only the transform and the
+            // metadata are merged. a later grid replaces an earlier one with
+            // the same name.
+            VDB_Primitive::Ptr outVDBPrim(new VDB_Primitive());
+
+            for (ULONG portIdx=0; portIdx<portCount; portIdx++)
+            {
+               CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid, portIdx);
+               VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, it);
+               if (!inVDBPrim) continue;
+
+               if (inVDBPrim->GetSourceTime() > outVDBPrim->GetSourceTime())
+               {
+                  outVDBPrim->SetSourceTime(inVDBPrim->GetSourceTime());
+               }
+
+               for (size_t i=0; i<inVDBPrim->GetGridCount(); ++i)
+               {
+                  // pending operations stay pending in the bundle
+                  outVDBPrim->AddGridFrom(*inVDBPrim, i);
+               }
+
+               const openvdb::MetaMap& inMeta = inVDBPrim->GetMetadata();
+               for (openvdb::MetaMap::ConstMetaIterator metaIt = inMeta.beginMeta(); metaIt != inMeta.endMeta(); ++metaIt)
+               {
+                  if (metaIt->second) outVDBPrim->GetMetadata().insertMeta(metaIt->first, *metaIt->second);
+               }
+            }
+
+            Application().LogMessage(L"[VDB_Node_Bundle] grid count = " + CValue((ULONG)outVDBPrim->GetGridCount()).GetAsText());
+            SetHandleId(output, it, m_outHandles.Add(outVDBPrim));
+         }
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_Bundle::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_Bundle", L"VDB Bundle");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   st = nodeDef.PutThreadingModel(siICENodeSingleThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1, 1, 10);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"VDBGrid", L"vdbGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutVDBGrid, customTypes,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Out", L"outVDBGrid");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Bundle_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_Bundle* vdbNode = new VDB_Node_Bundle();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Bundle_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Bundle* vdbNode;
+   vdbNode = (VDB_Node_Bundle*)(CValue::siPtrType)userData;
+   vdbNode->Evaluate(ctxt);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Bundle_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_Bundle* vdbNode;
+      vdbNode = (VDB_Node_Bundle*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
@@ -0,0 +1,31 @@
+// OpenVDB_Softimage
+// VDB_Node_Bundle.h
+// ICE node that gathers the grids of several inputs into one primitive,
+// so density, temperature, velocity... travel through the graph together
+
+#ifndef VDB_NODE_BUNDLE_H
+#define VDB_NODE_BUNDLE_H
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+#include "VDB_GridRegistry.h"
+
+class VDB_Node_Bundle
+{
+public:
+   VDB_Node_Bundle();
+   ~VDB_Node_Bundle();
+
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   VDB_OutputHandles m_outHandles;
+};
+
+#endif
@@ -0,0 +1,291 @@
+// OpenVDB_Softimage
+// VDB_Node_CSG.cpp
+// ICE node combining two or more level sets with union, intersection or
+// difference
+
+#include <vector>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+
+#include <tbb/task_group.h>
+
+#include <openvdb/tools/Composite.h>
+#include <openvdb/tools/GridTransformer.h>
+#if OPENVDB_LIBRARY_MAJOR_VERSION >= 3
+#include <openvdb/tools/Prune.h>
+#endif
+
+#include "VDB_Node_CSG.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kGroup2 = 101;
+static const ULONG kOperation = 200;
+static const ULONG kGridName = 201;
+static const ULONG kInVDBGrid = 203;
+static const ULONG kOutVDBGrid = 300;
+
+// operations exposed on the port
+enum { kUnion = 0, kIntersection = 1, kDifference = 2 };
+
+using namespace XSI;
+
+namespace
+{
+   typedef std::vector<openvdb::FloatGrid::Ptr> FloatGridVec;
+
+   // b is emptied, its nodes are moved into a where they do not overlap.
+   // pruning is left for the end.
+   void combine(openvdb::FloatGrid& a, openvdb::FloatGrid& b, int operation)
+   {
+      switch (operation)
+      {
+         case kIntersection: openvdb::tools::csgIntersection(a, b, false); break;
+         case kDifference: openvdb::tools::csgDifference(a, b, false); break;
+         default: openvdb::tools::csgUnion(a, b, false); break;
+      }
+   }
+
+   // pairwise reduction, the two halves are combined concurrently and the
+   // result ends up in the first grid of the range
+   struct ReduceTask
+   {
+      FloatGridVec* grids;
+      size_t begin, end;
+      int operation;
+
+      void operator()() const
+      {
+         if (end - begin < 2) return;
+         const size_t mid = begin + (end - begin) / 2;
+
+         ReduceTask left = { grids, begin, mid, operation };
+         ReduceTask right = { grids, mid, end, operation };
+         tbb::task_group group;
+         group.run(left);
+         right();
+         group.wait();
+
+         combine(*(*grids)[begin], *(*grids)[mid], operation);
+         (*grids)[mid].reset();
+      }
+   };
+}
+
+VDB_Node_CSG::VDB_Node_CSG()
+{
+}
+
+VDB_Node_CSG::~VDB_Node_CSG()
+{
+}
+
+CStatus VDB_Node_CSG::Evaluate(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_CSG] Evaluate");
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+
+   switch (evaluatedPort)
+   {
+      case kOutVDBGrid:
+      {
+         CDataArrayCustomType output(ctxt);
+         CIndexSet indexSet(ctxt);
+
+         m_outHandles.ReleaseAll();
+
+         CDataArrayLong operation(ctxt, kOperation);
+         CDataArrayString gridName(ctxt, kGridName);
+         const std::string name(gridName[0].GetAsciiString());
+
+         ULONG portCount;
+         ctxt.GetGroupInstanceCount(kGroup2, portCount);
+
+         for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+         {
+            VDB_Primitive::Ptr firstVDBPrim;
+            int firstGridIndex = -1;
+            openvdb::math::Transform::ConstPtr transform;
+
+            FloatGridVec grids;
+            for (ULONG portIdx=0; portIdx<portCount; portIdx++)
+            {
+               CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid, portIdx);
+               VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, it);
+               if (!inVDBPrim) continue;
+
+               const int gridIndex = inVDBPrim->FindGridIndex(name);
+               openvdb::FloatGrid::ConstPtr inGrid;
+               if (gridIndex >= 0) inGrid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(inVDBPrim->GetConstGridPtr(gridIndex));
+               if (!inGrid)
+               {
+                  Application().LogMessage(L"[VDB_Node_CSG] selected grid must be a float grid!", siErrorMsg);
+                  continue;
+               }
+               if (inGrid->getGridClass() != openvdb::GRID_LEVEL_SET)
+               {
+                  Application().LogMessage(L"[VDB_Node_CSG] " + CString(inGrid->getName().c_str()) + L" is not a level set", siWarningMsg);
+               }
+
+               if (!firstVDBPrim)
+               {
+                  firstVDBPrim = inVDBPrim;
+                  firstGridIndex = gridIndex;
+                  transform = inGrid->transformPtr();
+               }
+
+               openvdb::FloatGrid::Ptr grid;
+               if (inGrid->transform() != *transform)
+               {
+                  // only the inputs with another voxel size or placement
+                  // are resampled, into a grid of our own
+                  grid = openvdb::FloatGrid::create(inGrid->background());
+                  grid->setTransform(transform->copy());
+                  grid->setGridClass(inGrid->getGridClass());
+                  openvdb::tools::resampleToMatch<openvdb::tools::BoxSampler>(*inGrid, *grid);
+               }
+               else
+               {
+                  // the csg tools move nodes between the trees they combine,
+                  // the input is still owned by the upstream node
+                  grid = inGrid->deepCopy();
+               }
+               grids.push_back(grid);
+            }
+
+            if (grids.empty())
+            {
+               Application().LogMessage(L"[VDB_Node_CSG] no valid input!", siErrorMsg);
+               return CStatus::OK;
+            }
+
+            if (operation[0] == kDifference && grids.size() > 2)
+            {
+               // a - (b + c + ...), the subtracted grids are merged first
+               ReduceTask reduce = { &grids, 1, grids.size(), kUnion };
+               reduce();
+               combine(*grids[0], *grids[1], kDifference);
+            }
+            else
+            {
+               ReduceTask reduce = { &grids, 0, grids.size(), operation[0] };
+               reduce();
+            }
+
+            openvdb::FloatGrid::Ptr result = grids[0];
+#if OPENVDB_LIBRARY_MAJOR_VERSION >= 3
+            openvdb::tools::pruneLevelSet(result->tree());
+#else
+            result->tree().pruneLevelSet();
+#endif
+
+            // the other grids of the first input are passed through
+            VDB_Primitive::Ptr outVDBPrim = firstVDBPrim->ShallowCopy();
+            outVDBPrim->SetGridAt(firstGridIndex, *result);
+            SetHandleId(output, it, m_outHandles.Add(outVDBPrim));
+
+            Application().LogMessage(L"[VDB_Node_CSG] combined " + CValue((ULONG)grids.size()).GetAsText() + L" grids");
+         }
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_CSG::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_CSG", L"VDB CSG");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   st = nodeDef.PutThreadingModel(siICENodeSingleThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddPortGroup(kGroup2, 2, 10);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   // 0 union, 1 intersection, 2 difference of the first input and the others
+   st = nodeDef.AddInputPort(kOperation, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Operation", L"operation", CValue(0));
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup2,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"VDBGrid", L"vdbGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutVDBGrid, customTypes,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Out", L"outVDBGrid");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_CSG_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_CSG* vdbNode = new VDB_Node_CSG();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_CSG_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_CSG* vdbNode;
+   vdbNode = (VDB_Node_CSG*)(CValue::siPtrType)userData;
+   vdbNode->Evaluate(ctxt);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_CSG_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_CSG* vdbNode;
+      vdbNode = (VDB_Node_CSG*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
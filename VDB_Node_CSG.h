@@ -0,0 +1,31 @@
+// OpenVDB_Softimage
+// VDB_Node_CSG.h
+// ICE node combining two or more level sets with union, intersection or
+// difference
+
+#ifndef VDB_NODE_CSG_H
+#define VDB_NODE_CSG_H
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+#include "VDB_GridRegistry.h"
+
+class VDB_Node_CSG
+{
+public:
+   VDB_Node_CSG();
+   ~VDB_Node_CSG();
+
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   VDB_OutputHandles m_outHandles;
+};
+
+#endif
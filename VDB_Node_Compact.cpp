@@ -0,0 +1,356 @@
+// OpenVDB_Softimage
+// VDB_Node_Compact.cpp
+// ICE node that shrinks the memory footprint of a float grid
+// Prunes nearly constant nodes and deactivates values outside a band
+
+#include <cmath>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+#include <xsi_iceportstate.h>
+
+#include <tbb/parallel_for.h>
+
+#include <openvdb/tree/LeafManager.h>
+#if OPENVDB_LIBRARY_MAJOR_VERSION >= 3
+#include <openvdb/tools/Prune.h>
+#endif
+
+#include "VDB_Node_Compact.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kInVDBGrid = 200;
+static const ULONG kGridName = 201;
+static const ULONG kTolerance = 202;
+static const ULONG kBandWidth = 203;
+static const ULONG kCutoff = 204;
+static const ULONG kQuantize = 205;
+static const ULONG kOutVDBGrid = 300;
+static const ULONG kOutMemBefore = 301;
+static const ULONG kOutMemAfter = 302;
+
+using namespace XSI;
+
+namespace
+{
+   // quantizes and deactivates the active values of each leaf, the tree
+   // structure is left alone so the leaves can be visited in parallel
+   struct CompactLeafsOp
+   {
+      typedef openvdb::tree::LeafManager<openvdb::FloatTree> LeafManagerT;
+
+      float background;
+      bool isLevelSet;
+      float halfWidth;
+      float cutoff;
+      bool quantize;
+
+      void operator()(const LeafManagerT::LeafRange& range) const
+      {
+         for (LeafManagerT::LeafRange::Iterator leaf = range.begin(); leaf; ++leaf)
+         {
+            for (openvdb::FloatTree::LeafNodeType::ValueOnIter iter = leaf->beginValueOn(); iter; ++iter)
+            {
+               float value = *iter;
+               if (quantize)
+               {
+                  value = float(half(value));
+                  iter.setValue(value);
+               }
+               if (isLevelSet)
+               {
+                  // inactive level set voxels only keep their sign
+                  if (halfWidth > 0.0f && std::abs(value) > halfWidth)
+                  {
+                     leaf->setValueOff(iter.pos(), value < 0.0f ? -background : background);
+                  }
+               }
+               else if (cutoff > 0.0f && value <= cutoff)
+               {
+                  leaf->setValueOff(iter.pos(), background);
+               }
+            }
+         }
+      }
+   };
+}
+
+VDB_Node_Compact::VDB_Node_Compact()
+   : m_isValid(false)
+   , m_handleId(0)
+   , m_memBefore(0.0f)
+   , m_memAfter(0.0f)
+{
+}
+
+VDB_Node_Compact::~VDB_Node_Compact()
+{
+}
+
+void VDB_Node_Compact::Apply(openvdb::FloatGrid& grid, float tolerance, float bandWidth,
+   float cutoff, bool quantize)
+{
+   const bool isLevelSet = grid.getGridClass() == openvdb::GRID_LEVEL_SET;
+
+   CompactLeafsOp op;
+   op.background = grid.background();
+   op.isLevelSet = isLevelSet;
+   op.halfWidth = bandWidth * float(grid.voxelSize()[0]);
+   op.cutoff = cutoff;
+   op.quantize = quantize;
+   CompactLeafsOp::LeafManagerT leafs(grid.tree());
+   tbb::parallel_for(leafs.leafRange(), op);
+
+   // nodes left without active values become tiles first, then nearly
+   // constant nodes collapse
+#if OPENVDB_LIBRARY_MAJOR_VERSION >= 3
+   if (isLevelSet) openvdb::tools::pruneLevelSet(grid.tree());
+   else openvdb::tools::pruneInactive(grid.tree());
+   openvdb::tools::prune(grid.tree(), tolerance);
+#else
+   if (isLevelSet) grid.tree().pruneLevelSet();
+   else grid.tree().pruneInactive();
+   grid.tree().prune(tolerance);
+#endif
+
+   // OpenVDB has no half float tree, the quantized values keep 32 bits in
+   // memory but are written and spilled with 16 bits
+   if (quantize) grid.setSaveFloatAsHalf(true);
+}
+
+CStatus VDB_Node_Compact::Cache(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_Compact] Cache");
+
+   m_isValid = false;
+   m_handleId = 0;
+   m_memBefore = 0.0f;
+   m_memAfter = 0.0f;
+   // the previous result is freed once nothing downstream holds it
+   m_outHandles.ReleaseAll();
+
+   CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid);
+   CDataArrayString gridName(ctxt, kGridName);
+   CDataArrayFloat tolerance(ctxt, kTolerance);
+   CDataArrayFloat bandWidth(ctxt, kBandWidth);
+   CDataArrayFloat cutoff(ctxt, kCutoff);
+   CDataArrayBool quantize(ctxt, kQuantize);
+
+   VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, 0);
+   if (!inVDBPrim) return CStatus::Fail;
+
+   int gridIndex = inVDBPrim->FindGridIndex(gridName[0].GetAsciiString());
+   openvdb::FloatGrid::ConstPtr inputGrid;
+   if (gridIndex >= 0)
+   {
+      inputGrid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(inVDBPrim->GetConstGridPtr(gridIndex));
+   }
+   if (!inputGrid)
+   {
+      Application().LogMessage(L"[VDB_Node_Compact] selected grid must be a float grid!", siErrorMsg);
+      return CStatus::Fail;
+   }
+
+   // the input grid is shared with the upstream node, compact a copy
+   openvdb::FloatGrid::Ptr outputGrid = inputGrid->deepCopy();
+   Apply(*outputGrid, tolerance[0], bandWidth[0], cutoff[0], quantize[0]);
+
+   const float megabyte = 1024.0f * 1024.0f;
+   m_memBefore = float(inputGrid->memUsage()) / megabyte;
+   m_memAfter = float(outputGrid->memUsage()) / megabyte;
+   Application().LogMessage(L"[VDB_Node_Compact] " + CValue(m_memBefore).GetAsText() + L" MB -> " + CValue(m_memAfter).GetAsText() + L" MB");
+
+   // the other grids of the primitive are passed through untouched
+   VDB_Primitive::Ptr outVDBPrim = inVDBPrim->ShallowCopy();
+   outVDBPrim->SetGridAt(gridIndex, *outputGrid);
+   m_handleId = m_outHandles.Add(outVDBPrim);
+
+   m_isValid = true;
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_Compact::Evaluate(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_Compact] Evaluate");
+
+   if (!m_isValid) return CStatus::OK;
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+
+   switch (evaluatedPort)
+   {
+      case kOutVDBGrid:
+      {
+         CDataArrayCustomType output(ctxt);
+         SetHandleId(output, 0, m_handleId);
+         break;
+      }
+      case kOutMemBefore:
+      {
+         CDataArrayFloat output(ctxt);
+         output[0] = m_memBefore;
+         break;
+      }
+      case kOutMemAfter:
+      {
+         CDataArrayFloat output(ctxt);
+         output[0] = m_memAfter;
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+bool VDB_Node_Compact::IsValid()
+{
+   return m_isValid;
+}
+
+CStatus VDB_Node_Compact::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_Compact", L"VDB Compact");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   st = nodeDef.PutThreadingModel(siICENodeSingleThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"In", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kTolerance, kGroup1, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Tolerance", L"tolerance", 0.0f);
+   st.AssertSucceeded();
+
+   // level sets only, half width in voxels, zero keeps the band
+   st = nodeDef.AddInputPort(kBandWidth, kGroup1, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Band Width", L"bandWidth", 3.0f);
+   st.AssertSucceeded();
+
+   // fog volumes only, zero keeps every active value
+   st = nodeDef.AddInputPort(kCutoff, kGroup1, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Cutoff", L"cutoff", 0.0f);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kQuantize, kGroup1, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Half Precision", L"quantize", false);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutVDBGrid, customTypes,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Out", L"outVDBGrid");
+   st.AssertSucceeded();
+
+   // megabytes
+   st = nodeDef.AddOutputPort(kOutMemBefore, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Memory Before", L"memBefore");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutMemAfter, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Memory After", L"memAfter");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Compact_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_Compact* vdbNode = new VDB_Node_Compact();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Compact_BeginEvaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Compact* vdbNode;
+   vdbNode = (VDB_Node_Compact*)(CValue::siPtrType)userData;
+
+   // compacting is a full pass over the grid, it only runs again when an
+   // input changed
+   const ULONG ports[] = { kInVDBGrid, kGridName, kTolerance, kBandWidth, kCutoff, kQuantize };
+   bool dirty = false;
+   for (size_t i=0; i<sizeof(ports)/sizeof(ports[0]); ++i)
+   {
+      CICEPortState portState(ctxt, ports[i]);
+      dirty = portState.IsDirty(CICEPortState::siAnyDirtyState) || dirty;
+      portState.ClearState();
+   }
+
+   if (dirty)
+   {
+      vdbNode->Cache(ctxt);
+   }
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Compact_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Compact* vdbNode;
+   vdbNode = (VDB_Node_Compact*)(CValue::siPtrType)userData;
+   if (vdbNode->IsValid())
+   {
+      vdbNode->Evaluate(ctxt);
+   }
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Compact_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_Compact* vdbNode;
+      vdbNode = (VDB_Node_Compact*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
@@ -0,0 +1,45 @@
+// OpenVDB_Softimage
+// VDB_Node_Compact.h
+// ICE node that shrinks the memory footprint of a float grid
+// Prunes nearly constant nodes and deactivates values outside a band
+
+#ifndef VDB_NODE_COMPACT_H
+#define VDB_NODE_COMPACT_H
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+#include "VDB_GridRegistry.h"
+
+class VDB_Node_Compact
+{
+public:
+   VDB_Node_Compact();
+   ~VDB_Node_Compact();
+
+   XSI::CStatus Cache(XSI::ICENodeContext& ctxt);
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   bool IsValid();
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+   // compacts the grid in place. level sets drop the voxels farther than
+   // bandWidth voxels from the surface, fog volumes the values at or below
+   // the cutoff, zero disables either. nodes whose values lie within the
+   // tolerance collapse into tiles. quantizing rounds the values to half
+   // precision so more of them collapse and the grid is saved as half.
+   static void Apply(openvdb::FloatGrid& grid, float tolerance, float bandWidth,
+      float cutoff, bool quantize);
+
+private:
+   bool m_isValid;
+   VDB_OutputHandles m_outHandles;
+   ULONG m_handleId;
+   float m_memBefore;
+   float m_memAfter;
+};
+
+#endif
@@ -0,0 +1,419 @@
+// OpenVDB_Softimage
+// VDB_Node_Expression.cpp
+// ICE node that sets the active voxels of a grid with an SeExpr expression
+// The expression sees $P, $value and the other grids of the primitive by name
+
+#include <map>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+#include <xsi_iceportstate.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/mutex.h>
+#include <tbb/parallel_for.h>
+
+#include <openvdb/tree/LeafManager.h>
+#include <openvdb/tools/Interpolation.h>
+
+#include <SeExpression.h>
+
+#include "VDB_Node_Expression.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kInVDBGrid = 200;
+static const ULONG kGridName = 201;
+static const ULONG kExpression = 202;
+static const ULONG kOutVDBGrid = 300;
+
+using namespace XSI;
+
+namespace
+{
+   inline SeVec3d toSeVec(float value) { return SeVec3d(value, value, value); }
+   inline SeVec3d toSeVec(const openvdb::Vec3s& value) { return SeVec3d(value.x(), value.y(), value.z()); }
+
+   inline void fromSeVec(const SeVec3d& value, float& result) { result = float(value[0]); }
+   inline void fromSeVec(const SeVec3d& value, openvdb::Vec3s& result)
+   {
+      result = openvdb::Vec3s(float(value[0]), float(value[1]), float(value[2]));
+   }
+
+   // position and value of the voxel being evaluated
+   class VoxelVarRef : public SeExprVarRef
+   {
+   public:
+      VoxelVarRef(bool isVec) : SeExprVarRef(isVec) {}
+      virtual void eval(const SeExprVarNode* node, SeVec3d& result) { result = value; }
+
+      SeVec3d value;
+   };
+
+   // another grid of the primitive, sampled trilinearly at $P only when the
+   // expression reads it
+   template<typename GridT>
+   class GridVarRef : public SeExprVarRef
+   {
+   public:
+      GridVarRef(const GridT& grid, const SeVec3d& pos)
+         : SeExprVarRef(openvdb::VecTraits<typename GridT::ValueType>::IsVec)
+         , m_acc(grid.getConstAccessor())
+         , m_xform(grid.transform())
+         , m_pos(pos)
+      {
+      }
+
+      virtual void eval(const SeExprVarNode* node, SeVec3d& result)
+      {
+         const openvdb::Vec3d ijk = m_xform.worldToIndex(openvdb::Vec3d(m_pos[0], m_pos[1], m_pos[2]));
+         result = toSeVec(openvdb::tools::BoxSampler::sample(m_acc, ijk));
+      }
+
+   private:
+      typename GridT::ConstAccessor m_acc;
+      const openvdb::math::Transform& m_xform;
+      const SeVec3d& m_pos;
+   };
+
+   // an SeExpression keeps its variable values in the instance, each thread
+   // evaluates its own copy
+   class VoxelExpression : public SeExpression
+   {
+   public:
+      VoxelExpression(const std::string& expr, bool isVec, const VDB_Primitive& prim)
+         : SeExpression(expr, isVec)
+         , m_prim(prim)
+         , m_pos(true)
+         , m_value(isVec)
+      {
+      }
+
+      void SetVoxel(const openvdb::Vec3d& pos, const SeVec3d& value)
+      {
+         m_pos.value = SeVec3d(pos.x(), pos.y(), pos.z());
+         m_value.value = value;
+      }
+
+      virtual SeExprVarRef* resolveVar(const std::string& name) const
+      {
+         if (name == "P") return &m_pos;
+         if (name == "value") return &m_value;
+
+         GridRefMap::iterator it = m_gridRefs.find(name);
+         if (it != m_gridRefs.end()) return it->second.get();
+
+         int gridIndex = m_prim.FindGridIndex(name);
+         if (gridIndex < 0) return NULL;
+
+         openvdb::GridBase::ConstPtr grid = m_prim.GetConstGridPtr(gridIndex);
+         boost::shared_ptr<SeExprVarRef> ref;
+         if (grid->isType<openvdb::FloatGrid>())
+         {
+            ref.reset(new GridVarRef<openvdb::FloatGrid>(static_cast<const openvdb::FloatGrid&>(*grid), m_pos.value));
+         }
+         else if (grid->isType<openvdb::Vec3SGrid>())
+         {
+            ref.reset(new GridVarRef<openvdb::Vec3SGrid>(static_cast<const openvdb::Vec3SGrid&>(*grid), m_pos.value));
+         }
+         if (!ref) return NULL;
+
+         // the accessor points into the grid, keep it alive with the expression
+         m_grids.push_back(grid);
+         m_gridRefs[name] = ref;
+         return ref.get();
+      }
+
+   private:
+      typedef std::map<std::string, boost::shared_ptr<SeExprVarRef> > GridRefMap;
+
+      const VDB_Primitive& m_prim;
+      mutable VoxelVarRef m_pos;
+      mutable VoxelVarRef m_value;
+      mutable GridRefMap m_gridRefs;
+      mutable std::vector<openvdb::GridBase::ConstPtr> m_grids;
+   };
+
+   typedef boost::shared_ptr<VoxelExpression> VoxelExpressionPtr;
+   typedef tbb::enumerable_thread_specific<VoxelExpressionPtr> ThreadExpressions;
+
+   template<typename TreeT>
+   struct EvalLeafsOp
+   {
+      typedef openvdb::tree::LeafManager<TreeT> LeafManagerT;
+      typedef typename TreeT::ValueType ValueT;
+
+      const std::string* expr;
+      const VDB_Primitive* prim;
+      const openvdb::math::Transform* xform;
+      ThreadExpressions* expressions;
+      tbb::mutex* parseMutex;
+
+      void operator()(const typename LeafManagerT::LeafRange& range) const
+      {
+         // the expression is looked up once per range of leaves, not per voxel
+         VoxelExpressionPtr& local = expressions->local();
+         if (!local)
+         {
+            tbb::mutex::scoped_lock lock(*parseMutex);
+            local.reset(new VoxelExpression(*expr, openvdb::VecTraits<ValueT>::IsVec, *prim));
+            local->isValid();
+         }
+         VoxelExpression& expression = *local;
+
+         for (typename LeafManagerT::LeafRange::Iterator leaf = range.begin(); leaf; ++leaf)
+         {
+            for (typename TreeT::LeafNodeType::ValueOnIter iter = leaf->beginValueOn(); iter; ++iter)
+            {
+               expression.SetVoxel(xform->indexToWorld(iter.getCoord()), toSeVec(*iter));
+               ValueT value;
+               fromSeVec(expression.evaluate(), value);
+               iter.setValue(value);
+            }
+         }
+      }
+   };
+
+   template<typename GridT>
+   bool evalExpression(GridT& grid, const std::string& expr, const VDB_Primitive& prim, std::string& error)
+   {
+      typedef typename GridT::TreeType TreeT;
+
+      // parse on the calling thread first so an error is reported once, the
+      // instance is reused by the leaves this thread evaluates
+      VoxelExpressionPtr exemplar(new VoxelExpression(expr, openvdb::VecTraits<typename GridT::ValueType>::IsVec, prim));
+      if (!exemplar->isValid())
+      {
+         error = exemplar->parseError();
+         return false;
+      }
+
+      ThreadExpressions expressions;
+      expressions.local() = exemplar;
+      tbb::mutex parseMutex;
+
+      EvalLeafsOp<TreeT> op;
+      op.expr = &expr;
+      op.prim = &prim;
+      op.xform = &grid.transform();
+      op.expressions = &expressions;
+      op.parseMutex = &parseMutex;
+      typename EvalLeafsOp<TreeT>::LeafManagerT leafs(grid.tree());
+      tbb::parallel_for(leafs.leafRange(), op);
+      return true;
+   }
+}
+
+VDB_Node_Expression::VDB_Node_Expression()
+   : m_isValid(false)
+   , m_handleId(0)
+{
+}
+
+VDB_Node_Expression::~VDB_Node_Expression()
+{
+}
+
+bool VDB_Node_Expression::Apply(openvdb::GridBase& grid, const std::string& expr,
+   const VDB_Primitive& prim, std::string& error)
+{
+   if (grid.isType<openvdb::FloatGrid>())
+   {
+      return evalExpression(static_cast<openvdb::FloatGrid&>(grid), expr, prim, error);
+   }
+   if (grid.isType<openvdb::Vec3SGrid>())
+   {
+      return evalExpression(static_cast<openvdb::Vec3SGrid&>(grid), expr, prim, error);
+   }
+   error = "grid must be a float or vector grid";
+   return false;
+}
+
+CStatus VDB_Node_Expression::Cache(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_Expression] Cache");
+
+   m_isValid = false;
+   m_handleId = 0;
+   // the previous result is freed once nothing downstream holds it
+   m_outHandles.ReleaseAll();
+
+   CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid);
+   CDataArrayString gridName(ctxt, kGridName);
+   CDataArrayString expression(ctxt, kExpression);
+
+   VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, 0);
+   if (!inVDBPrim) return CStatus::Fail;
+
+   int gridIndex = inVDBPrim->FindGridIndex(gridName[0].GetAsciiString());
+   if (gridIndex < 0)
+   {
+      Application().LogMessage(L"[VDB_Node_Expression] grid not found!", siErrorMsg);
+      return CStatus::Fail;
+   }
+
+   // the input grid is shared with the upstream node, evaluate on a copy.
+   // other grids read by the expression come from the input primitive, so a
+   // grid reading itself sees the values from before the expression ran
+   openvdb::GridBase::Ptr outputGrid = inVDBPrim->GetConstGridPtr(gridIndex)->deepCopyGrid();
+   std::string error;
+   if (!Apply(*outputGrid, expression[0].GetAsciiString(), *inVDBPrim, error))
+   {
+      Application().LogMessage(L"[VDB_Node_Expression] " + CString(error.c_str()), siErrorMsg);
+      return CStatus::Fail;
+   }
+
+   // the other grids of the primitive are passed through untouched
+   VDB_Primitive::Ptr outVDBPrim = inVDBPrim->ShallowCopy();
+   outVDBPrim->SetGridAt(gridIndex, *outputGrid);
+   m_handleId = m_outHandles.Add(outVDBPrim);
+
+   m_isValid = true;
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_Expression::Evaluate(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_Expression] Evaluate");
+
+   if (!m_isValid) return CStatus::OK;
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+
+   switch (evaluatedPort)
+   {
+      case kOutVDBGrid:
+      {
+         CDataArrayCustomType output(ctxt);
+         SetHandleId(output, 0, m_handleId);
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+bool VDB_Node_Expression::IsValid()
+{
+   return m_isValid;
+}
+
+CStatus VDB_Node_Expression::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_Expression", L"VDB Expression");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   st = nodeDef.PutThreadingModel(siICENodeSingleThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"In", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kExpression, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Expression", L"expression", L"$value");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutVDBGrid, customTypes,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Out", L"outVDBGrid");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Expression_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_Expression* vdbNode = new VDB_Node_Expression();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Expression_BeginEvaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Expression* vdbNode;
+   vdbNode = (VDB_Node_Expression*)(CValue::siPtrType)userData;
+
+   // the expression is parsed and run over the grid only when an input changed
+   const ULONG ports[] = { kInVDBGrid, kGridName, kExpression };
+   bool dirty = false;
+   for (size_t i=0; i<sizeof(ports)/sizeof(ports[0]); ++i)
+   {
+      CICEPortState portState(ctxt, ports[i]);
+      dirty = portState.IsDirty(CICEPortState::siAnyDirtyState) || dirty;
+      portState.ClearState();
+   }
+
+   if (dirty)
+   {
+      vdbNode->Cache(ctxt);
+   }
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Expression_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Expression* vdbNode;
+   vdbNode = (VDB_Node_Expression*)(CValue::siPtrType)userData;
+   if (vdbNode->IsValid())
+   {
+      vdbNode->Evaluate(ctxt);
+   }
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Expression_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_Expression* vdbNode;
+      vdbNode = (VDB_Node_Expression*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
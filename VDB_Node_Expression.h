@@ -0,0 +1,45 @@
+// OpenVDB_Softimage
+// VDB_Node_Expression.h
+// ICE node that sets the active voxels of a grid with an SeExpr expression
+// The expression sees $P, $value and the other grids of the primitive by name
+
+#ifndef VDB_NODE_EXPRESSION_H
+#define VDB_NODE_EXPRESSION_H
+
+#include <string>
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+#include "VDB_GridRegistry.h"
+
+class VDB_Node_Expression
+{
+public:
+   VDB_Node_Expression();
+   ~VDB_Node_Expression();
+
+   XSI::CStatus Cache(XSI::ICENodeContext& ctxt);
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   bool IsValid();
+
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+   // evaluates the expression on every active voxel of the float or vector
+   // grid in place. $P is the world position of the voxel, $value its value
+   // and any other variable names a grid of the primitive, sampled at $P.
+   // the expression is parsed once per thread, returns false and the parse
+   // error when it is invalid.
+   static bool Apply(openvdb::GridBase& grid, const std::string& expr,
+      const VDB_Primitive& prim, std::string& error);
+
+private:
+   bool m_isValid;
+   VDB_OutputHandles m_outHandles;
+   ULONG m_handleId;
+};
+
+#endif
@@ -5,6 +5,7 @@
 // The noise can optionally be masked by another level set
 
 #include <xsi_application.h>
+#include <xsi_context.h>
 #include <xsi_icenodedef.h>
 #include <xsi_factory.h>
 #include <xsi_dataarray.h>
@@ -15,10 +16,10 @@
 #include <xsi_iceportstate.h>
 
 //#include <SeVec3d.h>
-#include <SeNoise.h>
 
 #include "VDB_Node_FBM.h"
 #include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
 
 // port values
 static const ULONG kGroup1 = 100;
@@ -26,6 +27,7 @@ static const ULONG kInVDBGrid = 200;
 static const ULONG kOctaves = 201;
 static const ULONG kLacunarity = 202;
 static const ULONG kGain = 203;
+static const ULONG kGridName = 204;
 static const ULONG kOutVDBGrid = 300;
 
 using namespace XSI;
@@ -54,49 +56,45 @@ CStatus VDB_Node_FBM::Evaluate(ICENodeContext& ctxt)
          CDataArrayCustomType output(ctxt);
          CIndexSet indexSet(ctxt);
 
+         // the previous result is freed once nothing downstream holds it
+         m_outHandles.ReleaseAll();
+
          for(CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
          {
             //Application().LogMessage(L"[VDB_Node_FBM] iterator index = " + CValue(it.GetIndex()).GetAsText());
 
-            ULONG inDataSize;
-            VDB_Primitive* inVDBPrim;
-            inVDBGridPort.GetData(it, (const CDataArrayCustomType::TData**)&inVDBPrim, inDataSize);
-            if (!inDataSize)
+            VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, it);
+            if (!inVDBPrim)
             {
-               Application().LogMessage(L"[VDB_Node_FBM] data size is invalid!", siErrorMsg);
+               Application().LogMessage(L"[VDB_Node_FBM] input handle is invalid!", siErrorMsg);
                return CStatus::OK;
             }
-            Application().LogMessage(L"[VDB_Node_FBM] previous data size = " + CValue(inDataSize).GetAsText());
 
-            openvdb::GridBase::Ptr grid = inVDBPrim->GetGridPtr();
-            openvdb::FloatGrid::Ptr outputGrid;
-            outputGrid = openvdb::gridPtrCast<openvdb::FloatGrid>(grid);
-            //openvdb::math::Transform::Ptr transform = outputGrid->getTransform();
-            
-            CDataArrayLong octaves(ctxt, kOctaves);
-            CDataArrayFloat lacunarity(ctxt, kLacunarity);
-            CDataArrayFloat gain(ctxt, kGain);
+            CDataArrayString gridName(ctxt, kGridName);
+            int gridIndex = inVDBPrim->FindGridIndex(gridName[0].GetAsciiString());
 
-            for (openvdb::FloatGrid::ValueOnIter iter = outputGrid->beginValueOn(); iter; ++iter)
+            openvdb::FloatGrid::ConstPtr inputGrid;
+            if (gridIndex >= 0)
             {
-               if (iter.isVoxelValue())
-               {
-                  openvdb::Coord coord = iter.getCoord();
-                  openvdb::Vec3d vec = outputGrid->indexToWorld(coord);
-                  double result;
-                  double p[3] = {vec.x(), vec.y(), vec.z()};
-                  SeExpr::FBM<3,1,false>(p, &result, double(octaves[0]), double(lacunarity[0]), double(gain[0]));
-                  Application().LogMessage(CValue(vec.x()).GetAsText() + "," + CValue(vec.y()).GetAsText() + "," + CValue(vec.z()).GetAsText(), siVerboseMsg);
-                  Application().LogMessage(CValue(.5*result+.5).GetAsText(), siVerboseMsg);
-                  iter.setValue(*iter + 1.0f * result);
-               }
+               inputGrid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(inVDBPrim->GetBaseGridPtr(gridIndex));
+            }
+            if (!inputGrid)
+            {
+               Application().LogMessage(L"[VDB_Node_FBM] selected grid must be a float grid!", siErrorMsg);
+               return CStatus::OK;
             }
 
-            VDB_Primitive* outVDBPrim = (VDB_Primitive*)output.Resize(it, sizeof(VDB_Primitive));
-            ::memcpy(outVDBPrim, inVDBPrim, inDataSize);
+            CDataArrayLong octaves(ctxt, kOctaves);
+            CDataArrayFloat lacunarity(ctxt, kLacunarity);
+            CDataArrayFloat gain(ctxt, kGain);
 
-            Application().LogMessage(L"[VDB_Node_FBM] memcpy succeeded");
-            Application().LogMessage(L"[VDB_Node_FBM] grid type is " + CString(inVDBPrim->GetTypeName()));
+            // the noise is deferred onto the grid and fused with the other
+            // pending operations when a node reads the values
+            VDB_Primitive::Ptr outVDBPrim = inVDBPrim->ShallowCopy();
+            outVDBPrim->AddPendingOp(gridIndex, VDB_VoxelOp::ConstPtr(new VDB_FBMOp(octaves[0], lacunarity[0], gain[0], false)));
+            SetHandleId(output, it, m_outHandles.Add(outVDBPrim));
+
+            Application().LogMessage(L"[VDB_Node_FBM] grid type is " + CString(outVDBPrim->GetTypeName(gridIndex)));
          }
          break;
       }
@@ -153,6 +151,11 @@ CStatus VDB_Node_FBM::Register(PluginRegistrar& reg)
       L"Gain", L"gain", CValue(0.5));
    st.AssertSucceeded();
 
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
    st = nodeDef.AddOutputPort(kOutVDBGrid, customTypes,
       siICENodeStructureSingle, siICENodeContextSingleton,
       L"Out", L"outVDBGrid");
@@ -181,9 +184,33 @@ SICALLBACK VDB_Node_FBM_BeginEvaluate(ICENodeContext& ctxt)
    return CStatus::OK;
 }
 
-SICALLBACK VDB_Node_FBM_Evaluate(ICENodeContext& ctxt)
+SICALLBACK VDB_Node_FBM_Init(CRef& in_ctxt)
 {
+   Context ctxt(in_ctxt);
    VDB_Node_FBM* vdbNode = new VDB_Node_FBM();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_FBM_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_FBM* vdbNode;
+   vdbNode = (VDB_Node_FBM*)(CValue::siPtrType)userData;
    vdbNode->Evaluate(ctxt);
    return CStatus::OK;
 }
+
+SICALLBACK VDB_Node_FBM_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_FBM* vdbNode;
+      vdbNode = (VDB_Node_FBM*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
@@ -13,6 +13,8 @@
 
 #include <openvdb/openvdb.h>
 
+#include "VDB_GridRegistry.h"
+
 class VDB_Node_FBM
 {
 public:
@@ -22,6 +24,9 @@ public:
    XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
    
    static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   VDB_OutputHandles m_outHandles;
 };
 
 #endif
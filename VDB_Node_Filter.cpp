@@ -0,0 +1,287 @@
+// OpenVDB_Softimage
+// VDB_Node_Filter.cpp
+// ICE node that smooths or offsets a level set or a fog volume
+// The filter can optionally be masked by another grid
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+
+#include <openvdb/tools/LevelSetFilter.h>
+#include <openvdb/tools/Filter.h>
+
+#include "VDB_Node_Filter.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kInVDBGrid = 200;
+static const ULONG kGridName = 201;
+static const ULONG kFilter = 202;
+static const ULONG kIterations = 203;
+static const ULONG kWidth = 204;
+static const ULONG kOffset = 205;
+static const ULONG kMaskVDBGrid = 206;
+static const ULONG kMaskGridName = 207;
+static const ULONG kOutVDBGrid = 300;
+
+using namespace XSI;
+
+VDB_Node_Filter::VDB_Node_Filter()
+{
+}
+
+VDB_Node_Filter::~VDB_Node_Filter()
+{
+}
+
+bool VDB_Node_Filter::Apply(openvdb::FloatGrid& grid, int filter, int width, int iterations,
+   float offset, const openvdb::FloatGrid* mask, std::string& error)
+{
+   if (width < 1) width = 1;
+   if (iterations < 1) iterations = 1;
+
+   // both filters work leaf by leaf on all cores, level sets only visit
+   // their narrow band and are renormalized after each iteration
+   if (grid.getGridClass() == openvdb::GRID_LEVEL_SET)
+   {
+      openvdb::tools::LevelSetFilter<openvdb::FloatGrid> filterOp(grid);
+      for (int i=0; i<iterations; ++i)
+      {
+         switch (filter)
+         {
+            case kFilterMean: filterOp.mean(width, mask); break;
+            case kFilterMedian: filterOp.median(width, mask); break;
+            case kFilterGaussian: filterOp.gaussian(width, mask); break;
+            case kFilterMeanCurvature: filterOp.meanCurvature(mask); break;
+            case kFilterLaplacian: filterOp.laplacian(mask); break;
+            // the level set offset moves the surface inward
+            case kFilterOffset: filterOp.offset(-offset, mask); return true;
+            default:
+               error = "unknown filter";
+               return false;
+         }
+      }
+      return true;
+   }
+
+   openvdb::tools::Filter<openvdb::FloatGrid> filterOp(grid);
+   switch (filter)
+   {
+      case kFilterMean: filterOp.mean(width, iterations, mask); break;
+      case kFilterMedian: filterOp.median(width, iterations, mask); break;
+      case kFilterGaussian: filterOp.gaussian(width, iterations, mask); break;
+      case kFilterOffset: filterOp.offset(offset, mask); break;
+      case kFilterMeanCurvature:
+      case kFilterLaplacian:
+         error = "mean curvature and laplacian flow need a level set";
+         return false;
+      default:
+         error = "unknown filter";
+         return false;
+   }
+   return true;
+}
+
+CStatus VDB_Node_Filter::Evaluate(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_Filter] Evaluate");
+
+   CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid);
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+
+   switch (evaluatedPort)
+   {
+      case kOutVDBGrid:
+      {
+         CDataArrayCustomType output(ctxt);
+         CIndexSet indexSet(ctxt);
+
+         // the previous result is freed once nothing downstream holds it
+         m_outHandles.ReleaseAll();
+
+         CDataArrayString gridName(ctxt, kGridName);
+         CDataArrayLong filter(ctxt, kFilter);
+         CDataArrayLong iterations(ctxt, kIterations);
+         CDataArrayLong width(ctxt, kWidth);
+         CDataArrayFloat offset(ctxt, kOffset);
+         CDataArrayCustomType maskVDBGridPort(ctxt, kMaskVDBGrid);
+         CDataArrayString maskGridName(ctxt, kMaskGridName);
+
+         for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+         {
+            VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, it);
+            if (!inVDBPrim)
+            {
+               Application().LogMessage(L"[VDB_Node_Filter] input handle is invalid!", siErrorMsg);
+               return CStatus::OK;
+            }
+
+            int gridIndex = inVDBPrim->FindGridIndex(gridName[0].GetAsciiString());
+
+            openvdb::FloatGrid::ConstPtr inputGrid;
+            if (gridIndex >= 0)
+            {
+               inputGrid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(inVDBPrim->GetConstGridPtr(gridIndex));
+            }
+            if (!inputGrid)
+            {
+               Application().LogMessage(L"[VDB_Node_Filter] selected grid must be a float grid!", siErrorMsg);
+               return CStatus::OK;
+            }
+
+            // the mask is optional, an unconnected port has no primitive
+            openvdb::FloatGrid::ConstPtr maskGrid;
+            VDB_Primitive::Ptr maskVDBPrim = GetPrimitive(maskVDBGridPort, it);
+            if (maskVDBPrim)
+            {
+               int maskIndex = maskVDBPrim->FindGridIndex(maskGridName[0].GetAsciiString());
+               if (maskIndex >= 0)
+               {
+                  maskGrid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(maskVDBPrim->GetConstGridPtr(maskIndex));
+               }
+               if (!maskGrid)
+               {
+                  Application().LogMessage(L"[VDB_Node_Filter] mask grid must be a float grid!", siErrorMsg);
+                  return CStatus::OK;
+               }
+            }
+
+            // the input grid is shared with the upstream node, filter a copy
+            openvdb::FloatGrid::Ptr outputGrid = inputGrid->deepCopy();
+            std::string error;
+            if (!Apply(*outputGrid, filter[0], width[0], iterations[0], offset[0], maskGrid.get(), error))
+            {
+               Application().LogMessage(L"[VDB_Node_Filter] " + CString(error.c_str()), siErrorMsg);
+               return CStatus::OK;
+            }
+
+            // the other grids of the primitive are passed through untouched
+            VDB_Primitive::Ptr outVDBPrim = inVDBPrim->ShallowCopy();
+            outVDBPrim->SetGridAt(gridIndex, *outputGrid);
+            SetHandleId(output, it, m_outHandles.Add(outVDBPrim));
+         }
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_Filter::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_Filter", L"VDB Filter");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   st = nodeDef.PutThreadingModel(siICENodeSingleThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"In", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
+   // 0 mean, 1 median, 2 gaussian, 3 mean curvature, 4 laplacian, 5 offset
+   st = nodeDef.AddInputPort(kFilter, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Filter", L"filter", CValue(0));
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kIterations, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Iterations", L"iterations", CValue(1));
+   st.AssertSucceeded();
+
+   // radius in voxels of the mean, median and gaussian filters
+   st = nodeDef.AddInputPort(kWidth, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Width", L"width", CValue(1));
+   st.AssertSucceeded();
+
+   // world units, positive dilates and negative erodes
+   st = nodeDef.AddInputPort(kOffset, kGroup1, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Offset", L"offset", 0.0f);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kMaskVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Mask", L"maskVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kMaskGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Mask Grid Name", L"maskGridName", L"");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutVDBGrid, customTypes,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Out", L"outVDBGrid");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Filter_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_Filter* vdbNode = new VDB_Node_Filter();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Filter_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Filter* vdbNode;
+   vdbNode = (VDB_Node_Filter*)(CValue::siPtrType)userData;
+   vdbNode->Evaluate(ctxt);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Filter_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_Filter* vdbNode;
+      vdbNode = (VDB_Node_Filter*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
@@ -0,0 +1,50 @@
+// OpenVDB_Softimage
+// VDB_Node_Filter.h
+// ICE node that smooths or offsets a level set or a fog volume
+// The filter can optionally be masked by another grid
+
+#ifndef VDB_NODE_FILTER_H
+#define VDB_NODE_FILTER_H
+
+#include <string>
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+#include "VDB_GridRegistry.h"
+
+// filters exposed on the port
+enum VDB_FilterType
+{
+   kFilterMean = 0,
+   kFilterMedian = 1,
+   kFilterGaussian = 2,
+   kFilterMeanCurvature = 3,
+   kFilterLaplacian = 4,
+   kFilterOffset = 5
+};
+
+class VDB_Node_Filter
+{
+public:
+   VDB_Node_Filter();
+   ~VDB_Node_Filter();
+
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+   // filters the grid in place, level sets keep their narrow band. a positive
+   // offset in world units dilates, a negative one erodes. returns false and
+   // sets the error when the filter does not apply to the grid.
+   static bool Apply(openvdb::FloatGrid& grid, int filter, int width, int iterations,
+      float offset, const openvdb::FloatGrid* mask, std::string& error);
+
+private:
+   VDB_OutputHandles m_outHandles;
+};
+
+#endif
@@ -3,6 +3,7 @@
 // Mesh to Volume custom ICE node
 
 #include <xsi_application.h>
+#include <xsi_context.h>
 #include <xsi_icenodedef.h>
 #include <xsi_factory.h>
 #include <xsi_dataarray.h>
@@ -10,11 +11,15 @@
 #include <xsi_icegeometry.h>
 #include <xsi_doublearray.h>
 #include <xsi_longarray.h>
+#include <xsi_icenode.h>
+#include <xsi_parameter.h>
 
 #include <openvdb/tools/MeshToVolume.h>
 
 #include "VDB_Node_MeshToVolume.h"
 #include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+#include "VDB_ProxyMode.h"
 
 // port values
 static const ULONG kGroup1 = 100;
@@ -23,17 +28,21 @@ static const ULONG kVoxelSize = 1;
 static const ULONG kExteriorWidth = 2;
 static const ULONG kInteriorWidth = 3;
 static const ULONG kGridName = 4;
+static const ULONG kRefineGeneration = 5;
 static const ULONG kVDBGrid = 200;
 
 using namespace XSI;
 
-VDB_Node_MeshToVolume::VDB_Node_MeshToVolume()
+VDB_Node_MeshToVolume::VDB_Node_MeshToVolume(const CRef& refineParam)
    : m_isDirty(true)
+   , m_refineParam(refineParam)
+   , m_refineGeneration(0)
 {
 }
 
 VDB_Node_MeshToVolume::~VDB_Node_MeshToVolume()
 {
+   VDB_ProxyMode::Get().RemoveNode(this);
 }
 
 CStatus VDB_Node_MeshToVolume::Evaluate(ICENodeContext& ctxt)
@@ -42,7 +51,15 @@ CStatus VDB_Node_MeshToVolume::Evaluate(ICENodeContext& ctxt)
 
    CDataArrayFloat voxelSize(ctxt, kVoxelSize);
 
-   m_transform = openvdb::math::Transform::createLinearTransform(voxelSize[0]);
+   // a new refine generation means the proxy mode asks for full resolution
+   CDataArrayLong refineGeneration(ctxt, kRefineGeneration);
+   const bool refining = refineGeneration[0] != m_refineGeneration;
+   m_refineGeneration = refineGeneration[0];
+
+   // in proxy mode the whole chain downstream works on a coarser grid, the
+   // band widths are in voxels so they scale along
+   const float proxyFactor = refining ? 1.0f : VDB_ProxyMode::Get().AcquireVoxelScale();
+   m_transform = openvdb::math::Transform::createLinearTransform(voxelSize[0] * proxyFactor);
 
    CICEGeometry geometry(ctxt, kGeometry);
    if (!geometry.IsValid())
@@ -103,11 +120,22 @@ CStatus VDB_Node_MeshToVolume::Evaluate(ICENodeContext& ctxt)
       {
          CDataArrayCustomType output(ctxt);
          CIndexSet::Iterator it = CIndexSet(ctxt).Begin();
+
+         // the previous result is freed once nothing downstream holds it
+         m_outHandles.ReleaseAll();
+         VDB_Primitive::Ptr vdbPrim(new VDB_Primitive());
+         vdbPrim->SetGrid(*outputGrid);
+         if (proxyFactor != 1.0f)
+         {
+            vdbPrim->GetMetadata().insertMeta(kProxyFactorMeta, openvdb::FloatMetadata(proxyFactor));
+         }
+         ULONG handleId = m_outHandles.Add(vdbPrim);
+         // a proxy grid stays in a clean tree until the node is dirtied
+         VDB_ProxyMode::Get().SetNodeScale(this, m_refineParam, proxyFactor);
         
          for(; it.HasNext(); it.Next())
          {
-            VDB_Primitive* vdbPrim = (VDB_Primitive*)output.Resize(it, sizeof(VDB_Primitive));
-            vdbPrim->SetGrid(*outputGrid);
+            SetHandleId(output, it, handleId);
          }
          break;
       }
@@ -164,7 +192,14 @@ CStatus VDB_Node_MeshToVolume::Register(PluginRegistrar& reg)
    st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
       siICENodeStructureSingle, siICENodeContextSingleton,
       L"Grid Name", L"gridName", L"");
-   st.AssertSucceeded();
+   st.AssertSucceeded();
+
+   // internal, bumped by the proxy mode to dirty the node when its proxy
+   // grid should be refined
+   st = nodeDef.AddInputPort(kRefineGeneration, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Refine Generation", L"refineGeneration", CValue(0));
+   st.AssertSucceeded();
 
    // Add custom type names.
    CStringArray customTypes(1);
@@ -180,9 +215,34 @@ CStatus VDB_Node_MeshToVolume::Register(PluginRegistrar& reg)
    return CStatus::OK;
 }
 
+SICALLBACK VDB_Node_MeshToVolume_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   ICENode node(ctxt.GetSource());
+   VDB_Node_MeshToVolume* vdbNode = new VDB_Node_MeshToVolume(node.GetParameter(L"refineGeneration").GetRef());
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
 SICALLBACK VDB_Node_MeshToVolume_Evaluate(ICENodeContext& ctxt)
 {
-   VDB_Node_MeshToVolume* vdbNode = new VDB_Node_MeshToVolume();
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_MeshToVolume* vdbNode;
+   vdbNode = (VDB_Node_MeshToVolume*)(CValue::siPtrType)userData;
    vdbNode->Evaluate(ctxt);
    return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_MeshToVolume_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_MeshToVolume* vdbNode;
+      vdbNode = (VDB_Node_MeshToVolume*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
 }
\ No newline at end of file
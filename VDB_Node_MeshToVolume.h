@@ -8,13 +8,17 @@
 #include <xsi_pluginregistrar.h>
 #include <xsi_status.h>
 #include <xsi_icenodecontext.h>
+#include <xsi_ref.h>
 
 #include <openvdb/openvdb.h>
 
+#include "VDB_GridRegistry.h"
+
 class VDB_Node_MeshToVolume
 {
 public:
-   VDB_Node_MeshToVolume();
+   // refineParam is the refine generation port bumped by the proxy mode
+   VDB_Node_MeshToVolume(const XSI::CRef& refineParam);
    ~VDB_Node_MeshToVolume();
 
    XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
@@ -22,7 +26,10 @@ public:
    static XSI::CStatus Register(XSI::PluginRegistrar& reg);
 private:
    bool m_isDirty;
+   XSI::CRef m_refineParam;
+   LONG m_refineGeneration;
    openvdb::math::Transform::Ptr m_transform;
+   VDB_OutputHandles m_outHandles;
 };
 
 #endif
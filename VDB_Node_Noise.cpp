@@ -4,6 +4,7 @@
 // The noise can optionally be masked by another level set
 
 #include <xsi_application.h>
+#include <xsi_context.h>
 #include <xsi_icenodedef.h>
 #include <xsi_factory.h>
 #include <xsi_dataarray.h>
@@ -14,14 +15,15 @@
 #include <xsi_iceportstate.h>
 
 //#include <SeVec3d.h>
-#include <SeNoise.h>
 
 #include "VDB_Node_Noise.h"
 #include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
 
 // port values
 static const ULONG kGroup1 = 100;
 static const ULONG kInVDBGrid = 200;
+static const ULONG kGridName = 201;
 static const ULONG kOutVDBGrid = 300;
 
 using namespace XSI;
@@ -50,45 +52,41 @@ CStatus VDB_Node_Noise::Evaluate(ICENodeContext& ctxt)
          CDataArrayCustomType output(ctxt);
          CIndexSet indexSet(ctxt);
 
+         // the previous result is freed once nothing downstream holds it
+         m_outHandles.ReleaseAll();
+
          for(CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
          {
             //Application().LogMessage(L"[VDB_Node_Noise] iterator index = " + CValue(it.GetIndex()).GetAsText());
 
-            ULONG inDataSize;
-            VDB_Primitive* inVDBPrim;
-            inVDBGridPort.GetData(it, (const CDataArrayCustomType::TData**)&inVDBPrim, inDataSize);
-            if (!inDataSize)
+            VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, it);
+            if (!inVDBPrim)
             {
-               Application().LogMessage(L"[VDB_Node_Noise] data size is invalid!", siErrorMsg);
+               Application().LogMessage(L"[VDB_Node_Noise] input handle is invalid!", siErrorMsg);
                return CStatus::OK;
             }
-            Application().LogMessage(L"[VDB_Node_Noise] previous data size = " + CValue(inDataSize).GetAsText());
 
-            openvdb::GridBase::Ptr grid = inVDBPrim->GetGridPtr();
-            openvdb::FloatGrid::Ptr outputGrid;
-            outputGrid = openvdb::gridPtrCast<openvdb::FloatGrid>(grid);
-            //openvdb::math::Transform::Ptr transform = outputGrid->getTransform();
+            CDataArrayString gridName(ctxt, kGridName);
+            int gridIndex = inVDBPrim->FindGridIndex(gridName[0].GetAsciiString());
 
-            for (openvdb::FloatGrid::ValueOnIter iter = outputGrid->beginValueOn(); iter; ++iter)
+            openvdb::FloatGrid::ConstPtr inputGrid;
+            if (gridIndex >= 0)
             {
-               if (iter.isVoxelValue())
-               {
-                  openvdb::Coord coord = iter.getCoord();
-                  openvdb::Vec3d vec = outputGrid->indexToWorld(coord);
-                  double result;
-                  double p[3] = {vec.x(), vec.y(), vec.z()};
-                  SeExpr::Noise<3,1>(p, &result);
-                  Application().LogMessage(CValue(vec.x()).GetAsText() + "," + CValue(vec.y()).GetAsText() + "," + CValue(vec.z()).GetAsText(), siVerboseMsg);
-                  Application().LogMessage(CValue(.5*result+.5).GetAsText(), siVerboseMsg);
-                  iter.setValue(*iter + 1.0f * result);
-               }
+               inputGrid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(inVDBPrim->GetBaseGridPtr(gridIndex));
+            }
+            if (!inputGrid)
+            {
+               Application().LogMessage(L"[VDB_Node_Noise] selected grid must be a float grid!", siErrorMsg);
+               return CStatus::OK;
             }
 
-            VDB_Primitive* outVDBPrim = (VDB_Primitive*)output.Resize(it, sizeof(VDB_Primitive));
-            ::memcpy(outVDBPrim, inVDBPrim, inDataSize);
+            // the noise is deferred onto the grid and fused with the other
+            // pending operations when a node reads the values
+            VDB_Primitive::Ptr outVDBPrim = inVDBPrim->ShallowCopy();
+            outVDBPrim->AddPendingOp(gridIndex, VDB_VoxelOp::ConstPtr(new VDB_NoiseOp()));
+            SetHandleId(output, it, m_outHandles.Add(outVDBPrim));
 
-            Application().LogMessage(L"[VDB_Node_Noise] memcpy succeeded");
-            Application().LogMessage(L"[VDB_Node_Noise] grid type is " + CString(inVDBPrim->GetTypeName()));
+            Application().LogMessage(L"[VDB_Node_Noise] grid type is " + CString(outVDBPrim->GetTypeName(gridIndex)));
          }
          break;
       }
@@ -130,6 +128,11 @@ CStatus VDB_Node_Noise::Register(PluginRegistrar& reg)
       L"In", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
    st.AssertSucceeded();
 
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
    st = nodeDef.AddOutputPort(kOutVDBGrid, customTypes,
       siICENodeStructureSingle, siICENodeContextSingleton,
       L"Out", L"outVDBGrid");
@@ -157,9 +160,33 @@ SICALLBACK VDB_Node_Noise_BeginEvaluate(ICENodeContext& ctxt)
    return CStatus::OK;
 }
 
-SICALLBACK VDB_Node_Noise_Evaluate(ICENodeContext& ctxt)
+SICALLBACK VDB_Node_Noise_Init(CRef& in_ctxt)
 {
+   Context ctxt(in_ctxt);
    VDB_Node_Noise* vdbNode = new VDB_Node_Noise();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Noise_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Noise* vdbNode;
+   vdbNode = (VDB_Node_Noise*)(CValue::siPtrType)userData;
    vdbNode->Evaluate(ctxt);
    return CStatus::OK;
 }
+
+SICALLBACK VDB_Node_Noise_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_Noise* vdbNode;
+      vdbNode = (VDB_Node_Noise*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
@@ -12,6 +12,8 @@
 
 #include <openvdb/openvdb.h>
 
+#include "VDB_GridRegistry.h"
+
 class VDB_Node_Noise
 {
 public:
@@ -21,6 +23,9 @@ public:
    XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
    
    static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   VDB_OutputHandles m_outHandles;
 };
 
 #endif
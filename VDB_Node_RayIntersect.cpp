@@ -0,0 +1,283 @@
+// OpenVDB_Softimage
+// VDB_Node_RayIntersect.cpp
+// ICE node that intersects per point rays with a level set
+// Returns hit, position, normal and distance of the first crossing
+
+#include <limits>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+#include <xsi_vector3f.h>
+
+#include "VDB_Node_RayIntersect.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kInVDBGrid = 200;
+static const ULONG kGridName = 201;
+static const ULONG kOrigin = 202;
+static const ULONG kDirection = 203;
+static const ULONG kMaxDistance = 204;
+static const ULONG kOutHit = 300;
+static const ULONG kOutPosition = 301;
+static const ULONG kOutNormal = 302;
+static const ULONG kOutDistance = 303;
+
+using namespace XSI;
+
+namespace
+{
+   // first crossing along the ray, a miss returns the origin, a zero
+   // normal and a zero distance
+   bool Trace(const VDB_Node_RayIntersect::IntersectorT* intersector,
+      const MATH::CVector3f& o, MATH::CVector3f d, double tMax,
+      openvdb::Vec3d& position, openvdb::Vec3d& normal, double& distance)
+   {
+      position = openvdb::Vec3d(o.GetX(), o.GetY(), o.GetZ());
+      normal = openvdb::Vec3d(0.0);
+      distance = 0.0;
+      if (!intersector || d.GetLengthSquared() <= 0.0f) return false;
+
+      d.NormalizeInPlace();
+      // hierarchical DDA skips empty tiles and internal nodes before
+      // stepping through the leaves along the ray
+      const VDB_Node_RayIntersect::IntersectorT::RayType ray(position,
+         openvdb::Vec3d(d.GetX(), d.GetY(), d.GetZ()), 0.0, tMax);
+      openvdb::Vec3d world;
+      if (!intersector->intersectsWS(ray, world, normal)) return false;
+
+      distance = (world - position).length();
+      position = world;
+      normal.normalize();
+      return true;
+   }
+}
+
+VDB_Node_RayIntersect::VDB_Node_RayIntersect()
+{
+}
+
+VDB_Node_RayIntersect::~VDB_Node_RayIntersect()
+{
+}
+
+CStatus VDB_Node_RayIntersect::BeginEvaluate(ICENodeContext& ctxt)
+{
+   CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid);
+   CDataArrayString gridName(ctxt, kGridName);
+
+   // the grid ports are singletons
+   openvdb::FloatGrid::ConstPtr grid;
+   VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, 0);
+   int gridIndex = inVDBPrim ? inVDBPrim->FindGridIndex(gridName[0].GetAsciiString()) : -1;
+   if (gridIndex >= 0)
+   {
+      grid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(inVDBPrim->GetConstGridPtr(gridIndex));
+   }
+
+   if (!grid)
+   {
+      m_intersector.reset();
+      m_grid.reset();
+   }
+   else if (grid != m_grid)
+   {
+      // holding the grid keeps the cached intersector valid
+      m_intersector.reset();
+      m_grid = grid;
+      try
+      {
+         m_intersector.reset(new IntersectorT(*grid));
+      }
+      catch (openvdb::Exception& e)
+      {
+         Application().LogMessage(L"[VDB_Node_RayIntersect] " + CString(e.what()), siErrorMsg);
+      }
+   }
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_RayIntersect::Evaluate(ICENodeContext& ctxt)
+{
+   CDataArrayVector3f origin(ctxt, kOrigin);
+   CDataArrayVector3f direction(ctxt, kDirection);
+   CDataArrayFloat maxDistance(ctxt, kMaxDistance);
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+   CIndexSet indexSet(ctxt);
+
+   // the intersector caches the last leaf it visited, so each slice
+   // marches its rays with a private copy
+   boost::shared_ptr<IntersectorT> intersector;
+   if (m_intersector) intersector.reset(new IntersectorT(*m_intersector));
+
+   const double tMax = maxDistance[0] > 0.0f ? double(maxDistance[0]) : std::numeric_limits<double>::max();
+
+   openvdb::Vec3d position, normal;
+   double distance;
+
+   switch (evaluatedPort)
+   {
+      case kOutHit:
+      {
+         CDataArrayBool output(ctxt);
+         for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+         {
+            output.Set(it, Trace(intersector.get(), origin[it], direction[it], tMax, position, normal, distance));
+         }
+         break;
+      }
+      case kOutPosition:
+      case kOutNormal:
+      {
+         CDataArrayVector3f output(ctxt);
+         for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+         {
+            Trace(intersector.get(), origin[it], direction[it], tMax, position, normal, distance);
+            const openvdb::Vec3d& result = evaluatedPort == kOutPosition ? position : normal;
+            output[it].Set(float(result[0]), float(result[1]), float(result[2]));
+         }
+         break;
+      }
+      case kOutDistance:
+      {
+         CDataArrayFloat output(ctxt);
+         for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+         {
+            Trace(intersector.get(), origin[it], direction[it], tMax, position, normal, distance);
+            output[it] = float(distance);
+         }
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_RayIntersect::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_RayIntersect", L"VDB Ray Intersect");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   // the rays are split in slices evaluated on all cores
+   st = nodeDef.PutThreadingModel(siICENodeMultiThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"In", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kOrigin, kGroup1, siICENodeDataVector3,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Origin", L"origin");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kDirection, kGroup1, siICENodeDataVector3,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Direction", L"direction");
+   st.AssertSucceeded();
+
+   // world units, zero means unlimited
+   st = nodeDef.AddInputPort(kMaxDistance, kGroup1, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Max Distance", L"maxDistance", 0.0f);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutHit, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Hit", L"hit");
+   st.AssertSucceeded();
+
+   // the origin when the ray misses
+   st = nodeDef.AddOutputPort(kOutPosition, siICENodeDataVector3,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Position", L"position");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutNormal, siICENodeDataVector3,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Normal", L"normal");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutDistance, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Distance", L"distance");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_RayIntersect_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_RayIntersect* vdbNode = new VDB_Node_RayIntersect();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_RayIntersect_BeginEvaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_RayIntersect* vdbNode;
+   vdbNode = (VDB_Node_RayIntersect*)(CValue::siPtrType)userData;
+   vdbNode->BeginEvaluate(ctxt);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_RayIntersect_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_RayIntersect* vdbNode;
+   vdbNode = (VDB_Node_RayIntersect*)(CValue::siPtrType)userData;
+   vdbNode->Evaluate(ctxt);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_RayIntersect_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_RayIntersect* vdbNode;
+      vdbNode = (VDB_Node_RayIntersect*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
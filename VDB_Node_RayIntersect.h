@@ -0,0 +1,41 @@
+// OpenVDB_Softimage
+// VDB_Node_RayIntersect.h
+// ICE node that intersects per point rays with a level set
+// Returns hit, position, normal and distance of the first crossing
+
+#ifndef VDB_NODE_RAYINTERSECT_H
+#define VDB_NODE_RAYINTERSECT_H
+
+#include <boost/shared_ptr.hpp>
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+#include <openvdb/tools/RayIntersector.h>
+
+class VDB_Node_RayIntersect
+{
+public:
+   typedef openvdb::tools::LevelSetRayIntersector<openvdb::FloatGrid> IntersectorT;
+
+   VDB_Node_RayIntersect();
+   ~VDB_Node_RayIntersect();
+
+   // runs on a single thread before the slices, resolves the pending
+   // operations of the grid once and builds the intersector
+   XSI::CStatus BeginEvaluate(XSI::ICENodeContext& ctxt);
+   // called by several ICE threads at once, each one with its own slice of rays
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   // building an intersector measures the bounds of the grid, it is done
+   // once per grid and every slice gets a cheap copy of it
+   openvdb::FloatGrid::ConstPtr m_grid;
+   boost::shared_ptr<IntersectorT> m_intersector;
+};
+
+#endif
@@ -0,0 +1,358 @@
+// OpenVDB_Softimage
+// VDB_Node_Read.cpp
+// ICE node to read grids from disk
+
+#include <cmath>
+#include <sstream>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+#include <xsi_vector3f.h>
+#include <xsi_time.h>
+
+#include "VDB_Node_Read.h"
+#include "VDB_DeltaSequence.h"
+#include "VDB_ReadCache.h"
+#include "VDB_Prefetcher.h"
+#include "VDB_Utils.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kFilepath = 200;
+static const ULONG kGridNames = 201;
+static const ULONG kDelayLoad = 202;
+static const ULONG kClip = 203;
+static const ULONG kClipMin = 204;
+static const ULONG kClipMax = 205;
+static const ULONG kPrefetch = 206;
+static const ULONG kOutVDBGrid = 300;
+
+using namespace XSI;
+using namespace XSI::MATH;
+
+VDB_Node_Read::VDB_Node_Read()
+   : m_cacheModTime(0)
+   , m_cacheHandle(0)
+{
+}
+
+VDB_Node_Read::~VDB_Node_Read()
+{
+}
+
+VDB_Primitive::Ptr VDB_Node_Read::Load(const std::string& path, const std::string& names,
+   bool delayLoad, const openvdb::BBoxd* clipBBox)
+{
+   openvdb::initialize();
+
+   // a partial read is specific to this node, anything else is shared
+   if (!clipBBox) return LoadCached(path, names, delayLoad);
+
+   VDB_Primitive::Ptr vdbPrim(new VDB_Primitive());
+   try
+   {
+      openvdb::io::File file(path);
+      // with delayed loading only the grid descriptors are read here
+      file.open(delayLoad);
+
+      // a frame of a delta sequence is rebuilt from its base frames in full
+      openvdb::MetaMap::Ptr fileMeta = file.getMetadata();
+      if (fileMeta && VDB_DeltaReader::IsDelta(*fileMeta))
+      {
+         file.close();
+         return LoadDelta(path, names, clipBBox);
+      }
+
+      std::vector<std::string> gridNames = splitGridNames(names);
+      if (gridNames.empty())
+      {
+         for (openvdb::io::File::NameIterator nameIt = file.beginName(); nameIt != file.endName(); ++nameIt)
+         {
+            gridNames.push_back(nameIt.gridName());
+         }
+      }
+
+      for (size_t i=0; i<gridNames.size(); ++i)
+      {
+         if (!file.hasGrid(gridNames[i]))
+         {
+            Application().LogMessage(L"[VDB_Node_Read] no grid named " + CString(gridNames[i].c_str()) + L" in " + CString(path.c_str()), siWarningMsg);
+            continue;
+         }
+         // seeks straight to the grid, the other grids of the file are never read
+         openvdb::GridBase::Ptr grid = file.readGrid(gridNames[i], *clipBBox);
+         if (grid) vdbPrim->AddGrid(*grid);
+      }
+
+      openvdb::MetaMap::Ptr meta = file.getMetadata();
+      if (meta) vdbPrim->GetMetadata() = *meta;
+      file.close();
+   }
+   catch (openvdb::Exception& e)
+   {
+      Application().LogMessage(L"[VDB_Node_Read] " + CString(e.what()) + L" : " + CString(path.c_str()), siErrorMsg);
+      return VDB_Primitive::Ptr();
+   }
+
+   if (vdbPrim->GetGridCount() == 0) return VDB_Primitive::Ptr();
+   return vdbPrim;
+}
+
+VDB_Primitive::Ptr VDB_Node_Read::LoadCached(const std::string& path, const std::string& names, bool delayLoad)
+{
+   VDB_ReadCache& cache = VDB_ReadCache::Get();
+
+   std::vector<std::string> fileGridNames;
+   openvdb::MetaMap::ConstPtr meta;
+   if (!cache.GetFileInfo(path, fileGridNames, meta)) return VDB_Primitive::Ptr();
+   if (VDB_DeltaReader::IsDelta(*meta)) return LoadDelta(path, names);
+
+   std::vector<std::string> gridNames = splitGridNames(names);
+   if (gridNames.empty()) gridNames = fileGridNames;
+
+   VDB_Primitive::Ptr vdbPrim(new VDB_Primitive());
+   for (size_t i=0; i<gridNames.size(); ++i)
+   {
+      openvdb::GridBase::ConstPtr grid = cache.GetGrid(path, gridNames[i], delayLoad);
+      if (!grid)
+      {
+         Application().LogMessage(L"[VDB_Node_Read] no grid named " + CString(gridNames[i].c_str()) + L" in " + CString(path.c_str()), siWarningMsg);
+         continue;
+      }
+      vdbPrim->AddGrid(*grid);
+   }
+   vdbPrim->GetMetadata() = *meta;
+
+   if (vdbPrim->GetGridCount() == 0) return VDB_Primitive::Ptr();
+   return vdbPrim;
+}
+
+VDB_Primitive::Ptr VDB_Node_Read::LoadDelta(const std::string& path, const std::string& names,
+   const openvdb::BBoxd* clipBBox)
+{
+   VDB_Primitive::Ptr frame = VDB_DeltaReader::Get().Read(path);
+   if (!frame) return frame;
+
+   // the rebuilt frame is shared with the reader, select from a new primitive
+   std::vector<std::string> gridNames = splitGridNames(names);
+   if (gridNames.empty() && !clipBBox) return frame->ShallowCopy();
+   if (gridNames.empty()) gridNames = frame->GetGridNames();
+
+   VDB_Primitive::Ptr vdbPrim(new VDB_Primitive());
+   for (size_t i=0; i<gridNames.size(); ++i)
+   {
+      int index = frame->FindGridIndex(gridNames[i]);
+      if (index < 0)
+      {
+         Application().LogMessage(L"[VDB_Node_Read] no grid named " + CString(gridNames[i].c_str()) + L" in " + CString(path.c_str()), siWarningMsg);
+         continue;
+      }
+      openvdb::GridBase::ConstPtr grid = frame->GetConstGridPtr(index);
+      if (clipBBox)
+      {
+         // clipping works in place, the trees of the frame stay untouched
+         openvdb::GridBase::Ptr clipped = grid->deepCopyGrid();
+         clipped->clipGrid(*clipBBox);
+         vdbPrim->AddGrid(*clipped);
+      }
+      else
+      {
+         vdbPrim->AddGrid(*grid);
+      }
+   }
+   vdbPrim->GetMetadata() = frame->GetMetadata();
+   vdbPrim->SetSourceTime(frame->GetSourceTime());
+
+   if (vdbPrim->GetGridCount() == 0) return VDB_Primitive::Ptr();
+   return vdbPrim;
+}
+
+CStatus VDB_Node_Read::Evaluate(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_Read] Evaluate");
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+
+   switch (evaluatedPort)
+   {
+      case kOutVDBGrid:
+      {
+         CDataArrayCustomType output(ctxt);
+         CIndexSet indexSet(ctxt);
+
+         CDataArrayString filePath(ctxt, kFilepath);
+         CDataArrayString gridNames(ctxt, kGridNames);
+         CDataArrayBool delayLoad(ctxt, kDelayLoad);
+         CDataArrayBool clip(ctxt, kClip);
+         CDataArrayVector3f clipMin(ctxt, kClipMin);
+         CDataArrayVector3f clipMax(ctxt, kClipMax);
+         CDataArrayLong prefetch(ctxt, kPrefetch);
+
+         // $F tokens pick the file of the current frame in a sequence
+         const int frame = int(floor(ctxt.GetTime().GetTime() + 0.5));
+         const std::string path = expandFrameTokens(filePath[0].GetAsciiString(), frame);
+         const std::string names(gridNames[0].GetAsciiString());
+
+         std::ostringstream key;
+         key << path << '|' << names << '|' << delayLoad[0];
+         openvdb::BBoxd clipBBox;
+         if (clip[0])
+         {
+            clipBBox = openvdb::BBoxd(
+               openvdb::Vec3d(clipMin[0].GetX(), clipMin[0].GetY(), clipMin[0].GetZ()),
+               openvdb::Vec3d(clipMax[0].GetX(), clipMax[0].GetY(), clipMax[0].GetZ()));
+            key << '|' << clipBBox;
+         }
+
+         // the next frames load in the background while this one is read,
+         // clipped reads bypass the read cache so there is nothing to prefetch into
+         if (!clip[0])
+         {
+            VDB_Prefetcher::Get().Update(filePath[0].GetAsciiString(), names, delayLoad[0], frame, prefetch[0]);
+         }
+
+         std::time_t modTime = 0;
+         if (!fileModTime(path, modTime))
+         {
+            Application().LogMessage(L"[VDB_Node_Read] file not found " + CString(path.c_str()), siErrorMsg);
+            return CStatus::OK;
+         }
+
+         bool reload = key.str() != m_cacheKey || modTime != m_cacheModTime
+            || !VDB_GridRegistry::Get().GetRefCount(m_cacheHandle);
+         if (reload)
+         {
+            m_outHandles.ReleaseAll();
+            m_cacheHandle = 0;
+            m_cacheKey.clear();
+
+            VDB_Primitive::Ptr vdbPrim = Load(path, names, delayLoad[0], clip[0] ? &clipBBox : NULL);
+            if (!vdbPrim) return CStatus::OK;
+            if (modTime > vdbPrim->GetSourceTime()) vdbPrim->SetSourceTime(modTime);
+
+            m_cacheHandle = m_outHandles.Add(vdbPrim);
+            m_cacheKey = key.str();
+            m_cacheModTime = modTime;
+            Application().LogMessage(L"[VDB_Node_Read] read " + CValue((ULONG)vdbPrim->GetGridCount()).GetAsText() + L" grids from " + CString(path.c_str()));
+         }
+
+         for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+         {
+            SetHandleId(output, it, m_cacheHandle);
+         }
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_Read::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_Read", L"VDB Read");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   st = nodeDef.PutThreadingModel(siICENodeSingleThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kFilepath, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"File Path", L"filePath", L"");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridNames, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Names", L"gridNames", L"");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kDelayLoad, kGroup1, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Delay Load", L"delayLoad", true);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kClip, kGroup1, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Clip", L"clip", false);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kClipMin, kGroup1, siICENodeDataVector3,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Clip Min", L"clipMin", CValue(CVector3f(-1.0f, -1.0f, -1.0f)));
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kClipMax, kGroup1, siICENodeDataVector3,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Clip Max", L"clipMax", CValue(CVector3f(1.0f, 1.0f, 1.0f)));
+   st.AssertSucceeded();
+
+   // number of frames read ahead of the playback, zero disables it
+   st = nodeDef.AddInputPort(kPrefetch, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Prefetch Frames", L"prefetchFrames", CValue(0));
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddOutputPort(kOutVDBGrid, customTypes,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"VDB Grid", L"outVDBGrid");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Read_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_Read* vdbNode = new VDB_Node_Read();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Read_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Read* vdbNode;
+   vdbNode = (VDB_Node_Read*)(CValue::siPtrType)userData;
+   vdbNode->Evaluate(ctxt);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Read_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_Read* vdbNode;
+      vdbNode = (VDB_Node_Read*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
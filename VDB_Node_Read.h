@@ -0,0 +1,49 @@
+// OpenVDB_Softimage
+// VDB_Node_Read.h
+// ICE node to read grids from disk
+
+#ifndef VDB_NODE_READ_H
+#define VDB_NODE_READ_H
+
+#include <string>
+#include <ctime>
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+class VDB_Node_Read
+{
+public:
+   VDB_Node_Read();
+   ~VDB_Node_Read();
+
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+   // reads only the named grids (all grids when names is empty), with delayed
+   // loading the voxel data of a grid is read the first time it is accessed
+   static VDB_Primitive::Ptr Load(const std::string& path, const std::string& names,
+      bool delayLoad, const openvdb::BBoxd* clipBBox);
+   // grids are served from the process wide read cache
+   static VDB_Primitive::Ptr LoadCached(const std::string& path, const std::string& names, bool delayLoad);
+   // frames of a delta sequence are always rebuilt whole, a clipped read
+   // clips copies of the rebuilt grids
+   static VDB_Primitive::Ptr LoadDelta(const std::string& path, const std::string& names,
+      const openvdb::BBoxd* clipBBox = NULL);
+
+private:
+   // the file is read again only when a port or the file itself changed
+   std::string m_cacheKey;
+   std::time_t m_cacheModTime;
+   ULONG m_cacheHandle;
+   VDB_OutputHandles m_outHandles;
+};
+
+#endif
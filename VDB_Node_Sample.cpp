@@ -0,0 +1,347 @@
+// OpenVDB_Softimage
+// VDB_Node_Sample.cpp
+// ICE node that samples a grid at per point positions
+// Returns the interpolated value, gradient and closest surface point
+
+#include <vector>
+#include <algorithm>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+#include <xsi_vector3f.h>
+
+#include <openvdb/tools/Interpolation.h>
+
+#include "VDB_Node_Sample.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kInVDBGrid = 200;
+static const ULONG kGridName = 201;
+static const ULONG kPosition = 202;
+static const ULONG kInterpolation = 203;
+static const ULONG kOutValue = 300;
+static const ULONG kOutGradient = 301;
+static const ULONG kOutClosestPoint = 302;
+static const ULONG kOutVector = 303;
+
+// projection steps towards the zero crossing, the gradient of a level set
+// is only unit length inside the narrow band so one step is not exact
+static const int kClosestPointSteps = 3;
+
+using namespace XSI;
+
+namespace
+{
+   struct PointRef
+   {
+      openvdb::Coord leaf;
+      ULONG index;
+
+      bool operator<(const PointRef& other) const { return leaf < other.leaf; }
+   };
+
+   // the points of the slice in leaf order, so consecutive lookups hit the
+   // leaf cached by the accessor instead of walking down the tree again
+   void SortByLeaf(CDataArrayVector3f& position, CIndexSet& indexSet,
+      const openvdb::math::Transform& xform, std::vector<PointRef>& points,
+      std::vector<openvdb::Vec3d>& worldPos)
+   {
+      const ULONG count = position.GetCount();
+      points.clear();
+      points.reserve(count);
+      worldPos.resize(count);
+      for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+      {
+         const MATH::CVector3f& p = position[it];
+         const openvdb::Vec3d wpos(p.GetX(), p.GetY(), p.GetZ());
+         worldPos[it] = wpos;
+
+         PointRef ref;
+         ref.leaf = openvdb::Coord::floor(xform.worldToIndex(wpos)) & ~openvdb::Int32(openvdb::FloatTree::LeafNodeType::DIM - 1);
+         ref.index = it;
+         points.push_back(ref);
+      }
+      std::sort(points.begin(), points.end());
+   }
+
+   template<typename SamplerT>
+   void SampleScalar(const openvdb::FloatGrid& grid, ULONG evaluatedPort,
+      const std::vector<PointRef>& points, const std::vector<openvdb::Vec3d>& worldPos,
+      ICENodeContext& ctxt)
+   {
+      // one accessor per slice, each ICE thread works on its own slice
+      openvdb::FloatGrid::ConstAccessor acc = grid.getConstAccessor();
+      openvdb::tools::GridSampler<openvdb::FloatGrid::ConstAccessor, SamplerT> sampler(acc, grid.transform());
+
+      const double h = grid.transform().voxelSize()[0];
+      const bool isLevelSet = grid.getGridClass() == openvdb::GRID_LEVEL_SET;
+
+      switch (evaluatedPort)
+      {
+         case kOutValue:
+         {
+            CDataArrayFloat output(ctxt);
+            for (size_t i=0; i<points.size(); ++i)
+            {
+               output[points[i].index] = sampler.wsSample(worldPos[points[i].index]);
+            }
+            break;
+         }
+         case kOutGradient:
+         case kOutClosestPoint:
+         {
+            CDataArrayVector3f output(ctxt);
+            for (size_t i=0; i<points.size(); ++i)
+            {
+               openvdb::Vec3d pos = worldPos[points[i].index];
+               const int steps = (evaluatedPort == kOutGradient || !isLevelSet) ? 1 : kClosestPointSteps;
+               openvdb::Vec3d grad(0.0);
+               for (int step=0; step<steps; ++step)
+               {
+                  // central differences of the interpolated field, so the
+                  // gradient matches the selected interpolation
+                  grad[0] = sampler.wsSample(pos + openvdb::Vec3d(h, 0, 0)) - sampler.wsSample(pos - openvdb::Vec3d(h, 0, 0));
+                  grad[1] = sampler.wsSample(pos + openvdb::Vec3d(0, h, 0)) - sampler.wsSample(pos - openvdb::Vec3d(0, h, 0));
+                  grad[2] = sampler.wsSample(pos + openvdb::Vec3d(0, 0, h)) - sampler.wsSample(pos - openvdb::Vec3d(0, 0, h));
+                  grad *= 0.5 / h;
+                  if (evaluatedPort == kOutGradient || !isLevelSet) break;
+
+                  const double length = grad.length();
+                  if (length < 1.0e-6) break;
+                  pos -= grad * (sampler.wsSample(pos) / (length * length));
+               }
+               const openvdb::Vec3d& result = evaluatedPort == kOutGradient ? grad : pos;
+               output[points[i].index].Set(float(result[0]), float(result[1]), float(result[2]));
+            }
+            break;
+         }
+         default:
+            break;
+      }
+   }
+
+   template<typename SamplerT>
+   void SampleVector(const openvdb::Vec3SGrid& grid,
+      const std::vector<PointRef>& points, const std::vector<openvdb::Vec3d>& worldPos,
+      ICENodeContext& ctxt)
+   {
+      openvdb::Vec3SGrid::ConstAccessor acc = grid.getConstAccessor();
+      openvdb::tools::GridSampler<openvdb::Vec3SGrid::ConstAccessor, SamplerT> sampler(acc, grid.transform());
+
+      CDataArrayVector3f output(ctxt);
+      for (size_t i=0; i<points.size(); ++i)
+      {
+         const openvdb::Vec3s value = sampler.wsSample(worldPos[points[i].index]);
+         output[points[i].index].Set(value[0], value[1], value[2]);
+      }
+   }
+
+   // fills the output with zeros when the grid type does not match the port
+   void ClearOutput(ULONG evaluatedPort, CIndexSet& indexSet, ICENodeContext& ctxt)
+   {
+      if (evaluatedPort == kOutValue)
+      {
+         CDataArrayFloat output(ctxt);
+         for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next()) output[it] = 0.0f;
+      }
+      else
+      {
+         CDataArrayVector3f output(ctxt);
+         for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next()) output[it].SetNull();
+      }
+   }
+}
+
+VDB_Node_Sample::VDB_Node_Sample()
+{
+}
+
+VDB_Node_Sample::~VDB_Node_Sample()
+{
+}
+
+CStatus VDB_Node_Sample::BeginEvaluate(ICENodeContext& ctxt)
+{
+   CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid);
+   CDataArrayString gridName(ctxt, kGridName);
+
+   // the grid ports are singletons
+   m_grid.reset();
+   VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, 0);
+   int gridIndex = inVDBPrim ? inVDBPrim->FindGridIndex(gridName[0].GetAsciiString()) : -1;
+   if (gridIndex >= 0) m_grid = inVDBPrim->GetConstGridPtr(gridIndex);
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_Sample::Evaluate(ICENodeContext& ctxt)
+{
+   CDataArrayVector3f position(ctxt, kPosition);
+   CDataArrayLong interpolation(ctxt, kInterpolation);
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+   CIndexSet indexSet(ctxt);
+
+   if (!m_grid)
+   {
+      ClearOutput(evaluatedPort, indexSet, ctxt);
+      return CStatus::OK;
+   }
+
+   const openvdb::GridBase::ConstPtr grid = m_grid;
+   openvdb::FloatGrid::ConstPtr floatGrid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(grid);
+   openvdb::Vec3SGrid::ConstPtr vectorGrid = openvdb::gridConstPtrCast<openvdb::Vec3SGrid>(grid);
+
+   // scalar outputs need a float grid and the vector output a vec3s grid
+   const bool scalarPort = evaluatedPort != kOutVector;
+   if ((scalarPort && !floatGrid) || (!scalarPort && !vectorGrid))
+   {
+      ClearOutput(evaluatedPort, indexSet, ctxt);
+      return CStatus::OK;
+   }
+
+   std::vector<PointRef> points;
+   std::vector<openvdb::Vec3d> worldPos;
+   SortByLeaf(position, indexSet, grid->transform(), points, worldPos);
+
+   // 0 closest voxel, 1 trilinear, 2 triquadratic
+   switch (interpolation[0])
+   {
+      case 0:
+         if (scalarPort) SampleScalar<openvdb::tools::PointSampler>(*floatGrid, evaluatedPort, points, worldPos, ctxt);
+         else SampleVector<openvdb::tools::PointSampler>(*vectorGrid, points, worldPos, ctxt);
+         break;
+      case 2:
+         if (scalarPort) SampleScalar<openvdb::tools::QuadraticSampler>(*floatGrid, evaluatedPort, points, worldPos, ctxt);
+         else SampleVector<openvdb::tools::QuadraticSampler>(*vectorGrid, points, worldPos, ctxt);
+         break;
+      default:
+         if (scalarPort) SampleScalar<openvdb::tools::BoxSampler>(*floatGrid, evaluatedPort, points, worldPos, ctxt);
+         else SampleVector<openvdb::tools::BoxSampler>(*vectorGrid, points, worldPos, ctxt);
+         break;
+   }
+
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_Sample::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_Sample", L"VDB Sample");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   // the points are split in slices evaluated on all cores
+   st = nodeDef.PutThreadingModel(siICENodeMultiThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"In", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kPosition, kGroup1, siICENodeDataVector3,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Position", L"position");
+   st.AssertSucceeded();
+
+   // 0 closest voxel, 1 trilinear, 2 triquadratic
+   st = nodeDef.AddInputPort(kInterpolation, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Interpolation", L"interpolation", CValue(1));
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutValue, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Value", L"value");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutGradient, siICENodeDataVector3,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Gradient", L"gradient");
+   st.AssertSucceeded();
+
+   // level sets only, other grids return the position
+   st = nodeDef.AddOutputPort(kOutClosestPoint, siICENodeDataVector3,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Closest Point", L"closestPoint");
+   st.AssertSucceeded();
+
+   // vec3s grids only
+   st = nodeDef.AddOutputPort(kOutVector, siICENodeDataVector3,
+      siICENodeStructureSingle, siICENodeContextComponent0D,
+      L"Vector", L"vector");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Sample_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_Sample* vdbNode = new VDB_Node_Sample();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Sample_BeginEvaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Sample* vdbNode;
+   vdbNode = (VDB_Node_Sample*)(CValue::siPtrType)userData;
+   vdbNode->BeginEvaluate(ctxt);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Sample_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Sample* vdbNode;
+   vdbNode = (VDB_Node_Sample*)(CValue::siPtrType)userData;
+   vdbNode->Evaluate(ctxt);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Sample_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_Sample* vdbNode;
+      vdbNode = (VDB_Node_Sample*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
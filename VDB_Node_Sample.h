@@ -0,0 +1,34 @@
+// OpenVDB_Softimage
+// VDB_Node_Sample.h
+// ICE node that samples a grid at per point positions
+// Returns the interpolated value, gradient and closest surface point
+
+#ifndef VDB_NODE_SAMPLE_H
+#define VDB_NODE_SAMPLE_H
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+class VDB_Node_Sample
+{
+public:
+   VDB_Node_Sample();
+   ~VDB_Node_Sample();
+
+   // runs on a single thread before the slices, resolves the pending
+   // operations of the grid once for all of them
+   XSI::CStatus BeginEvaluate(XSI::ICENodeContext& ctxt);
+   // called by several ICE threads at once, each one with its own slice of
+   // the points, the grid is only read
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   openvdb::GridBase::ConstPtr m_grid;
+};
+
+#endif
@@ -0,0 +1,673 @@
+// OpenVDB_Softimage
+// VDB_Node_Segment.cpp
+// ICE node that splits a grid into its connected components
+// Each piece becomes a grid of the output, with its voxel count and bounds
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+#include <xsi_dataarray2D.h>
+#include <xsi_iceportstate.h>
+#include <xsi_vector3f.h>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+
+#include <openvdb/tree/LeafManager.h>
+
+#include "VDB_Node_Segment.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kInVDBGrid = 200;
+static const ULONG kGridName = 201;
+static const ULONG kMinVoxels = 202;
+static const ULONG kOutVDBGrid = 300;
+static const ULONG kOutVoxelCounts = 301;
+static const ULONG kOutBoundsMin = 302;
+static const ULONG kOutBoundsMax = 303;
+
+using namespace XSI;
+
+namespace
+{
+   typedef openvdb::BoolTree MaskTreeT;
+   typedef MaskTreeT::LeafNodeType MaskLeafT;
+   typedef openvdb::tree::LeafManager<const MaskTreeT> MaskLeafManagerT;
+   typedef openvdb::FloatTree::LeafNodeType FloatLeafT;
+
+   // a leaf holds at most 256 disconnected components, 16 bits are plenty
+   typedef unsigned short LocalLabel;
+   static const LocalLabel kNoLabel = 0xFFFF;
+
+   typedef std::pair<openvdb::Index32, openvdb::Index32> Edge;
+   typedef std::vector<std::pair<const MaskLeafT*, size_t> > LeafIndex;
+
+   size_t findLeaf(const LeafIndex& index, const MaskLeafT* leaf)
+   {
+      LeafIndex::const_iterator it = std::lower_bound(index.begin(), index.end(),
+         std::make_pair(leaf, size_t(0)));
+      return it->second;
+   }
+
+   // flood fills the active voxels of each leaf on its own, the components
+   // of a leaf are numbered from zero
+   struct LocalLabelOp
+   {
+      const MaskLeafManagerT* leafs;
+      std::vector<LocalLabel>* labels;
+      std::vector<openvdb::Index32>* counts;
+
+      void operator()(const tbb::blocked_range<size_t>& range) const
+      {
+         std::vector<openvdb::Index> stack;
+         stack.reserve(MaskLeafT::SIZE);
+         for (size_t n = range.begin(); n != range.end(); ++n)
+         {
+            const MaskLeafT& leaf = leafs->leaf(n);
+            LocalLabel* label = &(*labels)[n * MaskLeafT::SIZE];
+            LocalLabel next = 0;
+            for (openvdb::Index seed = 0; seed < MaskLeafT::SIZE; ++seed)
+            {
+               if (label[seed] != kNoLabel || !leaf.isValueOn(seed)) continue;
+               label[seed] = next;
+               stack.push_back(seed);
+               while (!stack.empty())
+               {
+                  const openvdb::Coord xyz = MaskLeafT::offsetToLocalCoord(stack.back());
+                  stack.pop_back();
+                  for (int axis = 0; axis < 3; ++axis)
+                  {
+                     for (int dir = -1; dir <= 1; dir += 2)
+                     {
+                        openvdb::Coord ijk = xyz;
+                        ijk[axis] += dir;
+                        if (ijk[axis] < 0 || ijk[axis] >= int(MaskLeafT::DIM)) continue;
+                        const openvdb::Index neighbor = MaskLeafT::coordToOffset(ijk);
+                        if (label[neighbor] != kNoLabel || !leaf.isValueOn(neighbor)) continue;
+                        label[neighbor] = next;
+                        stack.push_back(neighbor);
+                     }
+                  }
+               }
+               ++next;
+            }
+            (*counts)[n] = next;
+         }
+      }
+   };
+
+   // pairs of global labels touching across the +x, +y and +z faces of each leaf
+   struct EdgeOp
+   {
+      const MaskTreeT* mask;
+      const MaskLeafManagerT* leafs;
+      const LeafIndex* index;
+      const std::vector<LocalLabel>* labels;
+      const std::vector<openvdb::Index32>* offsets;
+      std::vector<Edge> edges;
+
+      EdgeOp() {}
+
+      EdgeOp(EdgeOp& other, tbb::split)
+         : mask(other.mask)
+         , leafs(other.leafs)
+         , index(other.index)
+         , labels(other.labels)
+         , offsets(other.offsets)
+      {
+      }
+
+      void operator()(const tbb::blocked_range<size_t>& range)
+      {
+         openvdb::tree::ValueAccessor<const MaskTreeT> acc(*mask);
+         std::vector<Edge> faceEdges;
+         for (size_t n = range.begin(); n != range.end(); ++n)
+         {
+            const MaskLeafT& leaf = leafs->leaf(n);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+               openvdb::Coord origin = leaf.origin();
+               origin[axis] += MaskLeafT::DIM;
+               const MaskLeafT* other = acc.probeConstLeaf(origin);
+               if (!other) continue;
+               const size_t m = findLeaf(*index, other);
+
+               faceEdges.clear();
+               openvdb::Coord ijk, nijk;
+               ijk[axis] = MaskLeafT::DIM - 1;
+               nijk[axis] = 0;
+               for (int a = 0; a < int(MaskLeafT::DIM); ++a)
+               {
+                  ijk[(axis + 1) % 3] = nijk[(axis + 1) % 3] = a;
+                  for (int b = 0; b < int(MaskLeafT::DIM); ++b)
+                  {
+                     ijk[(axis + 2) % 3] = nijk[(axis + 2) % 3] = b;
+                     const openvdb::Index offset = MaskLeafT::coordToOffset(ijk);
+                     const openvdb::Index nOffset = MaskLeafT::coordToOffset(nijk);
+                     if (!leaf.isValueOn(offset) || !other->isValueOn(nOffset)) continue;
+                     faceEdges.push_back(Edge(
+                        (*offsets)[n] + (*labels)[n * MaskLeafT::SIZE + offset],
+                        (*offsets)[m] + (*labels)[m * MaskLeafT::SIZE + nOffset]));
+                  }
+               }
+               // a face usually repeats the same few pairs
+               std::sort(faceEdges.begin(), faceEdges.end());
+               faceEdges.erase(std::unique(faceEdges.begin(), faceEdges.end()), faceEdges.end());
+               edges.insert(edges.end(), faceEdges.begin(), faceEdges.end());
+            }
+         }
+      }
+
+      void join(EdgeOp& other)
+      {
+         edges.insert(edges.end(), other.edges.begin(), other.edges.end());
+      }
+   };
+
+   openvdb::Index32 findRoot(std::vector<openvdb::Index32>& parent, openvdb::Index32 i)
+   {
+      while (parent[i] != i)
+      {
+         parent[i] = parent[parent[i]];
+         i = parent[i];
+      }
+      return i;
+   }
+
+   struct PieceInLeaf
+   {
+      openvdb::Index32 piece;
+      openvdb::Index64 voxelCount;
+      openvdb::CoordBBox bbox;
+   };
+
+   // voxel count and bounds of every piece present in each leaf
+   struct PieceStatsOp
+   {
+      const MaskLeafManagerT* leafs;
+      const std::vector<LocalLabel>* labels;
+      const std::vector<openvdb::Index32>* offsets;
+      const std::vector<openvdb::Index32>* pieceOf;
+      std::vector<std::vector<PieceInLeaf> >* leafPieces;
+
+      void operator()(const tbb::blocked_range<size_t>& range) const
+      {
+         for (size_t n = range.begin(); n != range.end(); ++n)
+         {
+            std::vector<PieceInLeaf>& pieces = (*leafPieces)[n];
+            for (MaskLeafT::ValueOnCIter iter = leafs->leaf(n).cbeginValueOn(); iter; ++iter)
+            {
+               const openvdb::Index32 label = (*offsets)[n] + (*labels)[n * MaskLeafT::SIZE + iter.pos()];
+               const openvdb::Index32 piece = (*pieceOf)[label];
+               size_t i = 0;
+               while (i < pieces.size() && pieces[i].piece != piece) ++i;
+               if (i == pieces.size())
+               {
+                  PieceInLeaf entry;
+                  entry.piece = piece;
+                  entry.voxelCount = 0;
+                  pieces.push_back(entry);
+               }
+               ++pieces[i].voxelCount;
+               pieces[i].bbox.expand(iter.getCoord());
+            }
+         }
+      }
+   };
+
+   // each piece owns its tree, so the pieces are built concurrently
+   struct BuildPieceOp
+   {
+      const openvdb::FloatGrid* grid;
+      const MaskLeafManagerT* leafs;
+      const std::vector<LocalLabel>* labels;
+      const std::vector<openvdb::Index32>* offsets;
+      const std::vector<openvdb::Index32>* pieceOf;
+      const std::vector<openvdb::Index32>* keptPieces;
+      const std::vector<std::vector<openvdb::Index32> >* pieceLeafs;
+      std::vector<openvdb::FloatGrid::Ptr>* pieces;
+
+      void operator()(const tbb::blocked_range<size_t>& range) const
+      {
+         const float background = grid->background();
+         openvdb::tree::ValueAccessor<const openvdb::FloatTree> srcAcc(grid->tree());
+
+         for (size_t k = range.begin(); k != range.end(); ++k)
+         {
+            const openvdb::Index32 piece = (*keptPieces)[k];
+            openvdb::FloatGrid::Ptr out = openvdb::FloatGrid::create(background);
+            out->setTransform(grid->transform().copy());
+            out->setGridClass(grid->getGridClass());
+
+            const std::vector<openvdb::Index32>& pieceLeafList = (*pieceLeafs)[piece];
+            for (size_t i = 0; i < pieceLeafList.size(); ++i)
+            {
+               const size_t n = pieceLeafList[i];
+               const MaskLeafT& maskLeaf = leafs->leaf(n);
+               FloatLeafT* leaf = out->tree().touchLeaf(maskLeaf.origin());
+               const FloatLeafT* srcLeaf = srcAcc.probeConstLeaf(maskLeaf.origin());
+               // leaves voxelized from an active tile have no source leaf
+               if (srcLeaf) *leaf = *srcLeaf;
+               else leaf->fill(srcAcc.getValue(maskLeaf.origin()), false);
+
+               // the voxels of the other pieces sharing the leaf are cleared
+               for (MaskLeafT::ValueOnCIter iter = maskLeaf.cbeginValueOn(); iter; ++iter)
+               {
+                  const openvdb::Index32 label = (*offsets)[n] + (*labels)[n * MaskLeafT::SIZE + iter.pos()];
+                  if ((*pieceOf)[label] == piece) leaf->setValueOn(iter.pos());
+                  else leaf->setValueOff(iter.pos(), background);
+               }
+            }
+
+            if (out->getGridClass() == openvdb::GRID_LEVEL_SET) out->tree().signedFloodFill();
+            (*pieces)[k] = out;
+         }
+      }
+   };
+}
+
+VDB_Node_Segment::VDB_Node_Segment()
+   : m_isValid(false)
+   , m_handleId(0)
+{
+}
+
+VDB_Node_Segment::~VDB_Node_Segment()
+{
+}
+
+void VDB_Node_Segment::Segment(const openvdb::FloatGrid& grid, openvdb::Index64 minVoxels,
+   std::vector<openvdb::FloatGrid::Ptr>& pieces, std::vector<openvdb::Index64>& voxelCounts,
+   std::vector<openvdb::CoordBBox>& bounds)
+{
+   pieces.clear();
+   voxelCounts.clear();
+   bounds.clear();
+
+   // the labeling runs on the active topology, active tiles are split into
+   // leaves so every active voxel has a label
+   MaskTreeT mask(grid.tree(), false, openvdb::TopologyCopy());
+   std::vector<openvdb::CoordBBox> tiles;
+   for (MaskTreeT::ValueOnCIter iter = mask.cbeginValueOn(); iter; ++iter)
+   {
+      if (iter.isVoxelValue()) continue;
+      openvdb::CoordBBox bbox;
+      iter.getBoundingBox(bbox);
+      tiles.push_back(bbox);
+   }
+   for (size_t i = 0; i < tiles.size(); ++i)
+   {
+      openvdb::Coord xyz;
+      for (xyz[0] = tiles[i].min()[0]; xyz[0] <= tiles[i].max()[0]; xyz[0] += MaskLeafT::DIM)
+      {
+         for (xyz[1] = tiles[i].min()[1]; xyz[1] <= tiles[i].max()[1]; xyz[1] += MaskLeafT::DIM)
+         {
+            for (xyz[2] = tiles[i].min()[2]; xyz[2] <= tiles[i].max()[2]; xyz[2] += MaskLeafT::DIM)
+            {
+               mask.touchLeaf(xyz)->setValuesOn();
+            }
+         }
+      }
+   }
+
+   MaskLeafManagerT leafs(mask);
+   const size_t leafCount = leafs.leafCount();
+   if (leafCount == 0) return;
+
+   LeafIndex index(leafCount);
+   for (size_t n = 0; n < leafCount; ++n)
+   {
+      index[n] = std::make_pair(&leafs.leaf(n), n);
+   }
+   std::sort(index.begin(), index.end());
+
+   // 1. components inside each leaf, all leaves in parallel
+   std::vector<LocalLabel> labels(leafCount * MaskLeafT::SIZE, kNoLabel);
+   std::vector<openvdb::Index32> offsets(leafCount + 1, 0);
+   {
+      LocalLabelOp op;
+      op.leafs = &leafs;
+      op.labels = &labels;
+      op.counts = &offsets;
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, leafCount), op);
+   }
+
+   // turn the counts into the first global label of each leaf
+   openvdb::Index32 labelCount = 0;
+   for (size_t n = 0; n < leafCount; ++n)
+   {
+      const openvdb::Index32 count = offsets[n];
+      offsets[n] = labelCount;
+      labelCount += count;
+   }
+   offsets[leafCount] = labelCount;
+
+   // 2. labels touching across leaf faces, gathered in parallel
+   EdgeOp edgeOp;
+   edgeOp.mask = &mask;
+   edgeOp.leafs = &leafs;
+   edgeOp.index = &index;
+   edgeOp.labels = &labels;
+   edgeOp.offsets = &offsets;
+   tbb::parallel_reduce(tbb::blocked_range<size_t>(0, leafCount), edgeOp);
+
+   // 3. union find over the leaf components, there are far fewer of them
+   // than voxels. the smallest label always becomes the root.
+   std::vector<openvdb::Index32> parent(labelCount);
+   for (openvdb::Index32 i = 0; i < labelCount; ++i) parent[i] = i;
+   for (size_t e = 0; e < edgeOp.edges.size(); ++e)
+   {
+      const openvdb::Index32 a = findRoot(parent, edgeOp.edges[e].first);
+      const openvdb::Index32 b = findRoot(parent, edgeOp.edges[e].second);
+      if (a < b) parent[b] = a;
+      else if (b < a) parent[a] = b;
+   }
+
+   std::vector<openvdb::Index32> pieceOf(labelCount);
+   openvdb::Index32 pieceCount = 0;
+   for (openvdb::Index32 i = 0; i < labelCount; ++i)
+   {
+      const openvdb::Index32 root = findRoot(parent, i);
+      pieceOf[i] = root == i ? pieceCount++ : pieceOf[root];
+   }
+
+   // 4. voxel counts, bounds and leaves of each piece
+   std::vector<std::vector<PieceInLeaf> > leafPieces(leafCount);
+   {
+      PieceStatsOp op;
+      op.leafs = &leafs;
+      op.labels = &labels;
+      op.offsets = &offsets;
+      op.pieceOf = &pieceOf;
+      op.leafPieces = &leafPieces;
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, leafCount), op);
+   }
+
+   std::vector<openvdb::Index64> pieceVoxels(pieceCount, 0);
+   std::vector<openvdb::CoordBBox> pieceBounds(pieceCount);
+   std::vector<std::vector<openvdb::Index32> > pieceLeafs(pieceCount);
+   for (size_t n = 0; n < leafCount; ++n)
+   {
+      for (size_t i = 0; i < leafPieces[n].size(); ++i)
+      {
+         const PieceInLeaf& entry = leafPieces[n][i];
+         pieceVoxels[entry.piece] += entry.voxelCount;
+         pieceBounds[entry.piece].expand(entry.bbox);
+         pieceLeafs[entry.piece].push_back(openvdb::Index32(n));
+      }
+   }
+
+   std::vector<openvdb::Index32> keptPieces;
+   for (openvdb::Index32 p = 0; p < pieceCount; ++p)
+   {
+      if (pieceVoxels[p] < minVoxels) continue;
+      keptPieces.push_back(p);
+      voxelCounts.push_back(pieceVoxels[p]);
+      bounds.push_back(pieceBounds[p]);
+   }
+
+   // 5. one grid per piece, the pieces are built in parallel
+   pieces.resize(keptPieces.size());
+   BuildPieceOp buildOp;
+   buildOp.grid = &grid;
+   buildOp.leafs = &leafs;
+   buildOp.labels = &labels;
+   buildOp.offsets = &offsets;
+   buildOp.pieceOf = &pieceOf;
+   buildOp.keptPieces = &keptPieces;
+   buildOp.pieceLeafs = &pieceLeafs;
+   buildOp.pieces = &pieces;
+   tbb::parallel_for(tbb::blocked_range<size_t>(0, keptPieces.size()), buildOp);
+}
+
+CStatus VDB_Node_Segment::Cache(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_Segment] Cache");
+
+   m_isValid = false;
+   m_handleId = 0;
+   m_voxelCounts.clear();
+   m_boundsMin.clear();
+   m_boundsMax.clear();
+   // the previous result is freed once nothing downstream holds it
+   m_outHandles.ReleaseAll();
+
+   CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid);
+   CDataArrayString gridName(ctxt, kGridName);
+   CDataArrayLong minVoxels(ctxt, kMinVoxels);
+
+   VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, 0);
+   if (!inVDBPrim) return CStatus::Fail;
+
+   int gridIndex = inVDBPrim->FindGridIndex(gridName[0].GetAsciiString());
+   openvdb::FloatGrid::ConstPtr inputGrid;
+   if (gridIndex >= 0)
+   {
+      inputGrid = openvdb::gridConstPtrCast<openvdb::FloatGrid>(inVDBPrim->GetConstGridPtr(gridIndex));
+   }
+   if (!inputGrid)
+   {
+      Application().LogMessage(L"[VDB_Node_Segment] selected grid must be a float grid!", siErrorMsg);
+      return CStatus::Fail;
+   }
+
+   std::vector<openvdb::FloatGrid::Ptr> pieces;
+   std::vector<openvdb::CoordBBox> bounds;
+   Segment(*inputGrid, openvdb::Index64(std::max(minVoxels[0], LONG(1))), pieces, m_voxelCounts, bounds);
+
+   std::ostringstream ostr;
+   ostr << pieces.size();
+   Application().LogMessage(L"[VDB_Node_Segment] " + CString(ostr.str().c_str()) + L" pieces");
+
+   // the pieces share the transform and metadata of the input
+   const std::string baseName = inputGrid->getName().empty() ? std::string("piece") : inputGrid->getName();
+   VDB_Primitive::Ptr outVDBPrim = inVDBPrim->ShallowCopy();
+   for (size_t i = 0; i < pieces.size(); ++i)
+   {
+      std::ostringstream name;
+      name << baseName << "_" << i;
+      pieces[i]->setName(name.str());
+      if (i == 0) outVDBPrim->SetGrid(*pieces[i]);
+      else outVDBPrim->AddGrid(*pieces[i]);
+
+      const openvdb::BBoxd wbox = inputGrid->transform().indexToWorld(bounds[i]);
+      m_boundsMin.push_back(openvdb::Vec3s(wbox.min()));
+      m_boundsMax.push_back(openvdb::Vec3s(wbox.max()));
+   }
+   if (!pieces.empty()) m_handleId = m_outHandles.Add(outVDBPrim);
+
+   m_isValid = true;
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_Segment::Evaluate(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_Segment] Evaluate");
+
+   if (!m_isValid) return CStatus::OK;
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+
+   switch (evaluatedPort)
+   {
+      case kOutVDBGrid:
+      {
+         CDataArrayCustomType output(ctxt);
+         SetHandleId(output, 0, m_handleId);
+         break;
+      }
+      case kOutVoxelCounts:
+      {
+         CDataArray2DLong output(ctxt);
+         CDataArray2DLong::Accessor iter = output.Resize(0, (ULONG)m_voxelCounts.size());
+         for (ULONG i=0; i<m_voxelCounts.size(); ++i)
+         {
+            iter[i] = LONG(m_voxelCounts[i]);
+         }
+         break;
+      }
+      case kOutBoundsMin:
+      case kOutBoundsMax:
+      {
+         const std::vector<openvdb::Vec3s>& bounds = evaluatedPort == kOutBoundsMin ? m_boundsMin : m_boundsMax;
+         CDataArray2DVector3f output(ctxt);
+         CDataArray2DVector3f::Accessor iter = output.Resize(0, (ULONG)bounds.size());
+         for (ULONG i=0; i<bounds.size(); ++i)
+         {
+            iter[i] = MATH::CVector3f(bounds[i].x(), bounds[i].y(), bounds[i].z());
+         }
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+bool VDB_Node_Segment::IsValid()
+{
+   return m_isValid;
+}
+
+CStatus VDB_Node_Segment::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_Segment", L"VDB Segment");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   st = nodeDef.PutThreadingModel(siICENodeSingleThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"In", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
+   // smaller pieces are dropped, e.g. specks left over by noise
+   st = nodeDef.AddInputPort(kMinVoxels, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Min Voxels", L"minVoxels", CValue(1));
+   st.AssertSucceeded();
+
+   // one grid per piece named <grid name>_<index>
+   st = nodeDef.AddOutputPort(kOutVDBGrid, customTypes,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Out", L"outVDBGrid");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutVoxelCounts, siICENodeDataLong,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Voxel Counts", L"voxelCounts");
+   st.AssertSucceeded();
+
+   // world space bounds of the active voxels of each piece
+   st = nodeDef.AddOutputPort(kOutBoundsMin, siICENodeDataVector3,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Bounds Min", L"boundsMin");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutBoundsMax, siICENodeDataVector3,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Bounds Max", L"boundsMax");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Segment_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_Segment* vdbNode = new VDB_Node_Segment();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Segment_BeginEvaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Segment* vdbNode;
+   vdbNode = (VDB_Node_Segment*)(CValue::siPtrType)userData;
+
+   CICEPortState vdbGridPortState(ctxt, kInVDBGrid);
+   CICEPortState gridNamePortState(ctxt, kGridName);
+   CICEPortState minVoxelsPortState(ctxt, kMinVoxels);
+
+   bool vdbGridDirty = vdbGridPortState.IsDirty(CICEPortState::siAnyDirtyState);
+   bool gridNameDirty = gridNamePortState.IsDirty(CICEPortState::siAnyDirtyState);
+   bool minVoxelsDirty = minVoxelsPortState.IsDirty(CICEPortState::siAnyDirtyState);
+
+   vdbGridPortState.ClearState();
+   gridNamePortState.ClearState();
+   minVoxelsPortState.ClearState();
+
+   // segmenting is expensive, it only runs again when an input changed
+   if (vdbGridDirty || gridNameDirty || minVoxelsDirty)
+   {
+      vdbNode->Cache(ctxt);
+   }
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Segment_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Segment* vdbNode;
+   vdbNode = (VDB_Node_Segment*)(CValue::siPtrType)userData;
+   if (vdbNode->IsValid())
+   {
+      vdbNode->Evaluate(ctxt);
+   }
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Segment_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_Segment* vdbNode;
+      vdbNode = (VDB_Node_Segment*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
@@ -0,0 +1,47 @@
+// OpenVDB_Softimage
+// VDB_Node_Segment.h
+// ICE node that splits a grid into its connected components
+// Each piece becomes a grid of the output, with its voxel count and bounds
+
+#ifndef VDB_NODE_SEGMENT_H
+#define VDB_NODE_SEGMENT_H
+
+#include <vector>
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+#include "VDB_GridRegistry.h"
+
+class VDB_Node_Segment
+{
+public:
+   VDB_Node_Segment();
+   ~VDB_Node_Segment();
+
+   XSI::CStatus Cache(XSI::ICENodeContext& ctxt);
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   bool IsValid();
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+   // splits the active voxels of the grid into face connected pieces, pieces
+   // with fewer voxels than minVoxels are dropped. level set pieces get their
+   // inside flood filled again.
+   static void Segment(const openvdb::FloatGrid& grid, openvdb::Index64 minVoxels,
+      std::vector<openvdb::FloatGrid::Ptr>& pieces, std::vector<openvdb::Index64>& voxelCounts,
+      std::vector<openvdb::CoordBBox>& bounds);
+
+private:
+   bool m_isValid;
+   VDB_OutputHandles m_outHandles;
+   ULONG m_handleId;
+   std::vector<openvdb::Index64> m_voxelCounts;
+   std::vector<openvdb::Vec3s> m_boundsMin;
+   std::vector<openvdb::Vec3s> m_boundsMax;
+};
+
+#endif
@@ -3,6 +3,7 @@
 // ICE node to test the custom data type
 
 #include <xsi_application.h>
+#include <xsi_context.h>
 #include <xsi_icenodedef.h>
 #include <xsi_factory.h>
 #include <xsi_dataarray.h>
@@ -14,6 +15,7 @@
 
 #include "VDB_Node_TestCustomData.h"
 #include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
 
 // port values
 static const ULONG kGroup1 = 100;
@@ -46,24 +48,24 @@ CStatus VDB_Node_TestCustomData::Evaluate(ICENodeContext& ctxt)
          CDataArrayCustomType output(ctxt);
          CIndexSet indexSet(ctxt);
 
+         m_outHandles.ReleaseAll();
+
          for(CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
          {
             //Application().LogMessage(L"[VDB_Node_TestCustomData] iterator index = " + CValue(it.GetIndex()).GetAsText());
 
-            ULONG inDataSize;
-            VDB_Primitive* inVDBPrim;
-            inVDBGridPort.GetData(it, (const CDataArrayCustomType::TData**)&inVDBPrim, inDataSize);
-            if (!inDataSize)
+            ULONG handleId = GetHandleId(inVDBGridPort, it);
+            VDB_Primitive::Ptr inVDBPrim = VDB_GridRegistry::Get().Find(handleId);
+            if (!inVDBPrim)
             {
-               Application().LogMessage(L"[VDB_Node_TestCustomData] data size is invalid!", siErrorMsg);
+               Application().LogMessage(L"[VDB_Node_TestCustomData] input handle is invalid!", siErrorMsg);
                return CStatus::OK;
             }
-            Application().LogMessage(L"[VDB_Node_TestCustomData] previous data size = " + CValue(inDataSize).GetAsText());
+            Application().LogMessage(L"[VDB_Node_TestCustomData] handle = " + CValue(handleId).GetAsText() + L", references = " + CValue(VDB_GridRegistry::Get().GetRefCount(handleId)).GetAsText());
 
-            VDB_Primitive* outVDBPrim = (VDB_Primitive*)output.Resize(it, sizeof(VDB_Primitive));
-            ::memcpy(outVDBPrim, inVDBPrim, inDataSize);
+            // pass the same primitive through, holding our own reference on it
+            SetHandleId(output, it, m_outHandles.Hold(handleId));
 
-            Application().LogMessage(L"[VDB_Node_TestCustomData] memcpy succeeded");
             Application().LogMessage(L"[VDB_Node_TestCustomData] grid type is " + CString(inVDBPrim->GetTypeName()));
          }
          break;
@@ -133,9 +135,33 @@ SICALLBACK VDB_Node_TestCustomData_BeginEvaluate(ICENodeContext& ctxt)
    return CStatus::OK;
 }
 
-SICALLBACK VDB_Node_TestCustomData_Evaluate(ICENodeContext& ctxt)
+SICALLBACK VDB_Node_TestCustomData_Init(CRef& in_ctxt)
 {
+   Context ctxt(in_ctxt);
    VDB_Node_TestCustomData* vdbNode = new VDB_Node_TestCustomData();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_TestCustomData_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_TestCustomData* vdbNode;
+   vdbNode = (VDB_Node_TestCustomData*)(CValue::siPtrType)userData;
    vdbNode->Evaluate(ctxt);
    return CStatus::OK;
 }
+
+SICALLBACK VDB_Node_TestCustomData_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_TestCustomData* vdbNode;
+      vdbNode = (VDB_Node_TestCustomData*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
@@ -11,6 +11,8 @@
 
 #include <openvdb/openvdb.h>
 
+#include "VDB_GridRegistry.h"
+
 class VDB_Node_TestCustomData
 {
 public:
@@ -20,6 +22,9 @@ public:
    XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
    
    static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   VDB_OutputHandles m_outHandles;
 };
 
 #endif
@@ -0,0 +1,337 @@
+// OpenVDB_Softimage
+// VDB_Node_TopologyPreview.cpp
+// ICE node that shows the tree structure of a grid as boxes
+// Each internal node or leaf becomes a box of the preview mesh
+
+#include <algorithm>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+#include <xsi_dataarray2D.h>
+#include <xsi_iceportstate.h>
+#include <xsi_vector3f.h>
+
+#include "VDB_Node_TopologyPreview.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kInVDBGrid = 200;
+static const ULONG kGridName = 201;
+static const ULONG kLevel = 202;
+static const ULONG kOutPointArray = 300;
+static const ULONG kOutPolygonArray = 301;
+static const ULONG kOutLevels = 302;
+
+// 0 top internal nodes, 1 lower internal nodes, 2 leaves, 3 all of them
+static const LONG kAllLevels = 3;
+
+// corners of a box are numbered with x in bit 0, y in bit 1 and z in bit 2,
+// the faces wind counter clockwise seen from outside
+static const int kBoxFaces[6][4] =
+{
+   {0, 4, 6, 2}, {1, 3, 7, 5},
+   {0, 1, 5, 4}, {2, 6, 7, 3},
+   {0, 2, 3, 1}, {4, 5, 7, 6}
+};
+
+using namespace XSI;
+
+namespace
+{
+   // walks the nodes down to the selected level only, so the time depends
+   // on the number of nodes visited and never on the voxel count
+   template<typename GridT>
+   bool collectBoxes(const openvdb::GridBase& baseGrid, LONG level,
+      std::vector<openvdb::CoordBBox>& boxes, std::vector<LONG>& levels)
+   {
+      if (!baseGrid.isType<GridT>()) return false;
+
+      typedef typename GridT::TreeType TreeT;
+      const GridT& grid = static_cast<const GridT&>(baseGrid);
+
+      // the root sits at depth zero and is never drawn
+      const openvdb::Index leafDepth = TreeT::DEPTH - 1;
+      const bool allLevels = level >= kAllLevels;
+      const openvdb::Index depth = allLevels ? leafDepth : std::min(openvdb::Index(level + 1), leafDepth);
+
+      typename TreeT::NodeCIter iter = grid.tree().cbeginNode();
+      iter.setMaxDepth(depth);
+      for (; iter; ++iter)
+      {
+         const openvdb::Index nodeDepth = iter.getDepth();
+         if (nodeDepth == 0 || (!allLevels && nodeDepth != depth)) continue;
+         openvdb::CoordBBox bbox;
+         iter.getBoundingBox(bbox);
+         boxes.push_back(bbox);
+         levels.push_back(LONG(nodeDepth) - 1);
+      }
+      return true;
+   }
+
+   bool collectBoxes(const openvdb::GridBase& grid, LONG level,
+      std::vector<openvdb::CoordBBox>& boxes, std::vector<LONG>& levels)
+   {
+      return collectBoxes<openvdb::FloatGrid>(grid, level, boxes, levels)
+         || collectBoxes<openvdb::DoubleGrid>(grid, level, boxes, levels)
+         || collectBoxes<openvdb::Int32Grid>(grid, level, boxes, levels)
+         || collectBoxes<openvdb::Int64Grid>(grid, level, boxes, levels)
+         || collectBoxes<openvdb::Vec3SGrid>(grid, level, boxes, levels)
+         || collectBoxes<openvdb::Vec3DGrid>(grid, level, boxes, levels)
+         || collectBoxes<openvdb::Vec3IGrid>(grid, level, boxes, levels)
+         || collectBoxes<openvdb::BoolGrid>(grid, level, boxes, levels);
+   }
+}
+
+VDB_Node_TopologyPreview::VDB_Node_TopologyPreview()
+   : m_isValid(false)
+{
+}
+
+VDB_Node_TopologyPreview::~VDB_Node_TopologyPreview()
+{
+}
+
+CStatus VDB_Node_TopologyPreview::Cache(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_TopologyPreview] Cache");
+
+   m_isValid = false;
+   m_points.clear();
+   m_levels.clear();
+
+   CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid);
+   CDataArrayString gridName(ctxt, kGridName);
+   CDataArrayLong level(ctxt, kLevel);
+
+   VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, 0);
+   if (!inVDBPrim) return CStatus::Fail;
+
+   int gridIndex = inVDBPrim->FindGridIndex(gridName[0].GetAsciiString());
+   if (gridIndex < 0)
+   {
+      Application().LogMessage(L"[VDB_Node_TopologyPreview] no grid named " + gridName[0], siErrorMsg);
+      return CStatus::Fail;
+   }
+
+   // pending voxel operations only change values, the topology of the base
+   // grid is the one they resolve to
+   const openvdb::GridBase::ConstPtr gridPtr = inVDBPrim->GetBaseGridPtr(gridIndex);
+   const openvdb::GridBase& grid = *gridPtr;
+   std::vector<openvdb::CoordBBox> boxes;
+   if (!collectBoxes(grid, std::max(level[0], LONG(0)), boxes, m_levels))
+   {
+      Application().LogMessage(L"[VDB_Node_TopologyPreview] unsupported grid type " + CString(grid.valueType().c_str()), siErrorMsg);
+      return CStatus::Fail;
+   }
+
+   // the boxes enclose the voxels, which are centered on integer coordinates
+   const openvdb::math::Transform& xform = grid.transform();
+   m_points.reserve(boxes.size() * 8);
+   for (size_t b=0; b<boxes.size(); ++b)
+   {
+      const openvdb::Vec3d lo = boxes[b].min().asVec3d() - openvdb::Vec3d(0.5);
+      const openvdb::Vec3d hi = boxes[b].max().asVec3d() + openvdb::Vec3d(0.5);
+      for (int c=0; c<8; ++c)
+      {
+         const openvdb::Vec3d corner(c & 1 ? hi[0] : lo[0], c & 2 ? hi[1] : lo[1], c & 4 ? hi[2] : lo[2]);
+         m_points.push_back(openvdb::Vec3s(xform.indexToWorld(corner)));
+      }
+   }
+
+   Application().LogMessage(L"[VDB_Node_TopologyPreview] " + CValue((ULONG)boxes.size()).GetAsText() + L" boxes");
+
+   m_isValid = true;
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_TopologyPreview::Evaluate(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_TopologyPreview] Evaluate");
+
+   if (!m_isValid) return CStatus::OK;
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+
+   switch (evaluatedPort)
+   {
+      case kOutPointArray:
+      {
+         CDataArray2DVector3f output(ctxt);
+         CDataArray2DVector3f::Accessor iter = output.Resize(0, (ULONG)m_points.size());
+         for (ULONG i=0; i<m_points.size(); ++i)
+         {
+            iter[i] = MATH::CVector3f(m_points[i].x(), m_points[i].y(), m_points[i].z());
+         }
+         break;
+      }
+      case kOutPolygonArray:
+      {
+         // six quads per box, each one ends with -1
+         const ULONG boxCount = (ULONG)m_levels.size();
+         CDataArray2DLong output(ctxt);
+         CDataArray2DLong::Accessor iter = output.Resize(0, boxCount * 6 * 5);
+         ULONG index = 0;
+         for (ULONG b=0; b<boxCount; ++b)
+         {
+            for (int f=0; f<6; ++f)
+            {
+               for (int v=0; v<4; ++v)
+               {
+                  iter[index++] = LONG(b * 8 + kBoxFaces[f][v]);
+               }
+               iter[index++] = -1;
+            }
+         }
+         break;
+      }
+      case kOutLevels:
+      {
+         CDataArray2DLong output(ctxt);
+         CDataArray2DLong::Accessor iter = output.Resize(0, (ULONG)m_levels.size());
+         for (ULONG i=0; i<m_levels.size(); ++i)
+         {
+            iter[i] = m_levels[i];
+         }
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+bool VDB_Node_TopologyPreview::IsValid()
+{
+   return m_isValid;
+}
+
+CStatus VDB_Node_TopologyPreview::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_TopologyPreview", L"VDB Topology Preview");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   st = nodeDef.PutThreadingModel(siICENodeSingleThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"In", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
+   // 0 top internal nodes, 1 lower internal nodes, 2 leaves, 3 all levels
+   st = nodeDef.AddInputPort(kLevel, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Level", L"level", CValue(1));
+   st.AssertSucceeded();
+
+   // Add output ports.
+   st = nodeDef.AddOutputPort(kOutPointArray, siICENodeDataVector3,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Point Array", L"pointList");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutPolygonArray, siICENodeDataLong,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Polygon Array", L"polygonList");
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutLevels, siICENodeDataLong,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Levels", L"levels");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_TopologyPreview_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_TopologyPreview* vdbNode = new VDB_Node_TopologyPreview();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_TopologyPreview_BeginEvaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_TopologyPreview* vdbNode;
+   vdbNode = (VDB_Node_TopologyPreview*)(CValue::siPtrType)userData;
+
+   CICEPortState vdbGridPortState(ctxt, kInVDBGrid);
+   CICEPortState gridNamePortState(ctxt, kGridName);
+   CICEPortState levelPortState(ctxt, kLevel);
+
+   bool vdbGridDirty = vdbGridPortState.IsDirty(CICEPortState::siAnyDirtyState);
+   bool gridNameDirty = gridNamePortState.IsDirty(CICEPortState::siAnyDirtyState);
+   bool levelDirty = levelPortState.IsDirty(CICEPortState::siAnyDirtyState);
+
+   vdbGridPortState.ClearState();
+   gridNamePortState.ClearState();
+   levelPortState.ClearState();
+
+   if (vdbGridDirty || gridNameDirty || levelDirty)
+   {
+      vdbNode->Cache(ctxt);
+   }
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_TopologyPreview_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_TopologyPreview* vdbNode;
+   vdbNode = (VDB_Node_TopologyPreview*)(CValue::siPtrType)userData;
+   if (vdbNode->IsValid())
+   {
+      vdbNode->Evaluate(ctxt);
+   }
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_TopologyPreview_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_TopologyPreview* vdbNode;
+      vdbNode = (VDB_Node_TopologyPreview*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
@@ -0,0 +1,36 @@
+// OpenVDB_Softimage
+// VDB_Node_TopologyPreview.h
+// ICE node that shows the tree structure of a grid as boxes
+// Each internal node or leaf becomes a box of the preview mesh
+
+#ifndef VDB_NODE_TOPOLOGYPREVIEW_H
+#define VDB_NODE_TOPOLOGYPREVIEW_H
+
+#include <vector>
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+class VDB_Node_TopologyPreview
+{
+public:
+   VDB_Node_TopologyPreview();
+   ~VDB_Node_TopologyPreview();
+
+   XSI::CStatus Cache(XSI::ICENodeContext& ctxt);
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   bool IsValid();
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   bool m_isValid;
+   std::vector<openvdb::Vec3s> m_points;
+   // level of each box, 0 for the top internal nodes and 2 for leaves
+   std::vector<LONG> m_levels;
+};
+
+#endif
@@ -14,6 +14,8 @@
 
 #include <openvdb/openvdb.h>
 
+#include "VDB_GridRegistry.h"
+
 class VDB_Node_Turbulence
 {
 public:
@@ -23,6 +25,9 @@ public:
    XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
    
    static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   VDB_OutputHandles m_outHandles;
 };
 
 #endif
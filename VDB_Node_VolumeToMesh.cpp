@@ -9,12 +9,14 @@
 
 #include "VDB_Node_VolumeToMesh.h"
 #include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
 
 // port values
 static const ULONG kGroup1 = 100;
 static const ULONG kIsoValue = 1;
 static const ULONG kAdaptivity = 2;
 static const ULONG kVDBGrid = 3;
+static const ULONG kGridName = 4;
 static const ULONG kPointArray = 200;
 static const ULONG kPolygonArray = 201;
 static const ULONG kTypeCns = 400;
@@ -38,18 +40,27 @@ CStatus VDB_Node_VolumeToMesh::Cache(ICENodeContext& ctxt)
 
    CDataArrayCustomType inVDBGridPort(ctxt, kVDBGrid);
    
-   ULONG inDataSize;
-   VDB_Primitive* inVDBPrim;
-   inVDBGridPort.GetData(0, (const CDataArrayCustomType::TData**)&inVDBPrim, inDataSize);
+   VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, 0);
    
    // if the vdb grid port has no data, then exit
-   if (!inDataSize) return CStatus::Fail;
+   if (!inVDBPrim) return CStatus::Fail;
 
-   const openvdb::GridBase::ConstPtr grid = inVDBPrim->GetConstGridPtr();
+   CDataArrayString gridNameData(ctxt, kGridName);
+   int gridIndex = inVDBPrim->FindGridIndex(gridNameData[0].GetAsciiString());
+   if (gridIndex < 0)
+   {
+      Application().LogMessage(L"[VDB_Node_VolumeToMesh] no grid named " + gridNameData[0], siErrorMsg);
+      return CStatus::Fail;
+   }
+
+   const openvdb::GridBase::ConstPtr grid = inVDBPrim->GetConstGridPtr(gridIndex);
    
    // if the grid is invalid?
    if (!grid) return CStatus::Fail;
 
+   // nothing to mesh, the statistics are cached on the primitive
+   if (inVDBPrim->GetStats(gridIndex).activeVoxelCount == 0) return CStatus::Fail;
+
    // log some info about the grid
    CString gridName(grid->getName().c_str());
    CString gridType(grid->valueType().c_str());
@@ -210,6 +221,11 @@ CStatus VDB_Node_VolumeToMesh::Register(PluginRegistrar& reg)
       L"VDB Grid", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
    st.AssertSucceeded();
    
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
    st = nodeDef.AddInputPort(kIsoValue, kGroup1, siICENodeDataFloat,
       siICENodeStructureSingle, siICENodeContextSingleton,
       L"Iso Value", L"isoValue", 0.0);
@@ -267,16 +283,19 @@ SICALLBACK VDB_Node_VolumeToMesh_BeginEvaluate(ICENodeContext& ctxt)
    CICEPortState vdbGridPortState(ctxt, kVDBGrid);
    CICEPortState isoPortState(ctxt, kIsoValue);
    CICEPortState adaptPortState(ctxt, kAdaptivity);
+   CICEPortState gridNamePortState(ctxt, kGridName);
 
    bool vdbGridDirty = vdbGridPortState.IsDirty(CICEPortState::siAnyDirtyState);
    bool isoDirty = isoPortState.IsDirty(CICEPortState::siAnyDirtyState);
    bool adaptDirty = adaptPortState.IsDirty(CICEPortState::siAnyDirtyState);
+   bool gridNameDirty = gridNamePortState.IsDirty(CICEPortState::siAnyDirtyState);
 
    vdbGridPortState.ClearState();
    isoPortState.ClearState();
    adaptPortState.ClearState();
+   gridNamePortState.ClearState();
 
-   if (vdbGridDirty || isoDirty || adaptDirty)
+   if (vdbGridDirty || isoDirty || adaptDirty || gridNameDirty)
    {
       vdbNode->Cache(ctxt);
    }
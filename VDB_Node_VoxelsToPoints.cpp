@@ -0,0 +1,499 @@
+// OpenVDB_Softimage
+// VDB_Node_VoxelsToPoints.cpp
+// ICE node that exports the active voxels of a grid as point arrays
+// Positions and values can be thinned by stride and value range
+
+#include <algorithm>
+#include <vector>
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_icenodedef.h>
+#include <xsi_factory.h>
+#include <xsi_dataarray.h>
+#include <xsi_dataarray2D.h>
+#include <xsi_iceportstate.h>
+#include <xsi_vector3f.h>
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <openvdb/tree/LeafManager.h>
+
+#include "VDB_Node_VoxelsToPoints.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+
+// port values
+static const ULONG kGroup1 = 100;
+static const ULONG kInVDBGrid = 200;
+static const ULONG kGridName = 201;
+static const ULONG kStride = 202;
+static const ULONG kUseRange = 203;
+static const ULONG kMinValue = 204;
+static const ULONG kMaxValue = 205;
+static const ULONG kIncludeTiles = 206;
+static const ULONG kOutPositions = 300;
+static const ULONG kOutValues = 301;
+static const ULONG kOutVectors = 302;
+
+using namespace XSI;
+
+namespace
+{
+   // the range filter and the scalar output use the magnitude of vectors
+   inline float magnitude(float value) { return value; }
+   inline float magnitude(const openvdb::Vec3s& value) { return value.length(); }
+
+   struct Filter
+   {
+      bool useRange;
+      float minValue;
+      float maxValue;
+
+      template<typename ValueT>
+      bool operator()(const ValueT& value) const
+      {
+         if (!useRange) return true;
+         const float m = magnitude(value);
+         return m >= minValue && m <= maxValue;
+      }
+   };
+
+   // number of active voxels passing the filter in each leaf
+   template<typename TreeT>
+   struct CountOp
+   {
+      typedef openvdb::tree::LeafManager<const TreeT> LeafManagerT;
+
+      const LeafManagerT* leafs;
+      Filter filter;
+      std::vector<size_t>* counts;
+
+      void operator()(const tbb::blocked_range<size_t>& range) const
+      {
+         for (size_t n = range.begin(); n != range.end(); ++n)
+         {
+            size_t count = 0;
+            for (typename TreeT::LeafNodeType::ValueOnCIter iter = leafs->leaf(n).cbeginValueOn(); iter; ++iter)
+            {
+               if (filter(*iter)) ++count;
+            }
+            (*counts)[n] = count;
+         }
+      }
+   };
+
+   // number of points the grid exports, the leaves are counted in parallel.
+   // leafOffsets receives the running index of the first voxel of each leaf
+   // passing the filter, the stride applies to that index over the whole grid.
+   template<typename GridT>
+   size_t countPoints(const GridT& grid, const Filter& filter, size_t stride, bool includeTiles, std::vector<size_t>& leafOffsets)
+   {
+      typedef typename GridT::TreeType TreeT;
+
+      openvdb::tree::LeafManager<const TreeT> leafs(grid.tree());
+      leafOffsets.assign(leafs.leafCount() + 1, 0);
+      CountOp<TreeT> countOp;
+      countOp.leafs = &leafs;
+      countOp.filter = filter;
+      countOp.counts = &leafOffsets;
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, leafs.leafCount()), countOp);
+
+      // counts to exclusive offsets, the last entry is the total
+      size_t total = 0;
+      for (size_t n = 0; n < leafOffsets.size(); ++n)
+      {
+         const size_t count = leafOffsets[n];
+         leafOffsets[n] = total;
+         total += count;
+      }
+      size_t pointCount = (total + stride - 1) / stride;
+
+      if (includeTiles)
+      {
+         // tiles live above the leaf level, the voxels are not visited
+         typename TreeT::ValueOnCIter iter = grid.tree().cbeginValueOn();
+         iter.setMaxDepth(TreeT::ValueOnCIter::LEAF_DEPTH - 1);
+         for (; iter; ++iter)
+         {
+            if (filter(*iter)) ++pointCount;
+         }
+      }
+      return pointCount;
+   }
+
+   // writes the points of each leaf from its precomputed offset, the leaves
+   // fill disjoint parts of the output in parallel
+   template<typename TreeT, typename WriterT>
+   struct WriteOp
+   {
+      typedef openvdb::tree::LeafManager<const TreeT> LeafManagerT;
+
+      const LeafManagerT* leafs;
+      Filter filter;
+      size_t stride;
+      const std::vector<size_t>* leafOffsets;
+      WriterT writer;
+
+      void operator()(const tbb::blocked_range<size_t>& range) const
+      {
+         for (size_t n = range.begin(); n != range.end(); ++n)
+         {
+            size_t k = (*leafOffsets)[n];
+            for (typename TreeT::LeafNodeType::ValueOnCIter iter = leafs->leaf(n).cbeginValueOn(); iter; ++iter)
+            {
+               if (!filter(*iter)) continue;
+               if (k % stride == 0) writer(k / stride, iter.getCoord().asVec3d(), *iter);
+               ++k;
+            }
+         }
+      }
+   };
+
+   // the centers of the tiles come after the voxels
+   template<typename GridT, typename WriterT>
+   void writePoints(const GridT& grid, const Filter& filter, size_t stride, bool includeTiles, const std::vector<size_t>& leafOffsets, const WriterT& writer)
+   {
+      typedef typename GridT::TreeType TreeT;
+
+      openvdb::tree::LeafManager<const TreeT> leafs(grid.tree());
+      WriteOp<TreeT, WriterT> writeOp = { &leafs, filter, stride, &leafOffsets, writer };
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, leafs.leafCount()), writeOp);
+
+      if (!includeTiles) return;
+      size_t i = (leafOffsets.back() + stride - 1) / stride;
+      typename TreeT::ValueOnCIter iter = grid.tree().cbeginValueOn();
+      iter.setMaxDepth(TreeT::ValueOnCIter::LEAF_DEPTH - 1);
+      for (; iter; ++iter)
+      {
+         if (!filter(*iter)) continue;
+         openvdb::CoordBBox bbox;
+         iter.getBoundingBox(bbox);
+         writer(i++, (bbox.min().asVec3d() + bbox.max().asVec3d()) * 0.5, *iter);
+      }
+   }
+
+   // the writers store straight into the contiguous storage of the output
+   // array, each point is written by exactly one task
+   struct PositionWriter
+   {
+      MATH::CVector3f* data;
+      const openvdb::math::Transform* xform;
+
+      template<typename ValueT>
+      void operator()(size_t i, const openvdb::Vec3d& ijk, const ValueT&) const
+      {
+         const openvdb::Vec3d pos = xform->indexToWorld(ijk);
+         data[i].Set(float(pos.x()), float(pos.y()), float(pos.z()));
+      }
+   };
+
+   struct ValueWriter
+   {
+      float* data;
+
+      template<typename ValueT>
+      void operator()(size_t i, const openvdb::Vec3d&, const ValueT& value) const
+      {
+         data[i] = magnitude(value);
+      }
+   };
+
+   struct VectorWriter
+   {
+      MATH::CVector3f* data;
+
+      void operator()(size_t i, const openvdb::Vec3d&, const openvdb::Vec3s& value) const
+      {
+         data[i].Set(value.x(), value.y(), value.z());
+      }
+   };
+
+   template<typename WriterT>
+   void writeGridPoints(const openvdb::GridBase& grid, const Filter& filter, size_t stride, bool includeTiles, const std::vector<size_t>& leafOffsets, const WriterT& writer)
+   {
+      if (grid.isType<openvdb::FloatGrid>())
+      {
+         writePoints(static_cast<const openvdb::FloatGrid&>(grid), filter, stride, includeTiles, leafOffsets, writer);
+      }
+      else if (grid.isType<openvdb::Vec3SGrid>())
+      {
+         writePoints(static_cast<const openvdb::Vec3SGrid&>(grid), filter, stride, includeTiles, leafOffsets, writer);
+      }
+   }
+}
+
+VDB_Node_VoxelsToPoints::VDB_Node_VoxelsToPoints()
+   : m_isValid(false)
+   , m_useRange(false)
+   , m_minValue(0.0f)
+   , m_maxValue(0.0f)
+   , m_stride(1)
+   , m_includeTiles(false)
+   , m_pointCount(0)
+{
+}
+
+VDB_Node_VoxelsToPoints::~VDB_Node_VoxelsToPoints()
+{
+}
+
+CStatus VDB_Node_VoxelsToPoints::Cache(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_VoxelsToPoints] Cache");
+
+   m_isValid = false;
+   m_grid.reset();
+   m_leafOffsets.clear();
+   m_pointCount = 0;
+
+   CDataArrayCustomType inVDBGridPort(ctxt, kInVDBGrid);
+   CDataArrayString gridName(ctxt, kGridName);
+   CDataArrayLong stride(ctxt, kStride);
+   CDataArrayBool useRange(ctxt, kUseRange);
+   CDataArrayFloat minValue(ctxt, kMinValue);
+   CDataArrayFloat maxValue(ctxt, kMaxValue);
+   CDataArrayBool includeTiles(ctxt, kIncludeTiles);
+
+   VDB_Primitive::Ptr inVDBPrim = GetPrimitive(inVDBGridPort, 0);
+   if (!inVDBPrim) return CStatus::Fail;
+
+   int gridIndex = inVDBPrim->FindGridIndex(gridName[0].GetAsciiString());
+   if (gridIndex < 0)
+   {
+      Application().LogMessage(L"[VDB_Node_VoxelsToPoints] no grid named " + gridName[0], siErrorMsg);
+      return CStatus::Fail;
+   }
+
+   m_useRange = useRange[0];
+   m_minValue = minValue[0];
+   m_maxValue = maxValue[0];
+   m_stride = size_t(std::max(stride[0], LONG(1)));
+   m_includeTiles = includeTiles[0];
+
+   Filter filter = { m_useRange, m_minValue, m_maxValue };
+
+   // only the point count and the leaf offsets are cached, the arrays are
+   // written straight into the output ports from the grid
+   openvdb::GridBase::ConstPtr grid = inVDBPrim->GetConstGridPtr(gridIndex);
+   if (grid->isType<openvdb::FloatGrid>())
+   {
+      m_pointCount = countPoints(static_cast<const openvdb::FloatGrid&>(*grid), filter, m_stride, m_includeTiles, m_leafOffsets);
+   }
+   else if (grid->isType<openvdb::Vec3SGrid>())
+   {
+      m_pointCount = countPoints(static_cast<const openvdb::Vec3SGrid&>(*grid), filter, m_stride, m_includeTiles, m_leafOffsets);
+   }
+   else
+   {
+      Application().LogMessage(L"[VDB_Node_VoxelsToPoints] selected grid must be a float or vec3s grid!", siErrorMsg);
+      return CStatus::Fail;
+   }
+   m_grid = grid;
+
+   Application().LogMessage(L"[VDB_Node_VoxelsToPoints] " + CValue((ULONG)m_pointCount).GetAsText() + L" points");
+
+   m_isValid = true;
+   return CStatus::OK;
+}
+
+CStatus VDB_Node_VoxelsToPoints::Evaluate(ICENodeContext& ctxt)
+{
+   Application().LogMessage(L"[VDB_Node_VoxelsToPoints] Evaluate");
+
+   if (!m_isValid) return CStatus::OK;
+
+   Filter filter = { m_useRange, m_minValue, m_maxValue };
+
+   // The current output port being evaluated...
+   ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
+
+   switch (evaluatedPort)
+   {
+      case kOutPositions:
+      {
+         CDataArray2DVector3f output(ctxt);
+         CDataArray2DVector3f::Accessor iter = output.Resize(0, (ULONG)m_pointCount);
+         if (m_pointCount == 0) break;
+         PositionWriter writer = { &iter[0], &m_grid->transform() };
+         writeGridPoints(*m_grid, filter, m_stride, m_includeTiles, m_leafOffsets, writer);
+         break;
+      }
+      case kOutValues:
+      {
+         CDataArray2DFloat output(ctxt);
+         CDataArray2DFloat::Accessor iter = output.Resize(0, (ULONG)m_pointCount);
+         if (m_pointCount == 0) break;
+         ValueWriter writer = { &iter[0] };
+         writeGridPoints(*m_grid, filter, m_stride, m_includeTiles, m_leafOffsets, writer);
+         break;
+      }
+      case kOutVectors:
+      {
+         CDataArray2DVector3f output(ctxt);
+         openvdb::Vec3SGrid::ConstPtr vectorGrid = openvdb::gridConstPtrCast<openvdb::Vec3SGrid>(m_grid);
+         CDataArray2DVector3f::Accessor iter = output.Resize(0, vectorGrid ? (ULONG)m_pointCount : 0);
+         if (vectorGrid && m_pointCount > 0)
+         {
+            VectorWriter writer = { &iter[0] };
+            writePoints(*vectorGrid, filter, m_stride, m_includeTiles, m_leafOffsets, writer);
+         }
+         break;
+      }
+      default:
+         break;
+   };
+
+   return CStatus::OK;
+}
+
+bool VDB_Node_VoxelsToPoints::IsValid()
+{
+   return m_isValid;
+}
+
+CStatus VDB_Node_VoxelsToPoints::Register(PluginRegistrar& reg)
+{
+   ICENodeDef nodeDef;
+   Factory factory = Application().GetFactory();
+   nodeDef = factory.CreateICENodeDef(L"VDB_Node_VoxelsToPoints", L"VDB Voxels To Points");
+
+   CStatus st;
+   st = nodeDef.PutColor(110, 110, 110);
+   st.AssertSucceeded();
+
+   st = nodeDef.PutThreadingModel(siICENodeSingleThreading);
+   st.AssertSucceeded();
+
+   // Add custom types definition
+   st = nodeDef.DefineCustomType(L"vdb_prim" ,L"VDB Grid",
+      L"openvdb grid type", 155, 21, 10);
+   st.AssertSucceeded();
+
+   // Add input ports and groups.
+   st = nodeDef.AddPortGroup(kGroup1);
+   st.AssertSucceeded();
+
+   // Add custom type names.
+   CStringArray customTypes(1);
+   customTypes[0] = L"vdb_prim";
+
+   st = nodeDef.AddInputPort(kInVDBGrid, kGroup1,
+      customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
+      L"In", L"inVDBGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kGridName, kGroup1, siICENodeDataString,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Grid Name", L"gridName", L"");
+   st.AssertSucceeded();
+
+   // keeps every nth voxel passing the range filter
+   st = nodeDef.AddInputPort(kStride, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Stride", L"stride", CValue(1));
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kUseRange, kGroup1, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Use Range", L"useRange", false);
+   st.AssertSucceeded();
+
+   // vector grids compare their magnitude
+   st = nodeDef.AddInputPort(kMinValue, kGroup1, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Min Value", L"minValue", 0.0f);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kMaxValue, kGroup1, siICENodeDataFloat,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Max Value", L"maxValue", 1.0f);
+   st.AssertSucceeded();
+
+   // one point at the center of each active tile
+   st = nodeDef.AddInputPort(kIncludeTiles, kGroup1, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Include Tiles", L"includeTiles", false);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddOutputPort(kOutPositions, siICENodeDataVector3,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Positions", L"positions");
+   st.AssertSucceeded();
+
+   // the voxel values, vector grids give their magnitude
+   st = nodeDef.AddOutputPort(kOutValues, siICENodeDataFloat,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Values", L"values");
+   st.AssertSucceeded();
+
+   // vec3s grids only
+   st = nodeDef.AddOutputPort(kOutVectors, siICENodeDataVector3,
+      siICENodeStructureArray, siICENodeContextSingleton,
+      L"Vectors", L"vectors");
+   st.AssertSucceeded();
+
+   PluginItem nodeItem = reg.RegisterICENode(nodeDef);
+   nodeItem.PutCategories(L"OpenVDB");
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_VoxelsToPoints_Init(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   VDB_Node_VoxelsToPoints* vdbNode = new VDB_Node_VoxelsToPoints();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_VoxelsToPoints_BeginEvaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_VoxelsToPoints* vdbNode;
+   vdbNode = (VDB_Node_VoxelsToPoints*)(CValue::siPtrType)userData;
+
+   // the arrays are only rebuilt when an input changed
+   const ULONG ports[] = { kInVDBGrid, kGridName, kStride, kUseRange, kMinValue, kMaxValue, kIncludeTiles };
+   bool dirty = false;
+   for (size_t i=0; i<sizeof(ports)/sizeof(ports[0]); ++i)
+   {
+      CICEPortState portState(ctxt, ports[i]);
+      dirty = portState.IsDirty(CICEPortState::siAnyDirtyState) || dirty;
+      portState.ClearState();
+   }
+
+   if (dirty)
+   {
+      vdbNode->Cache(ctxt);
+   }
+
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_VoxelsToPoints_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_VoxelsToPoints* vdbNode;
+   vdbNode = (VDB_Node_VoxelsToPoints*)(CValue::siPtrType)userData;
+   if (vdbNode->IsValid())
+   {
+      vdbNode->Evaluate(ctxt);
+   }
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_VoxelsToPoints_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_VoxelsToPoints* vdbNode;
+      vdbNode = (VDB_Node_VoxelsToPoints*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
@@ -0,0 +1,43 @@
+// OpenVDB_Softimage
+// VDB_Node_VoxelsToPoints.h
+// ICE node that exports the active voxels of a grid as point arrays
+// Positions and values can be thinned by stride and value range
+
+#ifndef VDB_NODE_VOXELSTOPOINTS_H
+#define VDB_NODE_VOXELSTOPOINTS_H
+
+#include <vector>
+
+#include <xsi_pluginregistrar.h>
+#include <xsi_status.h>
+#include <xsi_icenodecontext.h>
+
+#include <openvdb/openvdb.h>
+
+class VDB_Node_VoxelsToPoints
+{
+public:
+   VDB_Node_VoxelsToPoints();
+   ~VDB_Node_VoxelsToPoints();
+
+   XSI::CStatus Cache(XSI::ICENodeContext& ctxt);
+   XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
+   bool IsValid();
+   
+   static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   bool m_isValid;
+   // the arrays are not kept, each output port is filled from the grid
+   openvdb::GridBase::ConstPtr m_grid;
+   // running index of the first filtered voxel of each leaf, plus the total
+   std::vector<size_t> m_leafOffsets;
+   bool m_useRange;
+   float m_minValue;
+   float m_maxValue;
+   size_t m_stride;
+   bool m_includeTiles;
+   size_t m_pointCount;
+};
+
+#endif
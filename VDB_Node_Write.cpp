@@ -3,6 +3,7 @@
 // ICE node to write grids to disk
 
 #include <xsi_application.h>
+#include <xsi_context.h>
 #include <xsi_icenodedef.h>
 #include <xsi_factory.h>
 #include <xsi_dataarray.h>
@@ -11,25 +12,43 @@
 #include <xsi_doublearray.h>
 #include <xsi_longarray.h>
 #include <xsi_iceportstate.h>
+#include <xsi_time.h>
+
+#include <cmath>
+#include <vector>
 
 #include "VDB_Node_Write.h"
 #include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+#include "VDB_WriteQueue.h"
+#include "VDB_Utils.h"
+#include "VDB_ProxyMode.h"
 
 // port values
 static const ULONG kGroup1 = 100;
 static const ULONG kGroup2 = 101;
 static const ULONG kFilepath = 200;
 static const ULONG kVDBGrid = 201;
+static const ULONG kAsync = 202;
+static const ULONG kCompression = 203;
+static const ULONG kHalfScalars = 204;
+static const ULONG kHalfVectors = 205;
+static const ULONG kSkipExisting = 206;
+static const ULONG kDeltaSequence = 207;
+static const ULONG kKeyframeInterval = 208;
 static const ULONG kSuccess = 300;
 
 using namespace XSI;
 
 VDB_Node_Write::VDB_Node_Write()
+   : m_writeOwner(VDB_WriteQueue::Get().NewOwner())
 {
 }
 
 VDB_Node_Write::~VDB_Node_Write()
 {
+   // nobody is left to report them to
+   VDB_WriteQueue::Get().TakeErrors(m_writeOwner);
 }
 
 CStatus VDB_Node_Write::Evaluate(ICENodeContext& ctxt)
@@ -37,7 +56,11 @@ CStatus VDB_Node_Write::Evaluate(ICENodeContext& ctxt)
    Application().LogMessage(L"[VDB_Node_Write] Evaluate");
 
    CDataArrayString filePath(ctxt, kFilepath);
-   Application().LogMessage(L"[VDB_Node_Write] " + filePath[0]);
+
+   // $F tokens write one file per frame of the sequence
+   const int frame = int(floor(ctxt.GetTime().GetTime() + 0.5));
+   const std::string path = expandFrameTokens(filePath[0].GetAsciiString(), frame);
+   Application().LogMessage(L"[VDB_Node_Write] " + CString(path.c_str()));
 
    // The current output port being evaluated...
    ULONG evaluatedPort = ctxt.GetEvaluatedOutputPortID();
@@ -53,8 +76,29 @@ CStatus VDB_Node_Write::Evaluate(ICENodeContext& ctxt)
          ctxt.GetGroupInstanceCount(kGroup2, portCount);
          Application().LogMessage(L"[VDB_Node_Write] port count=" + CValue(portCount).GetAsText());
 
-         openvdb::io::File file(filePath[0].GetAsciiString());
-         openvdb::GridPtrVec grids;
+         CDataArrayBool async(ctxt, kAsync);
+         CDataArrayLong compression(ctxt, kCompression);
+         CDataArrayBool halfScalars(ctxt, kHalfScalars);
+         CDataArrayBool halfVectors(ctxt, kHalfVectors);
+         CDataArrayBool skipExisting(ctxt, kSkipExisting);
+         CDataArrayBool deltaSequence(ctxt, kDeltaSequence);
+         CDataArrayLong keyframeInterval(ctxt, kKeyframeInterval);
+
+         // report the writes of this node that failed in the background since
+         // last time
+         std::vector<std::string> errors = VDB_WriteQueue::Get().TakeErrors(m_writeOwner);
+         for (size_t i=0; i<errors.size(); ++i)
+         {
+            Application().LogMessage(L"[VDB_Node_Write] " + CString(errors[i].c_str()), siErrorMsg);
+         }
+
+         // the grids are gathered once the frame is known to be written,
+         // getting them resolves their pending operations
+         std::vector<VDB_Primitive::Ptr> prims;
+         openvdb::MetaMap meta;
+         std::time_t sourceTime = 0;
+         // grids generated in the graph have no source time to compare with
+         bool allSourced = true;
 
          for (ULONG portIdx=0; portIdx<portCount; portIdx++)
 			{
@@ -64,32 +108,113 @@ CStatus VDB_Node_Write::Evaluate(ICENodeContext& ctxt)
             {
                Application().LogMessage(L"[VDB_Node_Write] iterator index = " + CValue(it.GetIndex()).GetAsText());
                
-               ULONG dataSize;
-               VDB_Primitive* VDBPrim;
-               VDBGridPort.GetData(it, (const CDataArrayCustomType::TData**)&VDBPrim, dataSize);
-               if (!dataSize)
+               VDB_Primitive::Ptr VDBPrim = GetPrimitive(VDBGridPort, it);
+               if (!VDBPrim)
                {
-                  Application().LogMessage(L"[VDB_Node_Write] data size is invalid!", siErrorMsg);
+                  Application().LogMessage(L"[VDB_Node_Write] input handle is invalid!", siErrorMsg);
                   output.Set(it, false);
                   return CStatus::OK;
                }
-               Application().LogMessage(L"[VDB_Node_Write] previous data size = " + CValue(dataSize).GetAsText());
-               grids.push_back(VDBPrim->GetGridPtr());
+               prims.push_back(VDBPrim);
+               if (VDBPrim->GetSourceTime() > sourceTime) sourceTime = VDBPrim->GetSourceTime();
+               if (VDBPrim->GetSourceTime() == 0) allSourced = false;
+
+               const openvdb::MetaMap& primMeta = VDBPrim->GetMetadata();
+               for (openvdb::MetaMap::ConstMetaIterator metaIt = primMeta.beginMeta(); metaIt != primMeta.endMeta(); ++metaIt)
+               {
+                  if (metaIt->second) meta.insertMeta(metaIt->first, *metaIt->second);
+               }
                //openvdb::GridBase::Ptr grid = VDBPrim->GetGridPtr();
                //openvdb::FloatGrid::Ptr outputGrid;
                //outputGrid = openvdb::gridPtrCast<openvdb::FloatGrid>(grid);
                //openvdb::math::Transform::Ptr transform = outputGrid->getTransform();
 
-               //VDB_Primitive* outVDBPrim = (VDB_Primitive*)output.Resize(it, sizeof(VDB_Primitive));
-               //::memcpy(outVDBPrim, inVDBPrim, inDataSize);
-
-               Application().LogMessage(L"[VDB_Node_Write] memcpy succeeded");
                Application().LogMessage(L"[VDB_Node_Write] grid type is " + CString(VDBPrim->GetTypeName()));
                output.Set(it, true);
             }
          }
-         file.write(grids);
-         file.close();
+         // the proxy factor only means something to the session that built
+         // the grids, it never goes in a file
+         const bool proxyGrids = bool(meta[kProxyFactorMeta]);
+         meta.removeMeta(kProxyFactorMeta);
+         if (proxyGrids)
+         {
+            // a low resolution file would later be reused by Skip Existing
+            Application().LogMessage(L"[VDB_Node_Write] grids built at proxy resolution are not written, turn proxy mode off to write " + CString(path.c_str()), siErrorMsg);
+            for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+            {
+               output.Set(it, false);
+            }
+            break;
+         }
+
+         // resume a partially written sequence, a frame is written again only
+         // when the files its grids were read from are newer than the output
+         std::time_t outputTime = 0;
+         if (skipExisting[0] && !allSourced)
+         {
+            Application().LogMessage(L"[VDB_Node_Write] inputs not read from files cannot be checked for changes, rewriting " + CString(path.c_str()), siWarningMsg);
+         }
+         else if (skipExisting[0] && fileModTime(path, outputTime) && outputTime >= sourceTime)
+         {
+            Application().LogMessage(L"[VDB_Node_Write] skipping existing file " + CString(path.c_str()));
+            m_deltaWriter.Reset();
+            break;
+         }
+
+         // every grid of the primitives goes in the same file
+         openvdb::GridCPtrVec grids;
+         for (size_t i=0; i<prims.size(); ++i)
+         {
+            openvdb::GridCPtrVec primGrids = prims[i]->GetConstGrids();
+            grids.insert(grids.end(), primGrids.begin(), primGrids.end());
+         }
+
+         // between keyframes only the leaf nodes that changed are written
+         if (deltaSequence[0])
+         {
+            grids = m_deltaWriter.Encode(grids, meta, path, frame, keyframeInterval[0]);
+         }
+         else
+         {
+            m_deltaWriter.Reset();
+         }
+
+         grids = gridsWithHalfFlags(grids, halfScalars[0], halfVectors[0]);
+         const openvdb::Index32 compressionMask = compressionFlags(compression[0]);
+
+         if (async[0])
+         {
+            // the grids are immutable once registered, the writer only needs
+            // to hold references on them while evaluation moves on
+            VDB_WriteQueue::Get().Submit(m_writeOwner, path, grids, meta, compressionMask);
+
+            // success means queued, unless earlier background writes failed
+            if (!errors.empty())
+            {
+               for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+               {
+                  output.Set(it, false);
+               }
+            }
+            break;
+         }
+
+         try
+         {
+            openvdb::io::File file(path);
+            file.setCompression(compressionMask);
+            file.write(grids, meta);
+            file.close();
+         }
+         catch (openvdb::Exception& e)
+         {
+            Application().LogMessage(L"[VDB_Node_Write] " + CString(e.what()) + L" : " + CString(path.c_str()), siErrorMsg);
+            for (CIndexSet::Iterator it = indexSet.Begin(); it.HasNext(); it.Next())
+            {
+               output.Set(it, false);
+            }
+         }
 
          break;
       }
@@ -134,6 +259,42 @@ CStatus VDB_Node_Write::Register(PluginRegistrar& reg)
       L"File Path", L"filePath", L"");
    st.AssertSucceeded();
 
+   st = nodeDef.AddInputPort(kAsync, kGroup1, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Asynchronous", L"async", true);
+   st.AssertSucceeded();
+
+   // 0 none, 1 zip, 2 blosc (zip when blosc is not available)
+   st = nodeDef.AddInputPort(kCompression, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Compression", L"compression", CValue(1));
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kHalfScalars, kGroup1, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Save Scalars As Half", L"halfScalars", false);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kHalfVectors, kGroup1, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Save Vectors As Half", L"halfVectors", false);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kSkipExisting, kGroup1, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Skip Existing", L"skipExisting", false);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kDeltaSequence, kGroup1, siICENodeDataBool,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Delta Sequence", L"deltaSequence", false);
+   st.AssertSucceeded();
+
+   st = nodeDef.AddInputPort(kKeyframeInterval, kGroup1, siICENodeDataLong,
+      siICENodeStructureSingle, siICENodeContextSingleton,
+      L"Keyframe Interval", L"keyframeInterval", CValue(10), CValue(1), CValue(kMaxDeltaChainLength));
+   st.AssertSucceeded();
+
    st = nodeDef.AddInputPort(kVDBGrid, kGroup2,
       customTypes, siICENodeStructureSingle, siICENodeContextSingleton,
       L"VDBGrid", L"vdbGrid",ULONG_MAX,ULONG_MAX,ULONG_MAX);
@@ -167,9 +328,33 @@ SICALLBACK VDB_Node_Write_BeginEvaluate(ICENodeContext& ctxt)
    return CStatus::OK;
 }
 
-SICALLBACK VDB_Node_Write_Evaluate(ICENodeContext& ctxt)
+SICALLBACK VDB_Node_Write_Init(CRef& in_ctxt)
 {
+   Context ctxt(in_ctxt);
    VDB_Node_Write* vdbNode = new VDB_Node_Write();
+   ctxt.PutUserData((CValue::siPtrType)vdbNode);
+   return CStatus::OK;
+}
+
+SICALLBACK VDB_Node_Write_Evaluate(ICENodeContext& ctxt)
+{
+   CValue userData = ctxt.GetUserData();
+   VDB_Node_Write* vdbNode;
+   vdbNode = (VDB_Node_Write*)(CValue::siPtrType)userData;
    vdbNode->Evaluate(ctxt);
    return CStatus::OK;
 }
+
+SICALLBACK VDB_Node_Write_Term(CRef& in_ctxt)
+{
+   Context ctxt(in_ctxt);
+   CValue userData = ctxt.GetUserData();
+   if (!userData.IsEmpty())
+   {
+      VDB_Node_Write* vdbNode;
+      vdbNode = (VDB_Node_Write*)(CValue::siPtrType)userData;
+      delete vdbNode;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
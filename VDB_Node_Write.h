@@ -11,6 +11,8 @@
 
 #include <openvdb/openvdb.h>
 
+#include "VDB_DeltaSequence.h"
+
 class VDB_Node_Write
 {
 public:
@@ -20,6 +22,12 @@ public:
    XSI::CStatus Evaluate(XSI::ICENodeContext& ctxt);
    
    static XSI::CStatus Register(XSI::PluginRegistrar& reg);
+
+private:
+   // jobs this node handed to VDB_WriteQueue
+   size_t m_writeOwner;
+   // previous frame of the sequence, the base of the next delta
+   VDB_DeltaWriter m_deltaWriter;
 };
 
 #endif
\ No newline at end of file
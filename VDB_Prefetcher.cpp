@@ -0,0 +1,192 @@
+// OpenVDB_Softimage
+// VDB_Prefetcher.cpp
+// read ahead of .vdb sequences during playback
+
+#include <cstdlib>
+#include <sstream>
+
+#include "VDB_Prefetcher.h"
+#include "VDB_ReadCache.h"
+#include "VDB_DeltaSequence.h"
+#include "VDB_Utils.h"
+
+// loading is bound by the file system, a few requests in flight hide the
+// latency of network storage
+static const size_t kLoaderThreads = 4;
+// a bigger step between two evaluations is a jump, not playback
+static const int kMaxPlaybackStep = 4;
+
+VDB_Prefetcher& VDB_Prefetcher::Get()
+{
+   static VDB_Prefetcher prefetcher;
+   return prefetcher;
+}
+
+VDB_Prefetcher::VDB_Prefetcher()
+{
+}
+
+VDB_Prefetcher::~VDB_Prefetcher()
+{
+   Shutdown();
+}
+
+void VDB_Prefetcher::Start()
+{
+   tbb::mutex::scoped_lock lock(m_threadsMutex);
+   if (!m_threads.empty()) return;
+
+   Worker worker = { this };
+   for (size_t i=0; i<kLoaderThreads; ++i)
+   {
+      m_threads.push_back(new tbb::tbb_thread(worker));
+   }
+}
+
+void VDB_Prefetcher::Update(const std::string& pathTemplate, const std::string& gridNames, bool delayLoad,
+   int frame, int count)
+{
+   if (count <= 0 || pathTemplate.find("$F") == std::string::npos) return;
+
+   std::ostringstream key;
+   key << pathTemplate << '|' << gridNames << '|' << delayLoad;
+
+   std::vector<Job*> jobs;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      SequenceMap::iterator it = m_sequences.find(key.str());
+      if (it == m_sequences.end())
+      {
+         // nothing known about the playback yet, assume it runs forward
+         Sequence seq;
+         seq.lastFrame = frame - 1;
+         seq.step = 1;
+         seq.generation = 0;
+         it = m_sequences.insert(SequenceMap::value_type(key.str(), seq)).first;
+      }
+      Sequence& seq = it->second;
+
+      const int step = frame - seq.lastFrame;
+      if (step == 0) return;
+      seq.lastFrame = frame;
+
+      if (std::abs(step) > kMaxPlaybackStep)
+      {
+         // the user jumped, what is queued is not needed anymore
+         ++seq.generation;
+         seq.scheduled.clear();
+         seq.step = step > 0 ? 1 : -1;
+      }
+      else
+      {
+         if ((step > 0) != (seq.step > 0))
+         {
+            ++seq.generation;
+            seq.scheduled.clear();
+         }
+         seq.step = step;
+      }
+
+      // forget the frames the playback already went past
+      if (seq.step > 0) seq.scheduled.erase(seq.scheduled.begin(), seq.scheduled.upper_bound(frame));
+      else seq.scheduled.erase(seq.scheduled.lower_bound(frame), seq.scheduled.end());
+
+      for (int i=1; i<=count; ++i)
+      {
+         const int nextFrame = frame + i * seq.step;
+         if (!seq.scheduled.insert(nextFrame).second) continue;
+
+         Job* job = new Job;
+         job->key = key.str();
+         job->path = expandFrameTokens(pathTemplate, nextFrame);
+         job->gridNames = splitGridNames(gridNames);
+         job->delayLoad = delayLoad;
+         job->generation = seq.generation;
+         jobs.push_back(job);
+      }
+   }
+
+   if (jobs.empty()) return;
+   Start();
+   for (size_t i=0; i<jobs.size(); ++i)
+   {
+      m_jobs.push(jobs[i]);
+   }
+}
+
+void VDB_Prefetcher::Cancel()
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   for (SequenceMap::iterator it = m_sequences.begin(); it != m_sequences.end(); ++it)
+   {
+      ++it->second.generation;
+      it->second.scheduled.clear();
+   }
+}
+
+bool VDB_Prefetcher::IsCurrent(const Job& job) const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   SequenceMap::const_iterator it = m_sequences.find(job.key);
+   return it != m_sequences.end() && it->second.generation == job.generation;
+}
+
+void VDB_Prefetcher::Run()
+{
+   for (;;)
+   {
+      Job* job = NULL;
+      m_jobs.pop(job);
+      // a null job tells the thread to stop
+      if (!job) return;
+
+      // cancelled jobs are dropped without touching the disk
+      if (IsCurrent(*job)) Load(*job);
+      delete job;
+   }
+}
+
+void VDB_Prefetcher::Load(const Job& job)
+{
+   // past the end of the sequence
+   std::time_t modTime = 0;
+   if (!fileModTime(job.path, modTime)) return;
+
+   VDB_ReadCache& cache = VDB_ReadCache::Get();
+   std::vector<std::string> fileGridNames;
+   openvdb::MetaMap::ConstPtr meta;
+   if (!cache.GetFileInfo(job.path, fileGridNames, meta)) return;
+   // delta frames are rebuilt from their base frames by the reader itself
+   if (VDB_DeltaReader::IsDelta(*meta)) return;
+
+   const std::vector<std::string>& gridNames = job.gridNames.empty() ? fileGridNames : job.gridNames;
+   for (size_t i=0; i<gridNames.size(); ++i)
+   {
+      // a jump on the timeline also stops a frame half way through
+      if (!IsCurrent(job)) return;
+
+      openvdb::GridBase::ConstPtr grid = cache.GetGrid(job.path, gridNames[i], job.delayLoad);
+      // with delayed loading only the topology is read, bring the voxels in
+      // as well or playback would still wait on the disk
+      if (grid && job.delayLoad) grid->baseTree().readNonresidentBuffers();
+   }
+}
+
+void VDB_Prefetcher::Shutdown()
+{
+   Cancel();
+
+   tbb::mutex::scoped_lock lock(m_threadsMutex);
+   if (m_threads.empty()) return;
+
+   for (size_t i=0; i<m_threads.size(); ++i)
+   {
+      m_jobs.push(NULL);
+   }
+   for (size_t i=0; i<m_threads.size(); ++i)
+   {
+      m_threads[i]->join();
+      delete m_threads[i];
+   }
+   m_threads.clear();
+}
@@ -0,0 +1,79 @@
+// OpenVDB_Softimage
+// VDB_Prefetcher.h
+// read ahead of .vdb sequences during playback. the prefetcher follows the
+// direction and speed of the frames a VDB Read node asks for and loads the
+// next frames into VDB_ReadCache on background threads, so playback pays
+// the file system throughput rather than one latency hit per frame.
+// jumping elsewhere on the timeline drops the frames still queued.
+
+#ifndef VDB_PREFETCHER_H
+#define VDB_PREFETCHER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <tbb/mutex.h>
+#include <tbb/concurrent_queue.h>
+#include <tbb/tbb_thread.h>
+
+class VDB_Prefetcher
+{
+public:
+   static VDB_Prefetcher& Get();
+
+   // tells the prefetcher the sequence is now at the given frame, the path
+   // holds the $F frame tokens. an empty list of names loads every grid.
+   void Update(const std::string& pathTemplate, const std::string& gridNames, bool delayLoad,
+      int frame, int count);
+
+   // drops the queued frames of every sequence
+   void Cancel();
+   // cancels and stops the loader threads
+   void Shutdown();
+
+private:
+   VDB_Prefetcher();
+   ~VDB_Prefetcher();
+
+   struct Job
+   {
+      std::string key;
+      std::string path;
+      std::vector<std::string> gridNames;
+      bool delayLoad;
+      size_t generation;
+   };
+
+   // playback state of one sequence, bumping the generation cancels its
+   // queued jobs
+   struct Sequence
+   {
+      int lastFrame;
+      int step;
+      size_t generation;
+      std::set<int> scheduled;
+   };
+   typedef std::map<std::string, Sequence> SequenceMap;
+
+   void Start();
+   void Run();
+   void Load(const Job& job);
+   bool IsCurrent(const Job& job) const;
+
+   struct Worker
+   {
+      VDB_Prefetcher* prefetcher;
+      void operator()() const { prefetcher->Run(); }
+   };
+
+   tbb::concurrent_bounded_queue<Job*> m_jobs;
+   std::vector<tbb::tbb_thread*> m_threads;
+   tbb::mutex m_threadsMutex;
+
+   mutable tbb::mutex m_mutex;
+   SequenceMap m_sequences;
+};
+
+#endif
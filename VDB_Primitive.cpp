@@ -2,11 +2,159 @@
 // VDB_Primitive.cpp
 // class to hold VDB data and passed through the ICE graph
 
+#include <limits>
+
 #include <xsi_application.h>
 
+#include <tbb/task_group.h>
+#include <tbb/parallel_reduce.h>
+
+#include <openvdb/tree/LeafManager.h>
+
 #include "VDB_Primitive.h"
+#include "VDB_ReadCache.h"
+#include "VDB_GridRegistry.h"
+
+namespace
+{
+   template<typename T>
+   inline double valueAsDouble(const T& value) { return double(value); }
+
+   template<typename T>
+   inline double valueAsDouble(const openvdb::math::Vec3<T>& value) { return double(value.length()); }
+
+   // parallel reduction of the active values over the leaf nodes
+   template<typename TreeT>
+   struct MinMaxOp
+   {
+      typedef openvdb::tree::LeafManager<const TreeT> LeafManagerT;
+      typedef typename LeafManagerT::LeafRange LeafRange;
+
+      double minValue, maxValue;
+      bool valid;
+
+      MinMaxOp()
+         : minValue(std::numeric_limits<double>::max())
+         , maxValue(-std::numeric_limits<double>::max())
+         , valid(false)
+      {
+      }
+
+      MinMaxOp(const MinMaxOp& other, tbb::split)
+         : minValue(std::numeric_limits<double>::max())
+         , maxValue(-std::numeric_limits<double>::max())
+         , valid(false)
+      {
+      }
+
+      void add(double value)
+      {
+         if (value < minValue) minValue = value;
+         if (value > maxValue) maxValue = value;
+         valid = true;
+      }
+
+      void operator()(const LeafRange& range)
+      {
+         for (typename LeafRange::Iterator leaf = range.begin(); leaf; ++leaf)
+         {
+            for (typename TreeT::LeafNodeType::ValueOnCIter iter = leaf->cbeginValueOn(); iter; ++iter)
+            {
+               add(valueAsDouble(*iter));
+            }
+         }
+      }
+
+      void join(const MinMaxOp& other)
+      {
+         if (!other.valid) return;
+         add(other.minValue);
+         add(other.maxValue);
+      }
+   };
+
+   template<typename GridT>
+   bool evalValueRange(const openvdb::GridBase& baseGrid, double& minValue, double& maxValue)
+   {
+      if (!baseGrid.isType<GridT>()) return false;
+
+      typedef typename GridT::TreeType TreeT;
+      const TreeT& tree = static_cast<const GridT&>(baseGrid).tree();
+
+      MinMaxOp<TreeT> op;
+      openvdb::tree::LeafManager<const TreeT> leafs(tree);
+      tbb::parallel_reduce(leafs.leafRange(), op);
+
+      // active tiles are not covered by the leaf nodes
+      typename TreeT::ValueOnCIter tileIter = tree.cbeginValueOn();
+      tileIter.setMaxDepth(TreeT::ValueOnCIter::LEAF_DEPTH - 1);
+      for (; tileIter; ++tileIter)
+      {
+         op.add(valueAsDouble(*tileIter));
+      }
+
+      if (!op.valid) return false;
+      minValue = op.minValue;
+      maxValue = op.maxValue;
+      return true;
+   }
+
+   bool evalValueRange(const openvdb::GridBase& grid, double& minValue, double& maxValue)
+   {
+      return evalValueRange<openvdb::FloatGrid>(grid, minValue, maxValue)
+         || evalValueRange<openvdb::DoubleGrid>(grid, minValue, maxValue)
+         || evalValueRange<openvdb::Int32Grid>(grid, minValue, maxValue)
+         || evalValueRange<openvdb::Int64Grid>(grid, minValue, maxValue)
+         || evalValueRange<openvdb::Vec3SGrid>(grid, minValue, maxValue)
+         || evalValueRange<openvdb::Vec3DGrid>(grid, minValue, maxValue)
+         || evalValueRange<openvdb::Vec3IGrid>(grid, minValue, maxValue);
+   }
+
+   struct BBoxTask
+   {
+      const openvdb::GridBase* grid;
+      VDB_GridStats* stats;
+      void operator()() const { stats->bbox = grid->evalActiveVoxelBoundingBox(); }
+   };
+
+   struct VoxelCountTask
+   {
+      const openvdb::GridBase* grid;
+      VDB_GridStats* stats;
+      void operator()() const { stats->activeVoxelCount = grid->activeVoxelCount(); }
+   };
+
+   struct MemUsageTask
+   {
+      const openvdb::GridBase* grid;
+      VDB_GridStats* stats;
+      void operator()() const { stats->memUsage = grid->memUsage(); }
+   };
+
+   struct ValueRangeTask
+   {
+      const openvdb::GridBase* grid;
+      VDB_GridStats* stats;
+      void operator()() const
+      {
+         stats->hasValueRange = evalValueRange(*grid, stats->minValue, stats->maxValue);
+      }
+   };
+
+   // the tree pointer is returned by value, the copy holds one reference
+   inline bool isShared(const openvdb::GridBase::Ptr& grid)
+   {
+      return !grid.unique() || grid->constBaseTreePtr().use_count() > 2;
+   }
+}
+
+// keeps the source time across a spill to disk
+static const char* kSourceTimeMeta = "softimage_source_time";
 
 VDB_Primitive::VDB_Primitive()
+   : m_sourceTime(0)
+   , m_statsGeneration(0)
+   , m_registryId(0)
 {
 }
 
@@ -14,28 +162,419 @@ VDB_Primitive::~VDB_Primitive()
 {
 }
 
+VDB_Primitive::Ptr VDB_Primitive::ShallowCopy() const
+{
+   Ptr prim(new VDB_Primitive());
+   prim->m_grids = m_grids;
+   prim->m_pendingOps = m_pendingOps;
+   prim->m_resolved.resize(m_grids.size());
+   {
+      // grids resolved already are shared with their operations applied
+      tbb::mutex::scoped_lock lock(m_resolveMutex);
+      for (size_t i=0; i<m_resolved.size(); ++i)
+      {
+         if (!m_resolved[i]) continue;
+         prim->m_grids[i] = m_resolved[i];
+         prim->m_pendingOps[i].clear();
+      }
+   }
+   prim->m_transform = m_transform;
+   prim->m_metadata = m_metadata;
+   prim->m_sourceTime = m_sourceTime;
+   {
+      // the grids are shared, so are their stats
+      tbb::mutex::scoped_lock lock(m_statsMutex);
+      prim->m_statsValid = m_statsValid;
+      prim->m_stats = m_stats;
+   }
+   prim->m_statsValid.resize(m_grids.size(), false);
+   prim->m_stats.resize(m_grids.size());
+   return prim;
+}
+
 void VDB_Primitive::SetGrid(const openvdb::GridBase& grid)
 {
-   if (m_grid.get() == &grid)
+   if (m_grids.size() == 1 && m_grids[0].get() == &grid)
    {
       XSI::Application().LogMessage(L"[VDB_Primitive] grids are equal?");
       return;
    }
+   m_grids.clear();
+   m_transform.reset();
+   m_sourceTime = 0;
+   ResetPendingOps();
+   AddGrid(grid);
+}
+
+void VDB_Primitive::AddGrid(const openvdb::GridBase& grid)
+{
+   InsertGrid(grid);
+}
+
+void VDB_Primitive::AddGridFrom(const VDB_Primitive& prim, size_t index)
+{
+   if (index >= prim.m_grids.size()) return;
+
+   openvdb::GridBase::Ptr resolved;
+   {
+      tbb::mutex::scoped_lock lock(prim.m_resolveMutex);
+      resolved = prim.m_resolved[index];
+   }
+   // a grid resolved already is shared with its operations applied
+   if (resolved)
+   {
+      InsertGrid(*resolved);
+      return;
+   }
+   const size_t i = InsertGrid(*prim.m_grids[index]);
+   m_pendingOps[i] = prim.m_pendingOps[index];
+}
+
+size_t VDB_Primitive::InsertGrid(const openvdb::GridBase& grid)
+{
    // shallow copy grid, according to openvdb_houdini
-   m_grid = grid.copyGrid();
+   openvdb::GridBase::Ptr copy = grid.copyGrid();
+   AdoptTransform(*copy);
+
+   const std::string& name = copy->getName();
+   if (!name.empty())
+   {
+      for (size_t i=0; i<m_grids.size(); ++i)
+      {
+         if (m_grids[i]->getName() == name)
+         {
+            m_grids[i] = copy;
+            m_pendingOps[i].clear();
+            m_resolved[i].reset();
+            InvalidateStats(i);
+            return i;
+         }
+      }
+   }
+   m_grids.push_back(copy);
+   ResetPendingOps();
+   InvalidateStats(m_grids.size() - 1);
+   return m_grids.size() - 1;
+}
+
+void VDB_Primitive::SetGridAt(size_t index, const openvdb::GridBase& grid)
+{
+   if (index >= m_grids.size()) return;
+   openvdb::GridBase::Ptr copy = grid.copyGrid();
+   AdoptTransform(*copy);
+   m_grids[index] = copy;
+   m_pendingOps[index].clear();
+   m_resolved[index].reset();
+   // the grid no longer matches the files it was read from
+   m_sourceTime = 0;
+   InvalidateStats(index);
 }
 
-XSI::CString VDB_Primitive::GetTypeName() const
+bool VDB_Primitive::AddPendingOp(size_t index, const VDB_VoxelOp::ConstPtr& op)
 {
-   return m_grid ? m_grid->valueType().c_str() : "";
+   if (index >= m_grids.size() || !op) return false;
+   if (!m_grids[index]->isType<openvdb::FloatGrid>()) return false;
+   m_pendingOps[index].push_back(op);
+   m_resolved[index].reset();
+   m_sourceTime = 0;
+   InvalidateStats(index);
+   return true;
 }
 
-openvdb::GridBase::ConstPtr VDB_Primitive::GetConstGridPtr() const
+bool VDB_Primitive::HasPendingOps(size_t index) const
 {
-   return m_grid;
+   return index < m_pendingOps.size() && !m_pendingOps[index].empty();
 }
 
-openvdb::GridBase::Ptr VDB_Primitive::GetGridPtr()
+bool VDB_Primitive::HasUnresolvedOps() const
 {
-   return m_grid;
+   tbb::mutex::scoped_lock lock(m_resolveMutex);
+   for (size_t i=0; i<m_pendingOps.size(); ++i)
+   {
+      if (!m_pendingOps[i].empty() && !m_resolved[i]) return true;
+   }
+   return false;
+}
+
+void VDB_Primitive::ResetPendingOps()
+{
+   m_pendingOps.resize(m_grids.size());
+   m_resolved.resize(m_grids.size());
+}
+
+openvdb::GridBase::Ptr VDB_Primitive::ResolvePendingOps(size_t index) const
+{
+   {
+      tbb::mutex::scoped_lock lock(m_resolveMutex);
+      if (m_resolved[index]) return m_resolved[index];
+   }
+
+   // the operations run in parallel, holding the lock across them could
+   // deadlock with a thread stealing one of their tasks and asking for the
+   // same grid. nodes racing on a grid may both resolve it, the first wins,
+   // so multithreaded nodes resolve their inputs in BeginEvaluate.
+   openvdb::GridBase::Ptr resolved = applyVoxelOps(*m_grids[index], m_pendingOps[index]);
+   {
+      tbb::mutex::scoped_lock lock(m_resolveMutex);
+      if (m_resolved[index]) return m_resolved[index];
+      m_resolved[index] = resolved;
+   }
+
+   // the copy did not exist when the primitive was registered, resolved
+   // grids are deep copies so none of it is shared with the read cache
+   if (m_registryId) VDB_GridRegistry::Get().AddMemUsage(*this, resolved->memUsage());
+   return resolved;
+}
+
+void VDB_Primitive::AdoptTransform(openvdb::GridBase& grid)
+{
+   if (!m_transform)
+   {
+      m_transform = grid.transformPtr();
+   }
+   else if (grid.transform() == *m_transform)
+   {
+      // equivalent transforms are stored once for the whole primitive
+      grid.setTransform(m_transform);
+   }
+}
+
+size_t VDB_Primitive::GetGridCount() const
+{
+   return m_grids.size();
+}
+
+int VDB_Primitive::FindGridIndex(const std::string& name) const
+{
+   if (m_grids.empty()) return -1;
+   if (name.empty()) return 0;
+   for (size_t i=0; i<m_grids.size(); ++i)
+   {
+      if (m_grids[i]->getName() == name) return int(i);
+   }
+   return -1;
+}
+
+std::vector<std::string> VDB_Primitive::GetGridNames() const
+{
+   std::vector<std::string> names;
+   names.reserve(m_grids.size());
+   for (size_t i=0; i<m_grids.size(); ++i)
+   {
+      names.push_back(m_grids[i]->getName());
+   }
+   return names;
+}
+
+XSI::CString VDB_Primitive::GetTypeName(size_t index) const
+{
+   return index < m_grids.size() ? m_grids[index]->valueType().c_str() : "";
+}
+
+openvdb::GridBase::ConstPtr VDB_Primitive::GetConstGridPtr(size_t index) const
+{
+   if (index >= m_grids.size()) return openvdb::GridBase::ConstPtr();
+   if (m_pendingOps[index].empty()) return m_grids[index];
+   return ResolvePendingOps(index);
+}
+
+openvdb::GridBase::ConstPtr VDB_Primitive::GetBaseGridPtr(size_t index) const
+{
+   if (index >= m_grids.size()) return openvdb::GridBase::ConstPtr();
+   return m_grids[index];
+}
+
+openvdb::GridCPtrVec VDB_Primitive::GetConstGrids() const
+{
+   openvdb::GridCPtrVec grids;
+   grids.reserve(m_grids.size());
+   for (size_t i=0; i<m_grids.size(); ++i)
+   {
+      grids.push_back(GetConstGridPtr(i));
+   }
+   return grids;
+}
+
+openvdb::math::Transform::ConstPtr VDB_Primitive::GetTransformPtr() const
+{
+   return m_transform;
+}
+
+const openvdb::MetaMap& VDB_Primitive::GetMetadata() const
+{
+   return m_metadata;
+}
+
+openvdb::MetaMap& VDB_Primitive::GetMetadata()
+{
+   return m_metadata;
+}
+
+openvdb::Index64 VDB_Primitive::GetMemUsage() const
+{
+   return MemUsage(false);
+}
+
+openvdb::Index64 VDB_Primitive::GetUncachedMemUsage() const
+{
+   return MemUsage(true);
+}
+
+openvdb::Index64 VDB_Primitive::MemUsage(bool skipReadCache) const
+{
+   VDB_ReadCache& cache = VDB_ReadCache::Get();
+   openvdb::Index64 memUsage = 0;
+   for (size_t i=0; i<m_grids.size(); ++i)
+   {
+      if (skipReadCache && cache.IsCached(m_grids[i]->constBaseTreePtr().get())) continue;
+      memUsage += m_grids[i]->memUsage();
+   }
+   // pending operations are not resolved just to be measured
+   tbb::mutex::scoped_lock lock(m_resolveMutex);
+   for (size_t i=0; i<m_resolved.size(); ++i)
+   {
+      if (m_resolved[i]) memUsage += m_resolved[i]->memUsage();
+   }
+   return memUsage;
+}
+
+bool VDB_Primitive::HasSharedTrees() const
+{
+   for (size_t i=0; i<m_grids.size(); ++i)
+   {
+      if (isShared(m_grids[i])) return true;
+   }
+   tbb::mutex::scoped_lock lock(m_resolveMutex);
+   for (size_t i=0; i<m_resolved.size(); ++i)
+   {
+      if (m_resolved[i] && isShared(m_resolved[i])) return true;
+   }
+   return false;
+}
+
+std::time_t VDB_Primitive::GetSourceTime() const
+{
+   return m_sourceTime;
+}
+
+void VDB_Primitive::SetSourceTime(std::time_t time)
+{
+   m_sourceTime = time;
+}
+
+VDB_GridStats VDB_Primitive::GetStats(size_t index) const
+{
+   static const VDB_GridStats emptyStats = { openvdb::CoordBBox(), 0, 0, false, 0.0, 0.0 };
+   if (index >= m_grids.size()) return emptyStats;
+
+   unsigned generation;
+   {
+      tbb::mutex::scoped_lock lock(m_statsMutex);
+      if (m_stats.size() != m_grids.size())
+      {
+         m_stats.resize(m_grids.size());
+         m_statsValid.resize(m_grids.size(), false);
+      }
+      if (m_statsValid[index]) return m_stats[index];
+      generation = m_statsGeneration;
+   }
+
+   // computed without the lock, the traversals run as tbb tasks and a
+   // worker waiting on them may pick up a task asking for the same stats
+   VDB_GridStats stats = emptyStats;
+   const openvdb::GridBase::ConstPtr gridPtr = GetConstGridPtr(index);
+   const openvdb::GridBase* grid = gridPtr.get();
+
+   // each statistic is a separate traversal of the tree, run them side by side
+   BBoxTask bboxTask = { grid, &stats };
+   VoxelCountTask voxelCountTask = { grid, &stats };
+   MemUsageTask memUsageTask = { grid, &stats };
+   ValueRangeTask valueRangeTask = { grid, &stats };
+
+   tbb::task_group tasks;
+   tasks.run(bboxTask);
+   tasks.run(voxelCountTask);
+   tasks.run(memUsageTask);
+   tasks.run(valueRangeTask);
+   tasks.wait();
+
+   tbb::mutex::scoped_lock lock(m_statsMutex);
+   if (generation == m_statsGeneration && index < m_stats.size())
+   {
+      m_stats[index] = stats;
+      m_statsValid[index] = true;
+   }
+   return stats;
+}
+
+void VDB_Primitive::InvalidateStats()
+{
+   tbb::mutex::scoped_lock lock(m_statsMutex);
+   ++m_statsGeneration;
+   m_statsValid.assign(m_grids.size(), false);
+   m_stats.resize(m_grids.size());
+}
+
+void VDB_Primitive::InvalidateStats(size_t index)
+{
+   tbb::mutex::scoped_lock lock(m_statsMutex);
+   ++m_statsGeneration;
+   m_statsValid.resize(m_grids.size(), false);
+   m_stats.resize(m_grids.size());
+   if (index < m_statsValid.size()) m_statsValid[index] = false;
+}
+
+bool VDB_Primitive::WriteToFile(const std::string& path) const
+{
+   if (m_grids.empty()) return false;
+
+   try
+   {
+      openvdb::MetaMap meta(m_metadata);
+      meta.insertMeta(kSourceTimeMeta, openvdb::Int64Metadata(openvdb::Int64(m_sourceTime)));
+
+      openvdb::io::File file(path);
+      file.write(GetConstGrids(), meta);
+      file.close();
+   }
+   catch (openvdb::Exception& e)
+   {
+      XSI::Application().LogMessage(L"[VDB_Primitive] " + XSI::CString(e.what()), XSI::siErrorMsg);
+      return false;
+   }
+   return true;
+}
+
+VDB_Primitive::Ptr VDB_Primitive::ReadFromFile(const std::string& path)
+{
+   openvdb::GridPtrVecPtr grids;
+   openvdb::MetaMap::Ptr meta;
+   try
+   {
+      openvdb::io::File file(path);
+      file.open();
+      grids = file.getGrids();
+      meta = file.getMetadata();
+      file.close();
+   }
+   catch (openvdb::Exception& e)
+   {
+      XSI::Application().LogMessage(L"[VDB_Primitive] " + XSI::CString(e.what()), XSI::siErrorMsg);
+      return Ptr();
+   }
+   if (!grids || grids->empty()) return Ptr();
+
+   Ptr prim(new VDB_Primitive());
+   for (size_t i=0; i<grids->size(); ++i)
+   {
+      if ((*grids)[i]) prim->AddGrid(*(*grids)[i]);
+   }
+   if (meta)
+   {
+      openvdb::Int64Metadata::ConstPtr sourceTime = meta->getMetadata<openvdb::Int64Metadata>(kSourceTimeMeta);
+      if (sourceTime) prim->m_sourceTime = std::time_t(sourceTime->value());
+      meta->removeMeta(kSourceTimeMeta);
+      prim->m_metadata = *meta;
+   }
+   return prim;
 }
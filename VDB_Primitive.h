@@ -5,24 +5,140 @@
 #ifndef VDB_PRIMITIVE_H
 #define VDB_PRIMITIVE_H
 
+#include <string>
+#include <vector>
+#include <ctime>
+
 #include <xsi_string.h>
 
+#include <boost/shared_ptr.hpp>
+
+#include <tbb/mutex.h>
+
 #include <openvdb/openvdb.h>
 
+#include "VDB_VoxelOp.h"
+
+// statistics of a grid, vector grids report the range of their magnitude
+struct VDB_GridStats
+{
+   openvdb::CoordBBox bbox;
+   openvdb::Index64 activeVoxelCount;
+   openvdb::Index64 memUsage;
+   bool hasValueRange;
+   double minValue;
+   double maxValue;
+};
+
+// primitives are owned by VDB_GridRegistry, ICE only sees a VDB_Handle.
+// a registered primitive is never modified, nodes create a new one instead.
+// a primitive holds a named set of grids (density, temperature, velocity...)
+// sharing one transform and one set of metadata, so a whole volume travels
+// through the graph as a single handle.
+// grids can carry pending per voxel operations, they are applied to a copy
+// of the grid the first time its values are requested and the result is
+// cached with the primitive.
 class VDB_Primitive
 {
 public:
+   typedef boost::shared_ptr<VDB_Primitive> Ptr;
+   typedef boost::shared_ptr<const VDB_Primitive> ConstPtr;
+
    VDB_Primitive();
    ~VDB_Primitive();
 
+   // new primitive sharing the grids and transform of this one
+   Ptr ShallowCopy() const;
+
+   // replaces all grids with the given one
    void SetGrid(const openvdb::GridBase& grid);
-   XSI::CString GetTypeName() const;
+   // replaces the grid with the same name or appends it, the grid adopts
+   // the shared transform when it is equivalent
+   void AddGrid(const openvdb::GridBase& grid);
+   // same as AddGrid() with the grid at the given index of another
+   // primitive, its pending operations are shared instead of resolved
+   void AddGridFrom(const VDB_Primitive& prim, size_t index);
+   void SetGridAt(size_t index, const openvdb::GridBase& grid);
+
+   // defers the operation on the float grid at the given index, it runs
+   // together with the other pending operations of the grid in one pass
+   bool AddPendingOp(size_t index, const VDB_VoxelOp::ConstPtr& op);
+   bool HasPendingOps(size_t index = 0) const;
+   // true when a grid still has operations that were not applied yet
+   bool HasUnresolvedOps() const;
+
+   size_t GetGridCount() const;
+   // index of the grid with the given name, an empty name selects the first
+   // grid, returns -1 when there is no such grid
+   int FindGridIndex(const std::string& name) const;
+   std::vector<std::string> GetGridNames() const;
+
+   XSI::CString GetTypeName(size_t index = 0) const;
    
-   openvdb::GridBase::ConstPtr GetConstGridPtr() const;
-   openvdb::GridBase::Ptr GetGridPtr();
+   // the pending operations are applied before returning the grid
+   openvdb::GridBase::ConstPtr GetConstGridPtr(size_t index = 0) const;
+   // grid the pending operations apply to, for nodes adding another one
+   openvdb::GridBase::ConstPtr GetBaseGridPtr(size_t index = 0) const;
+   openvdb::GridCPtrVec GetConstGrids() const;
+
+   openvdb::math::Transform::ConstPtr GetTransformPtr() const;
+   const openvdb::MetaMap& GetMetadata() const;
+   openvdb::MetaMap& GetMetadata();
+
+   openvdb::Index64 GetMemUsage() const;
+   // leaves out the trees shared with VDB_ReadCache, the cache accounts for
+   // them already
+   openvdb::Index64 GetUncachedMemUsage() const;
+   // true when a grid or tree of the primitive is also referenced from
+   // elsewhere (another primitive, the read cache, the write queue), freeing
+   // the primitive would not release that memory
+   bool HasSharedTrees() const;
+
+   // modification time of the newest file the grids were read from, zero
+   // when they were not read from a file. nodes deriving a primitive from
+   // others carry the newest of their source times, SetGrid(), SetGridAt()
+   // and AddPendingOp() reset it since the grids are generated from then on.
+   std::time_t GetSourceTime() const;
+   void SetSourceTime(std::time_t time);
+
+   // computed in parallel on the first request and cached with the grid,
+   // call InvalidateStats() after modifying a grid in place
+   VDB_GridStats GetStats(size_t index = 0) const;
+   void InvalidateStats();
+   void InvalidateStats(size_t index);
+
+   // used by the registry to spill primitives that exceed the memory budget
+   bool WriteToFile(const std::string& path) const;
+   static Ptr ReadFromFile(const std::string& path);
 
 private:
-   openvdb::GridBase::Ptr  m_grid;
+   // the registry stores the id of the entry holding the primitive
+   friend class VDB_GridRegistry;
+
+   void AdoptTransform(openvdb::GridBase& grid);
+   // AddGrid() returning the index the grid was stored at
+   size_t InsertGrid(const openvdb::GridBase& grid);
+   openvdb::Index64 MemUsage(bool skipReadCache) const;
+   void ResetPendingOps();
+   openvdb::GridBase::Ptr ResolvePendingOps(size_t index) const;
+
+   std::vector<openvdb::GridBase::Ptr>  m_grids;
+   openvdb::math::Transform::Ptr        m_transform;
+   openvdb::MetaMap                     m_metadata;
+   std::time_t                          m_sourceTime;
+
+   std::vector<VDB_VoxelOpList>         m_pendingOps;
+   mutable tbb::mutex                   m_resolveMutex;
+   mutable std::vector<openvdb::GridBase::Ptr> m_resolved;
+
+   mutable tbb::mutex                   m_statsMutex;
+   mutable std::vector<bool>            m_statsValid;
+   mutable std::vector<VDB_GridStats>   m_stats;
+   // bumped on invalidation, stats computed meanwhile are not published
+   unsigned                             m_statsGeneration;
+
+   // zero until the primitive is registered
+   ULONG                                m_registryId;
 };
 
 #endif
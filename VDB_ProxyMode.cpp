@@ -0,0 +1,206 @@
+// OpenVDB_Softimage
+// VDB_ProxyMode.cpp
+// session wide proxy resolution for interactive look development
+
+#include <xsi_application.h>
+#include <xsi_context.h>
+#include <xsi_status.h>
+#include <xsi_argument.h>
+#include <xsi_command.h>
+#include <xsi_value.h>
+#include <xsi_valuearray.h>
+#include <xsi_parameter.h>
+
+#include <vector>
+
+#include "VDB_ProxyMode.h"
+
+using namespace XSI;
+
+VDB_ProxyMode& VDB_ProxyMode::Get()
+{
+   static VDB_ProxyMode proxyMode;
+   return proxyMode;
+}
+
+VDB_ProxyMode::VDB_ProxyMode()
+   : m_enabled(false)
+   , m_factor(4.0f)
+   , m_idleDelay(1.0)
+   , m_fullResolutionDepth(0)
+   , m_refinePending(false)
+   , m_lastInteraction(tbb::tick_count::now())
+{
+}
+
+void VDB_ProxyMode::SetEnabled(bool enabled)
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   m_enabled = enabled;
+   if (!enabled) m_refinePending = false;
+}
+
+bool VDB_ProxyMode::IsEnabled() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_enabled;
+}
+
+void VDB_ProxyMode::SetFactor(float factor)
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   m_factor = factor < 1.0f ? 1.0f : factor;
+}
+
+float VDB_ProxyMode::GetFactor() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_factor;
+}
+
+void VDB_ProxyMode::SetIdleDelay(double seconds)
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   m_idleDelay = seconds < 0.0 ? 0.0 : seconds;
+}
+
+double VDB_ProxyMode::GetIdleDelay() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_idleDelay;
+}
+
+float VDB_ProxyMode::AcquireVoxelScale()
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   if (!m_enabled || m_fullResolutionDepth > 0 || m_factor <= 1.0f) return 1.0f;
+   m_lastInteraction = tbb::tick_count::now();
+   m_refinePending = true;
+   return m_factor;
+}
+
+void VDB_ProxyMode::SetNodeScale(const void* node, const CRef& refineParam, float scale)
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   if (scale != 1.0f) m_proxyNodes[node] = refineParam;
+   else m_proxyNodes.erase(node);
+}
+
+void VDB_ProxyMode::RemoveNode(const void* node)
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   m_proxyNodes.erase(node);
+}
+
+void VDB_ProxyMode::RefineProxyNodes()
+{
+   std::vector<CRef> params;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      for (std::map<const void*, CRef>::const_iterator it = m_proxyNodes.begin(); it != m_proxyNodes.end(); ++it)
+      {
+         params.push_back(it->second);
+      }
+      m_proxyNodes.clear();
+   }
+
+   // refreshing the viewport leaves clean ICE trees alone. the refine
+   // generation is an internal port no user value depends on, and it is
+   // set through the object model so no undo event is recorded.
+   for (size_t i=0; i<params.size(); ++i)
+   {
+      Parameter param(params[i]);
+      if (!param.IsValid()) continue;
+      param.PutValue(CValue(LONG(param.GetValue()) + 1));
+   }
+}
+
+bool VDB_ProxyMode::ShouldRefine()
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   if (!m_enabled || !m_refinePending) return false;
+   if ((tbb::tick_count::now() - m_lastInteraction).seconds() < m_idleDelay) return false;
+   m_refinePending = false;
+   return true;
+}
+
+void VDB_ProxyMode::BeginFullResolution()
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   ++m_fullResolutionDepth;
+}
+
+void VDB_ProxyMode::EndFullResolution()
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   if (m_fullResolutionDepth > 0) --m_fullResolutionDepth;
+}
+
+SICALLBACK openvdb_proxyMode_Init (CRef& ref)
+{
+   Context ctxt(ref);
+   Command oCmd;
+   oCmd = ctxt.GetSource();
+   oCmd.PutDescription(L"report and configure the proxy resolution used while interacting");
+   oCmd.EnableReturnValue(true);
+
+   ArgumentArray oArgs;
+   oArgs = oCmd.GetArguments();
+   // negative values leave the setting untouched
+   oArgs.Add(L"enabled", -1l);
+   oArgs.Add(L"factor", -1.0);
+   oArgs.Add(L"idleDelay", -1.0);
+   return CStatus::OK;
+}
+
+SICALLBACK openvdb_proxyMode_Execute (CRef& ref)
+{
+   Context ctxt(ref);
+   CValueArray args = ctxt.GetAttribute(L"Arguments");
+   LONG enabled = args[0];
+   double factor = args[1];
+   double idleDelay = args[2];
+
+   VDB_ProxyMode& proxyMode = VDB_ProxyMode::Get();
+   if (factor >= 0.0) proxyMode.SetFactor(float(factor));
+   if (idleDelay >= 0.0) proxyMode.SetIdleDelay(idleDelay);
+   if (enabled >= 0) proxyMode.SetEnabled(enabled != 0);
+
+   Application().LogMessage(CString(proxyMode.IsEnabled() ? L"proxy mode on" : L"proxy mode off")
+      + L"\tfactor " + CValue(proxyMode.GetFactor()).GetAsText()
+      + L"\tidle delay " + CValue(proxyMode.GetIdleDelay()).GetAsText() + L"s");
+
+   ctxt.PutAttribute(L"ReturnValue", proxyMode.IsEnabled());
+   return CStatus::OK;
+}
+
+// polls for the end of the interaction and has the nodes holding proxy
+// grids evaluate again at full resolution
+SICALLBACK openvdb_proxyIdle_OnEvent (CRef& ref)
+{
+   VDB_ProxyMode& proxyMode = VDB_ProxyMode::Get();
+   if (proxyMode.ShouldRefine())
+   {
+      Application().LogMessage(L"[VDB_ProxyMode] evaluating at full resolution");
+      proxyMode.RefineProxyNodes();
+   }
+   // the return value of timer events is ignored
+   return CStatus::OK;
+}
+
+// frames always render at full resolution, trees left clean with proxy
+// grids are refined so the render does not reuse them
+SICALLBACK openvdb_proxyBeginFrame_OnEvent (CRef& ref)
+{
+   VDB_ProxyMode& proxyMode = VDB_ProxyMode::Get();
+   proxyMode.BeginFullResolution();
+   proxyMode.RefineProxyNodes();
+   // false lets the render go on
+   return CStatus::False;
+}
+
+SICALLBACK openvdb_proxyEndFrame_OnEvent (CRef& ref)
+{
+   VDB_ProxyMode::Get().EndFullResolution();
+   return CStatus::False;
+}
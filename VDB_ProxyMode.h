@@ -0,0 +1,69 @@
+// OpenVDB_Softimage
+// VDB_ProxyMode.h
+// session wide proxy resolution for interactive look development. while the
+// mode is on, nodes creating grids scale their voxel size by a factor so the
+// whole VDB chain runs on a coarse grid. once the user stops interacting for
+// the idle delay, or when a frame renders, the nodes that built proxy grids
+// get their refine generation port bumped and evaluate at full resolution.
+
+#ifndef VDB_PROXYMODE_H
+#define VDB_PROXYMODE_H
+
+#include <map>
+
+#include <xsi_ref.h>
+
+#include <tbb/mutex.h>
+#include <tbb/tick_count.h>
+
+// primitive metadata holding the factor a proxy grid was built with
+static const char* const kProxyFactorMeta = "softimage_proxy_factor";
+
+class VDB_ProxyMode
+{
+public:
+   static VDB_ProxyMode& Get();
+
+   void SetEnabled(bool enabled);
+   bool IsEnabled() const;
+   // voxel size multiplier of the proxy grids, at least one
+   void SetFactor(float factor);
+   float GetFactor() const;
+   // seconds without interaction before the full resolution evaluation
+   void SetIdleDelay(double seconds);
+   double GetIdleDelay() const;
+
+   // voxel size scale for a node evaluating now, one at full resolution.
+   // an evaluation at proxy resolution counts as an interaction.
+   float AcquireVoxelScale();
+   // records whether the node built its output at proxy resolution.
+   // refineParam is the internal refine generation port of the node.
+   void SetNodeScale(const void* node, const XSI::CRef& refineParam, float scale);
+   // called when the node is deleted
+   void RemoveNode(const void* node);
+   // bumps the refine generation of the nodes holding proxy grids, a node
+   // seeing a new generation evaluates at full resolution
+   void RefineProxyNodes();
+
+   // polled by the idle timer, true once when the last proxy evaluation is
+   // older than the idle delay
+   bool ShouldRefine();
+
+   // nested scopes evaluating at full resolution, e.g. while rendering
+   void BeginFullResolution();
+   void EndFullResolution();
+
+private:
+   VDB_ProxyMode();
+
+   mutable tbb::mutex m_mutex;
+   bool m_enabled;
+   float m_factor;
+   double m_idleDelay;
+   int m_fullResolutionDepth;
+   bool m_refinePending;
+   tbb::tick_count m_lastInteraction;
+   std::map<const void*, XSI::CRef> m_proxyNodes;
+};
+
+#endif
@@ -0,0 +1,268 @@
+// OpenVDB_Softimage
+// VDB_ReadCache.cpp
+// process wide cache of the grids read from .vdb files
+
+#include <xsi_application.h>
+
+#include "VDB_ReadCache.h"
+#include "VDB_Utils.h"
+
+// room for a couple of frames of a production sized volume
+static const openvdb::Index64 kDefaultBudget = openvdb::Index64(2048) << 20;
+
+bool VDB_ReadCache::Key::operator<(const Key& other) const
+{
+   if (path != other.path) return path < other.path;
+   if (gridName != other.gridName) return gridName < other.gridName;
+   if (modTime != other.modTime) return modTime < other.modTime;
+   return delayLoad < other.delayLoad;
+}
+
+VDB_ReadCache& VDB_ReadCache::Get()
+{
+   static VDB_ReadCache cache;
+   return cache;
+}
+
+VDB_ReadCache::VDB_ReadCache()
+   : m_memUsage(0)
+   , m_memBudget(kDefaultBudget)
+   , m_clock(0)
+   , m_hits(0)
+   , m_misses(0)
+{
+}
+
+openvdb::GridBase::ConstPtr VDB_ReadCache::GetGrid(const std::string& path, const std::string& gridName, bool delayLoad)
+{
+   Key key;
+   key.path = path;
+   key.gridName = gridName;
+   key.delayLoad = delayLoad;
+   key.modTime = 0;
+   if (!fileModTime(path, key.modTime)) return openvdb::GridBase::ConstPtr();
+
+   openvdb::GridBase::ConstPtr cached;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      EntryMap::iterator it = m_entries.find(key);
+      if (it != m_entries.end())
+      {
+         it->second.lastAccess = ++m_clock;
+         ++m_hits;
+         cached = it->second.grid;
+      }
+      else ++m_misses;
+   }
+   if (cached)
+   {
+      if (delayLoad) Remeasure(key, cached);
+      return cached;
+   }
+   Purge(path, key.modTime);
+
+   // read outside of the lock, other grids keep being served meanwhile
+   openvdb::GridBase::ConstPtr grid;
+   try
+   {
+      openvdb::io::File file(path);
+      file.open(delayLoad);
+      if (file.hasGrid(gridName)) grid = file.readGrid(gridName);
+      file.close();
+   }
+   catch (openvdb::Exception& e)
+   {
+      XSI::Application().LogMessage(L"[VDB_ReadCache] " + XSI::CString(e.what()) + L" : " + XSI::CString(path.c_str()), XSI::siErrorMsg);
+      return grid;
+   }
+   if (!grid) return grid;
+
+   Entry entry;
+   entry.grid = grid;
+   entry.memUsage = grid->memUsage();
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      // another thread may have read the same grid in the meantime
+      EntryMap::iterator it = m_entries.find(key);
+      if (it != m_entries.end()) return it->second.grid;
+
+      entry.lastAccess = ++m_clock;
+      m_entries[key] = entry;
+      m_trees.insert(grid->constBaseTreePtr().get());
+      m_memUsage += entry.memUsage;
+   }
+
+   EnforceBudget();
+   return grid;
+}
+
+void VDB_ReadCache::Remeasure(const Key& key, const openvdb::GridBase::ConstPtr& grid)
+{
+   // walking the tree takes a while, the other readers are not blocked
+   const openvdb::Index64 memUsage = grid->memUsage();
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      EntryMap::iterator it = m_entries.find(key);
+      if (it == m_entries.end() || it->second.grid != grid) return;
+      m_memUsage += memUsage - it->second.memUsage;
+      it->second.memUsage = memUsage;
+   }
+   EnforceBudget();
+}
+
+bool VDB_ReadCache::GetFileInfo(const std::string& path, std::vector<std::string>& gridNames, openvdb::MetaMap::ConstPtr& meta)
+{
+   std::time_t modTime = 0;
+   if (!fileModTime(path, modTime)) return false;
+
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      FileInfoMap::const_iterator it = m_files.find(path);
+      if (it != m_files.end() && it->second.modTime == modTime)
+      {
+         gridNames = it->second.gridNames;
+         meta = it->second.meta;
+         return true;
+      }
+   }
+   Purge(path, modTime);
+
+   FileInfo info;
+   info.modTime = modTime;
+   try
+   {
+      // with delayed loading opening the file only reads the header
+      openvdb::io::File file(path);
+      file.open(true);
+      for (openvdb::io::File::NameIterator nameIt = file.beginName(); nameIt != file.endName(); ++nameIt)
+      {
+         info.gridNames.push_back(nameIt.gridName());
+      }
+      info.meta = file.getMetadata();
+      file.close();
+   }
+   catch (openvdb::Exception& e)
+   {
+      XSI::Application().LogMessage(L"[VDB_ReadCache] " + XSI::CString(e.what()) + L" : " + XSI::CString(path.c_str()), XSI::siErrorMsg);
+      return false;
+   }
+   if (!info.meta) info.meta.reset(new openvdb::MetaMap());
+
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      m_files[path] = info;
+   }
+   gridNames = info.gridNames;
+   meta = info.meta;
+   return true;
+}
+
+void VDB_ReadCache::Purge(const std::string& path, std::time_t modTime)
+{
+   // freeing the grids can take a while, do it outside of the lock
+   std::vector<openvdb::GridBase::ConstPtr> released;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      Key first;
+      first.path = path;
+      first.modTime = 0;
+      first.delayLoad = false;
+      EntryMap::iterator it = m_entries.lower_bound(first);
+      while (it != m_entries.end() && it->first.path == path)
+      {
+         if (it->first.modTime == modTime)
+         {
+            ++it;
+            continue;
+         }
+         released.push_back(it->second.grid);
+         m_trees.erase(it->second.grid->constBaseTreePtr().get());
+         m_memUsage -= it->second.memUsage;
+         m_entries.erase(it++);
+      }
+
+      FileInfoMap::iterator fileIt = m_files.find(path);
+      if (fileIt != m_files.end() && fileIt->second.modTime != modTime) m_files.erase(fileIt);
+   }
+}
+
+void VDB_ReadCache::EnforceBudget()
+{
+   // declared first so the grids are freed after the lock is released
+   std::vector<openvdb::GridBase::ConstPtr> released;
+   tbb::mutex::scoped_lock lock(m_mutex);
+
+   while (m_memBudget && m_memUsage > m_memBudget && !m_entries.empty())
+   {
+      EntryMap::iterator victim = m_entries.begin();
+      for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+      {
+         if (it->second.lastAccess < victim->second.lastAccess) victim = it;
+      }
+      // consumers still holding the grid keep it alive, the cache only
+      // gives up its own reference
+      released.push_back(victim->second.grid);
+      m_trees.erase(victim->second.grid->constBaseTreePtr().get());
+      m_memUsage -= victim->second.memUsage;
+      m_entries.erase(victim);
+   }
+}
+
+bool VDB_ReadCache::IsCached(const openvdb::TreeBase* tree) const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_trees.count(tree) != 0;
+}
+
+size_t VDB_ReadCache::GetCount() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_entries.size();
+}
+
+openvdb::Index64 VDB_ReadCache::GetMemUsage() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_memUsage;
+}
+
+openvdb::Index64 VDB_ReadCache::GetHits() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_hits;
+}
+
+openvdb::Index64 VDB_ReadCache::GetMisses() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_misses;
+}
+
+void VDB_ReadCache::SetMemoryBudget(openvdb::Index64 bytes)
+{
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      m_memBudget = bytes;
+   }
+   EnforceBudget();
+}
+
+openvdb::Index64 VDB_ReadCache::GetMemoryBudget() const
+{
+   tbb::mutex::scoped_lock lock(m_mutex);
+   return m_memBudget;
+}
+
+void VDB_ReadCache::Clear()
+{
+   EntryMap released;
+   {
+      tbb::mutex::scoped_lock lock(m_mutex);
+      released.swap(m_entries);
+      m_trees.clear();
+      m_files.clear();
+      m_memUsage = 0;
+      m_hits = 0;
+      m_misses = 0;
+   }
+}
@@ -0,0 +1,97 @@
+// OpenVDB_Softimage
+// VDB_ReadCache.h
+// process wide cache of the grids read from .vdb files, keyed by path, grid
+// name and file modification time. every reader shares the same immutable
+// grids, scrubbing over frames already visited does not touch the disk.
+// the least recently used grids are dropped when the cache exceeds its
+// memory budget.
+
+#ifndef VDB_READCACHE_H
+#define VDB_READCACHE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <ctime>
+
+#include <tbb/mutex.h>
+
+#include <openvdb/openvdb.h>
+
+class VDB_ReadCache
+{
+public:
+   static VDB_ReadCache& Get();
+
+   // returns the named grid of the file, read from disk only when it is not
+   // cached yet or the file changed since. the grid is shared, never modify it.
+   openvdb::GridBase::ConstPtr GetGrid(const std::string& path, const std::string& gridName, bool delayLoad = false);
+
+   // names of the grids in the file and the file metadata, read from the header
+   bool GetFileInfo(const std::string& path, std::vector<std::string>& gridNames, openvdb::MetaMap::ConstPtr& meta);
+
+   // true when the tree belongs to one of the cached grids
+   bool IsCached(const openvdb::TreeBase* tree) const;
+
+   size_t GetCount() const;
+   openvdb::Index64 GetMemUsage() const;
+   openvdb::Index64 GetHits() const;
+   openvdb::Index64 GetMisses() const;
+
+   // zero means unlimited
+   void SetMemoryBudget(openvdb::Index64 bytes);
+   openvdb::Index64 GetMemoryBudget() const;
+
+   void Clear();
+
+private:
+   VDB_ReadCache();
+
+   // drops the entries of older versions of the file
+   void Purge(const std::string& path, std::time_t modTime);
+   void EnforceBudget();
+
+   struct Key
+   {
+      std::string path;
+      std::string gridName;
+      std::time_t modTime;
+      bool delayLoad;
+
+      bool operator<(const Key& other) const;
+   };
+
+   struct Entry
+   {
+      openvdb::GridBase::ConstPtr grid;
+      openvdb::Index64 memUsage;
+      openvdb::Index64 lastAccess;
+   };
+   typedef std::map<Key, Entry> EntryMap;
+
+   // grids with delayed loading grow as their voxels are touched, they are
+   // measured again when they are accessed
+   void Remeasure(const Key& key, const openvdb::GridBase::ConstPtr& grid);
+
+   struct FileInfo
+   {
+      std::time_t modTime;
+      std::vector<std::string> gridNames;
+      openvdb::MetaMap::ConstPtr meta;
+   };
+   typedef std::map<std::string, FileInfo> FileInfoMap;
+
+   mutable tbb::mutex m_mutex;
+   EntryMap m_entries;
+   // trees of the cached grids, for IsCached()
+   std::set<const openvdb::TreeBase*> m_trees;
+   FileInfoMap m_files;
+   openvdb::Index64 m_memUsage;
+   openvdb::Index64 m_memBudget;
+   openvdb::Index64 m_clock;
+   openvdb::Index64 m_hits;
+   openvdb::Index64 m_misses;
+};
+
+#endif
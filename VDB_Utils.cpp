@@ -2,6 +2,19 @@
 // VDB_Utils.cpp
 // utilties use to help logging VDB related data
 
+#include <cstdlib>
+#include <cctype>
+#include <iomanip>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#include <fnmatch.h>
+#endif
+
 #include "VDB_Utils.h"
 
 std::string bkgdValueAsString (const openvdb::GridBase::ConstPtr& grid)
@@ -56,6 +69,188 @@ std::string coordAsString (const openvdb::Coord ijk, const std::string& sep)
    return ostr.str();
 }
 
+std::vector<std::string> splitGridNames (const std::string& names)
+{
+   std::vector<std::string> result;
+   std::string name;
+   for (size_t i = 0; i <= names.size(); ++i) {
+      const char c = i < names.size() ? names[i] : ' ';
+      if (c == ' ' || c == ',' || c == '\t') {
+         if (!name.empty()) result.push_back(name);
+         name.clear();
+      } else {
+         name += c;
+      }
+   }
+   return result;
+}
+
+bool fileModTime (const std::string& path, std::time_t& mtime)
+{
+   struct stat info;
+   if (stat(path.c_str(), &info) != 0) return false;
+   mtime = info.st_mtime;
+   return true;
+}
+
+bool fileSize (const std::string& path, openvdb::Index64& size)
+{
+   struct stat info;
+   if (stat(path.c_str(), &info) != 0) return false;
+   size = openvdb::Index64(info.st_size);
+   return true;
+}
+
+openvdb::Index32 compressionFlags (int codec)
+{
+   switch (codec) {
+      case kCodecNone:
+         return openvdb::io::COMPRESS_NONE;
+      case kCodecBlosc:
+#if OPENVDB_LIBRARY_MAJOR_VERSION >= 3
+         if (openvdb::io::hasBloscCompression()) {
+            return openvdb::io::COMPRESS_BLOSC | openvdb::io::COMPRESS_ACTIVE_MASK;
+         }
+#endif
+         return openvdb::io::COMPRESS_ZIP | openvdb::io::COMPRESS_ACTIVE_MASK;
+      default:
+         return openvdb::io::COMPRESS_ZIP | openvdb::io::COMPRESS_ACTIVE_MASK;
+   }
+}
+
+openvdb::GridCPtrVec gridsWithHalfFlags (const openvdb::GridCPtrVec& grids, bool halfScalars, bool halfVectors)
+{
+   openvdb::GridCPtrVec result;
+   result.reserve(grids.size());
+   for (openvdb::GridCPtrVec::const_iterator it = grids.begin(); it != grids.end(); ++it) {
+      const openvdb::GridBase::ConstPtr& grid = *it;
+      if (!grid) continue;
+
+      bool half = grid->saveFloatAsHalf();
+      if (grid->isType<openvdb::FloatGrid>() || grid->isType<openvdb::DoubleGrid>()) {
+         half = halfScalars;
+      } else if (grid->isType<openvdb::Vec3SGrid>() || grid->isType<openvdb::Vec3DGrid>()) {
+         half = halfVectors;
+      }
+      if (half == grid->saveFloatAsHalf()) {
+         result.push_back(grid);
+         continue;
+      }
+      // the flag lives in the grid metadata, the tree itself is shared
+      openvdb::GridBase::Ptr copy = grid->copyGrid();
+      copy->setSaveFloatAsHalf(half);
+      result.push_back(copy);
+   }
+   return result;
+}
+
+std::string tempFilePath (const std::string& filename)
+{
+   const char* dir = std::getenv("TEMP");
+   if (!dir) dir = std::getenv("TMPDIR");
+#ifdef _WIN32
+   if (!dir) dir = ".";
+   return std::string(dir) + "\\" + filename;
+#else
+   if (!dir) dir = "/tmp";
+   return std::string(dir) + "/" + filename;
+#endif
+}
+
+std::vector<std::string> listFiles (const std::string& pattern)
+{
+   std::vector<std::string> result;
+   std::string glob = pattern;
+
+   struct stat info;
+   if (stat(pattern.c_str(), &info) == 0) {
+      if (!(info.st_mode & S_IFDIR)) {
+         result.push_back(pattern);
+         return result;
+      }
+#ifdef _WIN32
+      glob = pattern + "\\*.vdb";
+#else
+      glob = pattern + "/*.vdb";
+#endif
+   }
+   if (glob.find_first_of("*?") == std::string::npos) return result;
+
+   // wildcards are only supported in the file name
+   const size_t sepPos = glob.find_last_of("/\\");
+   const std::string dir = sepPos == std::string::npos ? "" : glob.substr(0, sepPos + 1);
+
+#ifdef _WIN32
+   struct _finddata_t data;
+   intptr_t handle = _findfirst(glob.c_str(), &data);
+   if (handle != -1) {
+      do {
+         if (!(data.attrib & _A_SUBDIR)) result.push_back(dir + data.name);
+      } while (_findnext(handle, &data) == 0);
+      _findclose(handle);
+   }
+#else
+   const std::string filePattern = glob.substr(dir.size());
+   DIR* dirHandle = opendir(dir.empty() ? "." : dir.c_str());
+   if (dirHandle) {
+      while (struct dirent* entry = readdir(dirHandle)) {
+         if (fnmatch(filePattern.c_str(), entry->d_name, 0) != 0) continue;
+         const std::string path = dir + entry->d_name;
+         if (stat(path.c_str(), &info) == 0 && !(info.st_mode & S_IFDIR)) result.push_back(path);
+      }
+      closedir(dirHandle);
+   }
+#endif
+
+   std::sort(result.begin(), result.end());
+   return result;
+}
+
+std::string jsonEscape (const std::string& str)
+{
+   std::ostringstream ostr;
+   for (size_t i = 0; i < str.size(); ++i) {
+      const char c = str[i];
+      switch (c) {
+         case '"': ostr << "\\\""; break;
+         case '\\': ostr << "\\\\"; break;
+         case '\n': ostr << "\\n"; break;
+         case '\r': ostr << "\\r"; break;
+         case '\t': ostr << "\\t"; break;
+         default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+               ostr << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+            } else {
+               ostr << c;
+            }
+      }
+   }
+   return ostr.str();
+}
+
+std::string expandFrameTokens (const std::string& path, int frame)
+{
+   std::string result;
+   for (size_t i = 0; i < path.size(); ++i) {
+      if (path[i] != '$' || i + 1 >= path.size() || path[i + 1] != 'F') {
+         result += path[i];
+         continue;
+      }
+      size_t end = i + 2;
+      int padding = 0;
+      if (end < path.size() && std::isdigit(static_cast<unsigned char>(path[end]))) {
+         padding = path[end] - '0';
+         ++end;
+      }
+      std::ostringstream ostr;
+      if (frame < 0) ostr << '-';
+      ostr << std::setw(padding) << std::setfill('0') << std::abs(frame);
+      result += ostr.str();
+      i = end - 1;
+   }
+   return result;
+}
+
 // Return a string representation of the given metadata key, value pairs
 std::string metadataAsString (const openvdb::MetaMap::ConstMetaIterator& begin, const openvdb::MetaMap::ConstMetaIterator& end, const std::string& indent)
 {
@@ -70,4 +265,18 @@ std::string metadataAsString (const openvdb::MetaMap::ConstMetaIterator& begin,
       sep[0] = '\n';
    }
    return ostr.str();
-}
\ No newline at end of file
+}
+
+std::string metadataAsJson (const openvdb::MetaMap::ConstMetaIterator& begin, const openvdb::MetaMap::ConstMetaIterator& end)
+{
+   std::ostringstream ostr;
+   ostr << "{";
+   for (openvdb::MetaMap::ConstMetaIterator it = begin; it != end; ++it) {
+      if (it != begin) ostr << ",";
+      ostr << "\"" << jsonEscape(it->first) << "\":\"";
+      if (it->second) ostr << jsonEscape(it->second->str());
+      ostr << "\"";
+   }
+   ostr << "}";
+   return ostr.str();
+}
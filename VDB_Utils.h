@@ -9,8 +9,9 @@
 #include <sstream>
 #include <string>
 #include <iterator>
-#include <vector>
-
+#include <vector>
+#include <ctime>
+
 #include <openvdb/openvdb.h>
 
 std::string bkgdValueAsString (const openvdb::GridBase::ConstPtr& grid);
@@ -21,7 +22,44 @@ std::string sizeAsString (openvdb::Index64 n, const std::string& units);
 
 std::string coordAsString (const openvdb::Coord ijk, const std::string& sep);
 
+// Split a list of grid names separated by spaces or commas
+std::vector<std::string> splitGridNames (const std::string& names);
+
+// Get the modification time of a file, returns false if it does not exist
+bool fileModTime (const std::string& path, std::time_t& mtime);
+
+// Get the size of a file in bytes, returns false if it does not exist
+bool fileSize (const std::string& path, openvdb::Index64& size);
+
+// Codecs exposed on the write ports
+enum VDB_Codec { kCodecNone = 0, kCodecZip = 1, kCodecBlosc = 2 };
+
+// Return the io::File compression flags for a codec, falls back to zip
+// when blosc is not available in this build of OpenVDB
+openvdb::Index32 compressionFlags (int codec);
+
+// Return shallow copies of the grids flagged to save their floating point
+// values as half, scalar and vector grids are controlled separately
+openvdb::GridCPtrVec gridsWithHalfFlags (const openvdb::GridCPtrVec& grids, bool halfScalars, bool halfVectors);
+
+// Return the full path of a file in the temporary directory
+std::string tempFilePath (const std::string& filename);
+
+// Return the files matching a glob pattern (* and ?) in sorted order, a
+// directory lists the .vdb files it contains and a plain path is returned as is
+std::vector<std::string> listFiles (const std::string& pattern);
+
+// Escape a string for use inside a JSON string literal
+std::string jsonEscape (const std::string& str);
+
+// Replace the $F frame tokens of a path, $F4 pads the frame to four digits
+std::string expandFrameTokens (const std::string& path, int frame);
+
 // Return a string representation of the given metadata key, value pairs
 std::string metadataAsString (const openvdb::MetaMap::ConstMetaIterator& begin, const openvdb::MetaMap::ConstMetaIterator& end, const std::string& indent = "");
 
+// Return a JSON object of the given metadata key, value pairs, the values
+// are written as strings
+std::string metadataAsJson (const openvdb::MetaMap::ConstMetaIterator& begin, const openvdb::MetaMap::ConstMetaIterator& end);
+
 #endif
@@ -0,0 +1,86 @@
+// OpenVDB_Softimage
+// VDB_VoxelOp.cpp
+// per voxel operations deferred on a primitive
+
+#include <xsi_application.h>
+
+#include <tbb/parallel_for.h>
+
+#include <openvdb/tree/LeafManager.h>
+
+#include <SeNoise.h>
+
+#include "VDB_VoxelOp.h"
+
+namespace
+{
+   struct ApplyOpsOp
+   {
+      typedef openvdb::tree::LeafManager<openvdb::FloatTree> LeafManagerT;
+
+      const VDB_VoxelOpList* ops;
+      const openvdb::math::Transform* xform;
+
+      void operator()(const LeafManagerT::LeafRange& range) const
+      {
+         const size_t opCount = ops->size();
+         for (LeafManagerT::LeafRange::Iterator leaf = range.begin(); leaf; ++leaf)
+         {
+            for (openvdb::FloatTree::LeafNodeType::ValueOnIter iter = leaf->beginValueOn(); iter; ++iter)
+            {
+               const openvdb::Vec3d pos = xform->indexToWorld(iter.getCoord());
+               float value = *iter;
+               for (size_t i=0; i<opCount; ++i)
+               {
+                  value = (*ops)[i]->Apply(pos, value);
+               }
+               iter.setValue(value);
+            }
+         }
+      }
+   };
+}
+
+float VDB_NoiseOp::Apply(const openvdb::Vec3d& pos, float value) const
+{
+   double result;
+   double p[3] = {pos.x(), pos.y(), pos.z()};
+   SeExpr::Noise<3,1>(p, &result);
+   return value + float(result);
+}
+
+VDB_FBMOp::VDB_FBMOp(int octaves, float lacunarity, float gain, bool turbulence)
+   : m_octaves(octaves)
+   , m_lacunarity(lacunarity)
+   , m_gain(gain)
+   , m_turbulence(turbulence)
+{
+}
+
+float VDB_FBMOp::Apply(const openvdb::Vec3d& pos, float value) const
+{
+   double result;
+   double p[3] = {pos.x(), pos.y(), pos.z()};
+   if (m_turbulence) SeExpr::FBM<3,1,true>(p, &result, m_octaves, m_lacunarity, m_gain);
+   else SeExpr::FBM<3,1,false>(p, &result, m_octaves, m_lacunarity, m_gain);
+   return value + float(result);
+}
+
+openvdb::GridBase::Ptr applyVoxelOps(const openvdb::GridBase& grid, const VDB_VoxelOpList& ops)
+{
+   if (!grid.isType<openvdb::FloatGrid>())
+   {
+      XSI::Application().LogMessage(L"[VDB_VoxelOp] operations need a float grid", XSI::siErrorMsg);
+      return grid.copyGrid();
+   }
+
+   openvdb::FloatGrid::Ptr result = static_cast<const openvdb::FloatGrid&>(grid).deepCopy();
+   if (ops.empty()) return result;
+
+   ApplyOpsOp op;
+   op.ops = &ops;
+   op.xform = &result->transform();
+   ApplyOpsOp::LeafManagerT leafs(result->tree());
+   tbb::parallel_for(leafs.leafRange(), op);
+   return result;
+}
@@ -0,0 +1,59 @@
+// OpenVDB_Softimage
+// VDB_VoxelOp.h
+// per voxel operations deferred on a primitive. nodes like VDB Noise, VDB FBM
+// and VDB Turbulence append an operation to the grid instead of running a
+// pass over it, the stacked operations run in a single leaf parallel pass
+// the first time a node asks for the values of the grid.
+
+#ifndef VDB_VOXELOP_H
+#define VDB_VOXELOP_H
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include <openvdb/openvdb.h>
+
+class VDB_VoxelOp
+{
+public:
+   typedef boost::shared_ptr<const VDB_VoxelOp> ConstPtr;
+
+   virtual ~VDB_VoxelOp() {}
+
+   // new value of an active voxel at the given world position, called from
+   // many threads at once
+   virtual float Apply(const openvdb::Vec3d& pos, float value) const = 0;
+};
+
+typedef std::vector<VDB_VoxelOp::ConstPtr> VDB_VoxelOpList;
+
+// adds SeExpr noise to the value
+class VDB_NoiseOp : public VDB_VoxelOp
+{
+public:
+   virtual float Apply(const openvdb::Vec3d& pos, float value) const;
+};
+
+// adds SeExpr fractal brownian motion, turbulence takes the absolute value
+// of each octave
+class VDB_FBMOp : public VDB_VoxelOp
+{
+public:
+   VDB_FBMOp(int octaves, float lacunarity, float gain, bool turbulence);
+
+   virtual float Apply(const openvdb::Vec3d& pos, float value) const;
+
+private:
+   double m_octaves;
+   double m_lacunarity;
+   double m_gain;
+   bool m_turbulence;
+};
+
+// copy of the float grid with the operations applied to its active voxels
+// in order, every voxel is transformed to world space once for all of them.
+// other grid types come back unchanged.
+openvdb::GridBase::Ptr applyVoxelOps(const openvdb::GridBase& grid, const VDB_VoxelOpList& ops);
+
+#endif
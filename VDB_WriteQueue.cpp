@@ -0,0 +1,186 @@
+// OpenVDB_Softimage
+// VDB_WriteQueue.cpp
+// background writer pool for VDB_Node_Write
+
+#include <algorithm>
+
+#include <tbb/tick_count.h>
+#include <tbb/task_scheduler_init.h>
+
+#include "VDB_WriteQueue.h"
+
+// compression keeps a writer busy on the CPU, one writer per two cores
+// overlaps it with the disk I/O of the others
+static const size_t kMinWriterThreads = 2;
+static const size_t kDefaultMaxPending = 4;
+
+VDB_WriteQueue& VDB_WriteQueue::Get()
+{
+   static VDB_WriteQueue queue;
+   return queue;
+}
+
+VDB_WriteQueue::VDB_WriteQueue()
+{
+   m_pending = 0;
+   m_completed = 0;
+   m_failed = 0;
+   m_nextOwner = 0;
+   m_jobs.set_capacity(kDefaultMaxPending);
+}
+
+VDB_WriteQueue::~VDB_WriteQueue()
+{
+   Shutdown();
+}
+
+void VDB_WriteQueue::Start()
+{
+   tbb::mutex::scoped_lock lock(m_threadsMutex);
+   if (!m_threads.empty()) return;
+
+   const size_t threadCount = std::max(kMinWriterThreads,
+      size_t(tbb::task_scheduler_init::default_num_threads() / 2));
+
+   Worker worker = { this };
+   for (size_t i=0; i<threadCount; ++i)
+   {
+      m_threads.push_back(new tbb::tbb_thread(worker));
+   }
+}
+
+size_t VDB_WriteQueue::NewOwner()
+{
+   // zero is never handed out
+   return ++m_nextOwner;
+}
+
+void VDB_WriteQueue::Submit(size_t owner, const std::string& path, const openvdb::GridCPtrVec& grids,
+   const openvdb::MetaMap& meta, openvdb::Index32 compression)
+{
+   Start();
+
+   Job* job = new Job;
+   job->owner = owner;
+   job->path = path;
+   job->grids = grids;
+   job->meta = meta;
+   job->compression = compression;
+
+   ++m_pending;
+   // backpressure, blocks the evaluation while the queue is full
+   m_jobs.push(job);
+}
+
+void VDB_WriteQueue::Run()
+{
+   for (;;)
+   {
+      Job* job = NULL;
+      m_jobs.pop(job);
+      // a null job tells the thread to stop
+      if (!job) return;
+
+      Write(*job);
+      delete job;
+      --m_pending;
+   }
+}
+
+void VDB_WriteQueue::Write(const Job& job)
+{
+   std::string error;
+   try
+   {
+      openvdb::io::File file(job.path);
+      file.setCompression(job.compression);
+      file.write(job.grids, job.meta);
+      file.close();
+   }
+   catch (openvdb::Exception& e)
+   {
+      error = e.what();
+   }
+   catch (std::exception& e)
+   {
+      error = e.what();
+   }
+
+   if (error.empty())
+   {
+      ++m_completed;
+      return;
+   }
+
+   ++m_failed;
+   Error jobError;
+   jobError.owner = job.owner;
+   jobError.message = job.path + " : " + error;
+   tbb::mutex::scoped_lock lock(m_errorsMutex);
+   m_errors.push_back(jobError);
+}
+
+void VDB_WriteQueue::Wait()
+{
+   while (m_pending > 0)
+   {
+      tbb::this_tbb_thread::sleep(tbb::tick_count::interval_t(0.01));
+   }
+}
+
+void VDB_WriteQueue::Shutdown()
+{
+   tbb::mutex::scoped_lock lock(m_threadsMutex);
+   if (m_threads.empty()) return;
+
+   Wait();
+   for (size_t i=0; i<m_threads.size(); ++i)
+   {
+      m_jobs.push(NULL);
+   }
+   for (size_t i=0; i<m_threads.size(); ++i)
+   {
+      m_threads[i]->join();
+      delete m_threads[i];
+   }
+   m_threads.clear();
+}
+
+VDB_WriteQueue::Status VDB_WriteQueue::GetStatus() const
+{
+   Status status;
+   status.pending = m_pending;
+   status.completed = m_completed;
+   status.failed = m_failed;
+   return status;
+}
+
+std::vector<std::string> VDB_WriteQueue::TakeErrors(size_t owner)
+{
+   std::vector<std::string> errors;
+   tbb::mutex::scoped_lock lock(m_errorsMutex);
+   std::vector<Error>::iterator kept = m_errors.begin();
+   for (std::vector<Error>::iterator it = m_errors.begin(); it != m_errors.end(); ++it)
+   {
+      if (it->owner == owner) errors.push_back(it->message);
+      else *kept++ = *it;
+   }
+   m_errors.erase(kept, m_errors.end());
+   return errors;
+}
+
+std::vector<std::string> VDB_WriteQueue::GetErrors() const
+{
+   std::vector<std::string> errors;
+   tbb::mutex::scoped_lock lock(m_errorsMutex);
+   for (size_t i=0; i<m_errors.size(); ++i)
+   {
+      errors.push_back(m_errors[i].message);
+   }
+   return errors;
+}
+
+void VDB_WriteQueue::SetMaxPending(size_t count)
+{
+   m_jobs.set_capacity(count > 0 ? count : 1);
+}
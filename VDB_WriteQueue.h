@@ -0,0 +1,94 @@
+// OpenVDB_Softimage
+// VDB_WriteQueue.h
+// background writer pool, ICE evaluation hands the grids over and continues
+// while compression and disk I/O happen on the writer threads
+
+#ifndef VDB_WRITEQUEUE_H
+#define VDB_WRITEQUEUE_H
+
+#include <string>
+#include <vector>
+
+#include <tbb/atomic.h>
+#include <tbb/mutex.h>
+#include <tbb/concurrent_queue.h>
+#include <tbb/tbb_thread.h>
+
+#include <openvdb/openvdb.h>
+
+class VDB_WriteQueue
+{
+public:
+   struct Status
+   {
+      size_t pending;
+      size_t completed;
+      size_t failed;
+   };
+
+   static VDB_WriteQueue& Get();
+
+   // identifies the node submitting jobs, its errors are reported to it only
+   size_t NewOwner();
+
+   // the job keeps references on the grids, they must not be modified
+   // afterwards. blocks while the maximum number of jobs is already queued.
+   void Submit(size_t owner, const std::string& path, const openvdb::GridCPtrVec& grids,
+      const openvdb::MetaMap& meta, openvdb::Index32 compression);
+
+   // blocks until every submitted job is written
+   void Wait();
+   // waits for the pending jobs and stops the writer threads
+   void Shutdown();
+
+   Status GetStatus() const;
+   // error messages of the failed jobs of the owner since the last call
+   std::vector<std::string> TakeErrors(size_t owner);
+   // error messages of every owner not taken yet, they stay in the queue
+   std::vector<std::string> GetErrors() const;
+
+   void SetMaxPending(size_t count);
+
+private:
+   VDB_WriteQueue();
+   ~VDB_WriteQueue();
+
+   struct Job
+   {
+      size_t owner;
+      std::string path;
+      openvdb::GridCPtrVec grids;
+      openvdb::MetaMap meta;
+      openvdb::Index32 compression;
+   };
+
+   void Start();
+   void Run();
+   void Write(const Job& job);
+
+   struct Worker
+   {
+      VDB_WriteQueue* queue;
+      void operator()() const { queue->Run(); }
+   };
+
+   tbb::concurrent_bounded_queue<Job*> m_jobs;
+   std::vector<tbb::tbb_thread*> m_threads;
+   tbb::mutex m_threadsMutex;
+
+   tbb::atomic<size_t> m_pending;
+   tbb::atomic<size_t> m_completed;
+   tbb::atomic<size_t> m_failed;
+   tbb::atomic<size_t> m_nextOwner;
+
+   struct Error
+   {
+      size_t owner;
+      std::string message;
+   };
+
+   mutable tbb::mutex m_errorsMutex;
+   std::vector<Error> m_errors;
+};
+
+#endif
@@ -13,11 +13,20 @@
 #include <xsi_doublearray.h>
 #include <xsi_longarray.h>
 
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
 #include <openvdb/openvdb.h>
 #include <openvdb/tools/MeshToVolume.h>
 #include <openvdb/tools/VolumeToMesh.h>
 
 #include "VDB_Utils.h"
+#include "VDB_Primitive.h"
+#include "VDB_GridRegistry.h"
+#include "VDB_WriteQueue.h"
+#include "VDB_DeltaSequence.h"
+#include "VDB_ReadCache.h"
+#include "VDB_Prefetcher.h"
 #include "VDB_Node_VolumeToMesh.h"
 #include "VDB_Node_MeshToVolume.h"
 #include "VDB_Node_TestCustomData.h"
@@ -25,6 +34,19 @@
 #include "VDB_Node_Turbulence.h"
 #include "VDB_Node_FBM.h"
 #include "VDB_Node_Write.h"
+#include "VDB_Node_Bundle.h"
+#include "VDB_Node_Read.h"
+#include "VDB_Node_CSG.h"
+#include "VDB_Node_Filter.h"
+#include "VDB_Node_Advect.h"
+#include "VDB_Node_Sample.h"
+#include "VDB_Node_RayIntersect.h"
+#include "VDB_Node_Segment.h"
+#include "VDB_Node_Compact.h"
+#include "VDB_Node_VoxelsToPoints.h"
+#include "VDB_Node_TopologyPreview.h"
+#include "VDB_Node_Expression.h"
+#include "VDB_ProxyMode.h"
 
 using namespace XSI;
 //using namespace XSI::MATH;
@@ -39,6 +61,17 @@ SICALLBACK XSILoadPlugin (PluginRegistrar& reg)
    reg.RegisterCommand(L"openvdb_print", L"openvdb_print");
    reg.RegisterCommand(L"openvdb_volumeToMesh", L"openvdb_volumeToMesh");
    reg.RegisterCommand(L"openvdb_meshToVolume", L"openvdb_meshToVolume");
+   reg.RegisterCommand(L"openvdb_memoryUsage", L"openvdb_memoryUsage");
+   reg.RegisterCommand(L"openvdb_memoryBudget", L"openvdb_memoryBudget");
+   reg.RegisterCommand(L"openvdb_writeStatus", L"openvdb_writeStatus");
+   reg.RegisterCommand(L"openvdb_readCache", L"openvdb_readCache");
+   reg.RegisterCommand(L"openvdb_benchmark", L"openvdb_benchmark");
+   reg.RegisterCommand(L"openvdb_proxyMode", L"openvdb_proxyMode");
+
+   // proxy mode refines after the interaction and renders at full resolution
+   reg.RegisterTimerEvent(L"openvdb_proxyIdle", 250, 0);
+   reg.RegisterEvent(L"openvdb_proxyBeginFrame", siOnBeginFrame);
+   reg.RegisterEvent(L"openvdb_proxyEndFrame", siOnEndFrame);
    
    // ice nodes
    VDB_Node_VolumeToMesh::Register(reg);
@@ -48,15 +81,111 @@ SICALLBACK XSILoadPlugin (PluginRegistrar& reg)
    VDB_Node_Turbulence::Register(reg);
    VDB_Node_FBM::Register(reg);
    VDB_Node_Write::Register(reg);
+   VDB_Node_Bundle::Register(reg);
+   VDB_Node_Read::Register(reg);
+   VDB_Node_CSG::Register(reg);
+   VDB_Node_Filter::Register(reg);
+   VDB_Node_Advect::Register(reg);
+   VDB_Node_Sample::Register(reg);
+   VDB_Node_RayIntersect::Register(reg);
+   VDB_Node_Segment::Register(reg);
+   VDB_Node_Compact::Register(reg);
+   VDB_Node_VoxelsToPoints::Register(reg);
+   VDB_Node_TopologyPreview::Register(reg);
+   VDB_Node_Expression::Register(reg);
 
    return CStatus::OK;
 }
 
 SICALLBACK XSIUnloadPlugin (const PluginRegistrar& reg)
 {
+   // let the background writes finish before the grids go away
+   VDB_WriteQueue::Get().Shutdown();
+   VDB_Prefetcher::Get().Shutdown();
+
+   // free whatever grids the ICE graph did not release
+   VDB_GridRegistry::Get().Clear();
+   VDB_DeltaReader::Get().Clear();
+   VDB_ReadCache::Get().Clear();
    return CStatus::OK;
 }
 
+// grid descriptor, transform and metadata of a grid read without its tree
+static std::string gridHeaderAsJson (const openvdb::GridBase& grid)
+{
+   std::ostringstream ostr;
+   ostr << "{\"name\":\"" << jsonEscape(grid.getName()) << "\"";
+   ostr << ",\"type\":\"" << jsonEscape(grid.valueType()) << "\"";
+   ostr << ",\"class\":\"" << openvdb::GridBase::gridClassToString(grid.getGridClass()) << "\"";
+
+   const openvdb::Vec3d voxelSize = grid.voxelSize();
+   ostr << ",\"voxelSize\":[" << voxelSize[0] << "," << voxelSize[1] << "," << voxelSize[2] << "]";
+   ostr << ",\"saveFloatAsHalf\":" << (grid.saveFloatAsHalf() ? "true" : "false");
+
+   // statistics stored in the file when the grid was written
+   openvdb::Vec3IMetadata::ConstPtr bboxMin = grid.getMetadata<openvdb::Vec3IMetadata>(openvdb::GridBase::META_FILE_BBOX_MIN);
+   openvdb::Vec3IMetadata::ConstPtr bboxMax = grid.getMetadata<openvdb::Vec3IMetadata>(openvdb::GridBase::META_FILE_BBOX_MAX);
+   if (bboxMin && bboxMax)
+   {
+      const openvdb::Vec3i& bmin = bboxMin->value();
+      const openvdb::Vec3i& bmax = bboxMax->value();
+      ostr << ",\"bboxMin\":[" << bmin[0] << "," << bmin[1] << "," << bmin[2] << "]";
+      ostr << ",\"bboxMax\":[" << bmax[0] << "," << bmax[1] << "," << bmax[2] << "]";
+   }
+   openvdb::Int64Metadata::ConstPtr voxelCount = grid.getMetadata<openvdb::Int64Metadata>(openvdb::GridBase::META_FILE_VOXEL_COUNT);
+   if (voxelCount) ostr << ",\"activeVoxelCount\":" << voxelCount->value();
+   openvdb::Int64Metadata::ConstPtr memBytes = grid.getMetadata<openvdb::Int64Metadata>(openvdb::GridBase::META_FILE_MEM_BYTES);
+   if (memBytes) ostr << ",\"memBytes\":" << memBytes->value();
+
+   ostr << ",\"metadata\":" << metadataAsJson(grid.beginMeta(), grid.endMeta());
+   ostr << "}";
+   return ostr.str();
+}
+
+// reads the file header and the grid descriptors only, never the trees
+static std::string fileHeadersAsJson (const std::string& path)
+{
+   std::ostringstream ostr;
+   ostr << "{\"file\":\"" << jsonEscape(path) << "\"";
+   try
+   {
+      openvdb::io::File file(path);
+      file.open();
+      openvdb::MetaMap::Ptr meta = file.getMetadata();
+      openvdb::GridPtrVecPtr grids = file.readAllGridMetadata();
+      file.close();
+
+      if (meta) ostr << ",\"metadata\":" << metadataAsJson(meta->beginMeta(), meta->endMeta());
+      ostr << ",\"grids\":[";
+      for (size_t i=0; grids && i<grids->size(); ++i)
+      {
+         if (i) ostr << ",";
+         ostr << gridHeaderAsJson(*(*grids)[i]);
+      }
+      ostr << "]";
+   }
+   catch (openvdb::Exception& e)
+   {
+      ostr << ",\"error\":\"" << jsonEscape(e.what()) << "\"";
+   }
+   ostr << "}";
+   return ostr.str();
+}
+
+struct FileHeadersOp
+{
+   const std::vector<std::string>* files;
+   std::vector<std::string>* results;
+
+   void operator()(const tbb::blocked_range<size_t>& range) const
+   {
+      for (size_t i = range.begin(); i != range.end(); ++i)
+      {
+         (*results)[i] = fileHeadersAsJson((*files)[i]);
+      }
+   }
+};
+
 SICALLBACK openvdb_print_Init (CRef& ref)
 {
    Context ctxt(ref);
@@ -69,6 +198,9 @@ SICALLBACK openvdb_print_Init (CRef& ref)
    oArgs = oCmd.GetArguments();
    oArgs.Add(L"file", CString());
    oArgs.Add(L"metadata", false);
+   // returns a JSON array describing every file matching a directory or a
+   // glob, only the headers are read
+   oArgs.Add(L"headersOnly", false);
    return CStatus::OK;
 }
 
@@ -78,6 +210,7 @@ SICALLBACK openvdb_print_Execute (CRef& ref)
    CValueArray args = ctxt.GetAttribute(L"Arguments");
    CString filename = args[0];
    bool printMetadata = args[1];
+   bool headersOnly = args[2];
 
    if (filename.IsEmpty())
    {
@@ -88,22 +221,51 @@ SICALLBACK openvdb_print_Execute (CRef& ref)
 
    openvdb::initialize();
 
-   openvdb::GridPtrVecPtr grids;
-   openvdb::MetaMap::Ptr meta;
-
-   openvdb::io::File file(filename.GetAsciiString());
-   try
+   if (headersOnly)
    {
-      file.open();
-      grids = file.getGrids();
-      meta = file.getMetadata();
-      file.close();
+      std::vector<std::string> files = listFiles(filename.GetAsciiString());
+      if (files.empty())
+      {
+         Application().LogMessage(L"No files matching " + filename, siErrorMsg);
+         ctxt.PutAttribute(L"ReturnValue", CString());
+         return CStatus::Fail;
+      }
+
+      // each file is opened on its own thread, the latency of network
+      // storage overlaps
+      std::vector<std::string> results(files.size());
+      FileHeadersOp op = { &files, &results };
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, files.size(), 1), op);
+
+      std::string json("[");
+      for (size_t i=0; i<results.size(); ++i)
+      {
+         if (i) json += ",";
+         json += results[i];
+      }
+      json += "]";
+
+      Application().LogMessage(CValue((ULONG)files.size()).GetAsText() + L" files inspected");
+      ctxt.PutAttribute(L"ReturnValue", CString(json.c_str()));
+      return CStatus::OK;
    }
-   catch (openvdb::Exception& e)
+
+   // printing the same file again is served from the read cache
+   VDB_ReadCache& cache = VDB_ReadCache::Get();
+   const std::string path(filename.GetAsciiString());
+
+   std::vector<std::string> gridNames;
+   openvdb::MetaMap::ConstPtr meta;
+   openvdb::GridCPtrVec grids;
+   if (cache.GetFileInfo(path, gridNames, meta))
    {
-      Application().LogMessage(CString(e.what()) + L" : " + filename);
+      for (size_t i=0; i<gridNames.size(); ++i)
+      {
+         openvdb::GridBase::ConstPtr grid = cache.GetGrid(path, gridNames[i]);
+         if (grid) grids.push_back(grid);
+      }
    }
-   if (!grids)
+   if (grids.empty())
    {
       Application().LogMessage(L"No grids in %s", siErrorMsg);
       ctxt.PutAttribute(L"ReturnValue", false);
@@ -116,7 +278,7 @@ SICALLBACK openvdb_print_Execute (CRef& ref)
       Application().LogMessage(metadataStr);
    }
 
-   for (openvdb::GridPtrVec::const_iterator it = grids->begin(); it != grids->end(); ++it)
+   for (openvdb::GridCPtrVec::const_iterator it = grids.begin(); it != grids.end(); ++it)
    {
       const openvdb::GridBase::ConstPtr grid = *it;
       if (!grid) continue;
@@ -124,18 +286,27 @@ SICALLBACK openvdb_print_Execute (CRef& ref)
       // grid name and data type
       CString gridName(grid->getName().c_str());
       CString gridType(grid->valueType().c_str());
+
+      // bounds, voxel count, memory and value range in one parallel pass
+      VDB_Primitive vdbPrim;
+      vdbPrim.SetGrid(*grid);
+      const VDB_GridStats stats = vdbPrim.GetStats();
       
       // grid dimensions
-      openvdb::CoordBBox bbox = grid->evalActiveVoxelBoundingBox();
-      CString dimensions(coordAsString(bbox.extents(), "x").c_str());
+      CString dimensions(coordAsString(stats.bbox.extents(), "x").c_str());
       
       // grid active voxel count
-      CString voxelCount(sizeAsString(grid->activeVoxelCount(), " Voxels").c_str());
+      CString voxelCount(sizeAsString(stats.activeVoxelCount, " Voxels").c_str());
 
       // grid size in bytes
-      CString gridSizeInBytes(bytesAsString(grid->memUsage()).c_str());
+      CString gridSizeInBytes(bytesAsString(stats.memUsage).c_str());
 
-      Application().LogMessage(gridName + "\t" + gridType + "\t" + dimensions + "\t" + voxelCount + "\t" + gridSizeInBytes);
+      CString line(gridName + "\t" + gridType + "\t" + dimensions + "\t" + voxelCount + "\t" + gridSizeInBytes);
+      if (stats.hasValueRange)
+      {
+         line += "\t" + CValue(stats.minValue).GetAsText() + " to " + CValue(stats.maxValue).GetAsText();
+      }
+      Application().LogMessage(line);
       if (printMetadata)
       {
          CString bkgValue(bkgdValueAsString(grid).c_str());
@@ -155,37 +326,6 @@ SICALLBACK openvdb_print_Execute (CRef& ref)
    return CStatus::OK;
 }
 
-SICALLBACK openvdb_volumeToMesh_Init (CRef& ref)
-{
-   Context ctxt(ref);
-   Command oCmd;
-   oCmd = ctxt.GetSource();
-   oCmd.PutDescription(L"mesh a scalar grid from an input openvdb file(.vdb)");
-   oCmd.EnableReturnValue(true);
-
-   ArgumentArray oArgs;
-   oArgs = oCmd.GetArguments();
-   oArgs.Add(L"file", CString());
-   oArgs.Add(L"gridName", CString());
-   return CStatus::OK;
-}
-
-SICALLBACK openvdb_volumeToMesh_Execute (CRef& ref)
-{
-   Context ctxt(ref);
-   CValueArray args = ctxt.GetAttribute(L"Arguments");
-   CString filename = args[0];
-
-   if (filename.IsEmpty())
-   {
-      Application().LogMessage(L"No file name provided!", siErrorMsg);
-      ctxt.PutAttribute(L"ReturnValue", false);
-      return CStatus::Fail;
-   }
-
-   return CStatus::OK;
-}
-
 SICALLBACK openvdb_meshToVolume_Init (CRef& ref)
 {
    Context ctxt(ref);
@@ -284,3 +424,146 @@ SICALLBACK openvdb_meshToVolume_Execute (CRef& ref)
    return CStatus::OK;
 }
 
+
+SICALLBACK openvdb_memoryUsage_Init (CRef& ref)
+{
+   Context ctxt(ref);
+   Command oCmd;
+   oCmd = ctxt.GetSource();
+   oCmd.PutDescription(L"report the memory held by all grids living in the ICE graph");
+   oCmd.EnableReturnValue(true);
+   return CStatus::OK;
+}
+
+SICALLBACK openvdb_memoryUsage_Execute (CRef& ref)
+{
+   Context ctxt(ref);
+
+   VDB_GridRegistry& registry = VDB_GridRegistry::Get();
+   openvdb::Index64 memUsage = registry.GetMemUsage();
+
+   CString gridCount(CValue((ULONG)registry.GetCount()).GetAsText());
+   CString spilledCount(CValue((ULONG)registry.GetSpilledCount()).GetAsText());
+   CString memSize(bytesAsString(memUsage).c_str());
+   Application().LogMessage(gridCount + L" live primitives\t" + spilledCount + L" spilled to disk\t" + memSize);
+
+   ctxt.PutAttribute(L"ReturnValue", double(memUsage));
+   return CStatus::OK;
+}
+
+SICALLBACK openvdb_memoryBudget_Init (CRef& ref)
+{
+   Context ctxt(ref);
+   Command oCmd;
+   oCmd = ctxt.GetSource();
+   oCmd.PutDescription(L"set the memory budget for grids living in the ICE graph, grids over budget are spilled to disk");
+   oCmd.EnableReturnValue(true);
+
+   ArgumentArray oArgs;
+   oArgs = oCmd.GetArguments();
+   // negative leaves the budget untouched, zero means unlimited
+   oArgs.Add(L"megabytes", -1.0);
+   return CStatus::OK;
+}
+
+SICALLBACK openvdb_memoryBudget_Execute (CRef& ref)
+{
+   Context ctxt(ref);
+   CValueArray args = ctxt.GetAttribute(L"Arguments");
+   double megabytes = args[0];
+
+   VDB_GridRegistry& registry = VDB_GridRegistry::Get();
+   if (megabytes >= 0.0)
+   {
+      registry.SetMemoryBudget(openvdb::Index64(megabytes * double(1 << 20)));
+   }
+
+   openvdb::Index64 budget = registry.GetMemoryBudget();
+   CString budgetStr(budget ? bytesAsString(budget).c_str() : "unlimited");
+   Application().LogMessage(L"memory budget\t" + budgetStr);
+
+   ctxt.PutAttribute(L"ReturnValue", double(budget) / double(1 << 20));
+   return CStatus::OK;
+}
+
+SICALLBACK openvdb_writeStatus_Init (CRef& ref)
+{
+   Context ctxt(ref);
+   Command oCmd;
+   oCmd = ctxt.GetSource();
+   oCmd.PutDescription(L"report the progress of the background writes of VDB Write nodes");
+   oCmd.EnableReturnValue(true);
+
+   ArgumentArray oArgs;
+   oArgs = oCmd.GetArguments();
+   oArgs.Add(L"wait", false);
+   return CStatus::OK;
+}
+
+SICALLBACK openvdb_writeStatus_Execute (CRef& ref)
+{
+   Context ctxt(ref);
+   CValueArray args = ctxt.GetAttribute(L"Arguments");
+   bool wait = args[0];
+
+   VDB_WriteQueue& queue = VDB_WriteQueue::Get();
+   if (wait) queue.Wait();
+
+   // the errors stay queued for the Write nodes that submitted the jobs
+   std::vector<std::string> errors = queue.GetErrors();
+   for (size_t i=0; i<errors.size(); ++i)
+   {
+      Application().LogMessage(CString(errors[i].c_str()), siErrorMsg);
+   }
+
+   VDB_WriteQueue::Status status = queue.GetStatus();
+   Application().LogMessage(CValue((ULONG)status.pending).GetAsText() + L" pending\t"
+      + CValue((ULONG)status.completed).GetAsText() + L" completed\t"
+      + CValue((ULONG)status.failed).GetAsText() + L" failed");
+
+   // true once everything submitted so far has been written without error
+   ctxt.PutAttribute(L"ReturnValue", status.pending == 0 && status.failed == 0);
+   return CStatus::OK;
+}
+
+SICALLBACK openvdb_readCache_Init (CRef& ref)
+{
+   Context ctxt(ref);
+   Command oCmd;
+   oCmd = ctxt.GetSource();
+   oCmd.PutDescription(L"report and configure the cache of grids read from .vdb files");
+   oCmd.EnableReturnValue(true);
+
+   ArgumentArray oArgs;
+   oArgs = oCmd.GetArguments();
+   // negative leaves the budget untouched, zero means unlimited
+   oArgs.Add(L"megabytes", -1.0);
+   oArgs.Add(L"clear", false);
+   return CStatus::OK;
+}
+
+SICALLBACK openvdb_readCache_Execute (CRef& ref)
+{
+   Context ctxt(ref);
+   CValueArray args = ctxt.GetAttribute(L"Arguments");
+   double megabytes = args[0];
+   bool clear = args[1];
+
+   VDB_ReadCache& cache = VDB_ReadCache::Get();
+   if (clear) cache.Clear();
+   if (megabytes >= 0.0)
+   {
+      cache.SetMemoryBudget(openvdb::Index64(megabytes * double(1 << 20)));
+   }
+
+   openvdb::Index64 memUsage = cache.GetMemUsage();
+   openvdb::Index64 budget = cache.GetMemoryBudget();
+   CString budgetStr(budget ? bytesAsString(budget).c_str() : "unlimited");
+   Application().LogMessage(CValue((ULONG)cache.GetCount()).GetAsText() + L" cached grids\t"
+      + CString(bytesAsString(memUsage).c_str()) + L" of " + budgetStr + L"\t"
+      + CValue((ULONG)cache.GetHits()).GetAsText() + L" hits\t"
+      + CValue((ULONG)cache.GetMisses()).GetAsText() + L" misses");
+
+   ctxt.PutAttribute(L"ReturnValue", double(memUsage));
+   return CStatus::OK;
+}